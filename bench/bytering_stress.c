@@ -0,0 +1,140 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Multi-producer stress test for the timer byte ring.
+// Each producer keeps at most MAX_IN_FLIGHT records queued, and the ring is sized
+// so that every producer's records fit at once. A push can therefore never find
+// the ring genuinely full, so any rejected push is a failure. The consumer checks
+// that each producer's records arrive whole and in order.
+//
+// Built standalone (make bench/bytering_stress); takes an optional record count per producer.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "../bytering.h"
+
+#define PRODUCERS 4
+#define MAX_IN_FLIGHT 4
+#define MAX_PAYLOAD 27
+#define RECORD_BYTES 32
+
+struct producer
+{
+    pthread_t thread;
+    uint8_t id;
+    uint32_t sent;
+
+    // Updated by the consumer
+    uint32_t received;
+};
+
+static struct bytering *ring;
+static struct producer producers[PRODUCERS];
+static uint32_t records_per_producer = 200000;
+
+static void fail(const char *message)
+{
+    fprintf(stderr, "FAILED: %s\n", message);
+    abort();
+}
+
+// Payload is the producer id, a sequence number, and
+// a variable number of filler bytes derived from both
+static size_t encode(uint8_t *out, uint8_t id, uint32_t sequence)
+{
+    size_t length = 5 + sequence % (MAX_PAYLOAD - 4);
+    out[0] = id;
+    memcpy(&out[1], &sequence, sizeof(uint32_t));
+    for (size_t i = 5; i < length; i++)
+        out[i] = (uint8_t)(id + sequence + i);
+
+    return length;
+}
+
+static void *producer_thread(void *_producer)
+{
+    struct producer *p = _producer;
+    uint8_t data[MAX_PAYLOAD];
+
+    while (p->sent < records_per_producer)
+    {
+        if (p->sent - __atomic_load_n(&p->received, __ATOMIC_ACQUIRE) >= MAX_IN_FLIGHT)
+        {
+            sched_yield();
+            continue;
+        }
+
+        size_t length = encode(data, p->id, p->sent);
+        if (!bytering_push(ring, data, length))
+            fail("push rejected while the ring had space");
+
+        p->sent++;
+    }
+
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        records_per_producer = strtoul(argv[1], NULL, 10);
+
+    ring = bytering_create(PRODUCERS*MAX_IN_FLIGHT*RECORD_BYTES);
+    if (!ring)
+        fail("couldn't create ring");
+
+    for (uint8_t i = 0; i < PRODUCERS; i++)
+    {
+        producers[i].id = i;
+        if (pthread_create(&producers[i].thread, NULL, producer_thread, &producers[i]))
+            fail("couldn't create producer thread");
+    }
+
+    // Popped records are concatenated, but each one's length
+    // can be recovered from the id and sequence at its start
+    uint8_t records[PRODUCERS*MAX_IN_FLIGHT*MAX_PAYLOAD];
+    uint8_t expected[MAX_PAYLOAD];
+    uint64_t total = (uint64_t)PRODUCERS*records_per_producer;
+    for (uint64_t popped = 0; popped < total;)
+    {
+        size_t length = bytering_pop(ring, records, sizeof(records));
+        if (length == 0)
+            sched_yield();
+
+        for (size_t offset = 0; offset < length;)
+        {
+            uint8_t *record = &records[offset];
+            if (length - offset < 5 || record[0] >= PRODUCERS)
+                fail("malformed record");
+
+            struct producer *p = &producers[record[0]];
+            uint32_t sequence;
+            memcpy(&sequence, &record[1], sizeof(uint32_t));
+            if (sequence != p->received)
+                fail("record out of order");
+
+            size_t record_length = encode(expected, p->id, sequence);
+            if (record_length > length - offset || memcmp(expected, record, record_length))
+                fail("record corrupted");
+
+            __atomic_store_n(&p->received, sequence + 1, __ATOMIC_RELEASE);
+            offset += record_length;
+            popped++;
+        }
+    }
+
+    for (size_t i = 0; i < PRODUCERS; i++)
+        pthread_join(producers[i].thread, NULL);
+
+    bytering_destroy(ring);
+    printf("%d producers pushed %u records each without a spurious full ring.\n", PRODUCERS, records_per_producer);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Measures the write throughput and compression ratio of each OutputCodec.
+// Usage: codec_bench [-o output_dir] [frame.fits ...]
+// Frames are read from the given FITS files (use frames from your own camera
+// for representative numbers); a synthetic noisy bias frame is used if none are given.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <fitsio.h>
+#include "../preferences.h"
+
+#define ITERATIONS 5
+
+// Defined here to avoid linking preferences.c
+const char *pn_output_codec_suffix(unsigned char codec)
+{
+    switch (codec)
+    {
+        case CODEC_RICE:
+        case CODEC_HCOMPRESS:
+            return ".fits.fz";
+        case CODEC_NONE:
+            return ".fits";
+        case CODEC_GZIP:
+        default:
+            return ".fits.gz";
+    }
+}
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct
+{
+    char *name;
+    uint16_t *data;
+    long width;
+    long height;
+} Frame;
+
+static int load_frame(const char *path, Frame *frame)
+{
+    fitsfile *fptr;
+    int status = 0;
+    int naxis;
+    long size[2];
+    if (fits_open_image(&fptr, path, READONLY, &status) ||
+        fits_get_img_dim(fptr, &naxis, &status) || naxis != 2 ||
+        fits_get_img_size(fptr, 2, size, &status))
+    {
+        fprintf(stderr, "Failed to open `%s' (status %d)\n", path, status);
+        return 1;
+    }
+
+    frame->name = strdup(path);
+    frame->width = size[0];
+    frame->height = size[1];
+    frame->data = malloc(size[0]*size[1]*sizeof(uint16_t));
+    fits_read_img(fptr, TUSHORT, 1, size[0]*size[1], NULL, frame->data, NULL, &status);
+    fits_close_file(fptr, &status);
+    return status;
+}
+
+// Bias level with read noise and a scattering of stars
+static void synthetic_frame(Frame *frame)
+{
+    frame->name = strdup("synthetic 1024x1024");
+    frame->width = frame->height = 1024;
+    frame->data = malloc(1024*1024*sizeof(uint16_t));
+
+    for (size_t i = 0; i < 1024*1024; i++)
+    {
+        double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+        double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+        frame->data[i] = 1000 + 10*sqrt(-2*log(u))*cos(2*M_PI*v);
+    }
+
+    for (int s = 0; s < 100; s++)
+    {
+        int cx = rand() % 1024, cy = rand() % 1024;
+        double peak = rand() % 30000;
+        for (int y = cy - 8; y <= cy + 8; y++)
+            for (int x = cx - 8; x <= cx + 8; x++)
+                if (x >= 0 && x < 1024 && y >= 0 && y < 1024)
+                {
+                    double r2 = (x - cx)*(x - cx) + (y - cy)*(y - cy);
+                    double value = frame->data[y*1024 + x] + peak*exp(-r2 / 8);
+                    frame->data[y*1024 + x] = value > 65535 ? 65535 : value;
+                }
+    }
+}
+
+// Matches the codec handling in frame_save()
+static int write_frame(Frame *frame, const char *path, uint8_t codec)
+{
+    fitsfile *fptr;
+    int status = 0;
+
+    remove(path);
+    if (fits_create_file(&fptr, path, &status))
+        return status;
+
+    if (codec == CODEC_RICE)
+        fits_set_compression_type(fptr, RICE_1, &status);
+    else if (codec == CODEC_HCOMPRESS)
+    {
+        fits_set_compression_type(fptr, HCOMPRESS_1, &status);
+        fits_set_hcomp_scale(fptr, 0, &status);
+    }
+
+    long size[2] = { frame->width, frame->height };
+    fits_create_img(fptr, USHORT_IMG, 2, size, &status);
+    fits_write_img(fptr, TUSHORT, 1, frame->width*frame->height, frame->data, &status);
+    fits_close_file(fptr, &status);
+    return status;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *output_dir = ".";
+    Frame *frames = calloc(argc + 1, sizeof(Frame));
+    size_t frame_count = 0;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output_dir = argv[++i];
+        else if (load_frame(argv[i], &frames[frame_count]) == 0)
+            frame_count++;
+    }
+
+    if (frame_count == 0)
+        synthetic_frame(&frames[frame_count++]);
+
+    const char *codec_names[] = {"gzip", "rice", "hcompress", "none"};
+    const uint8_t codecs[] = {CODEC_GZIP, CODEC_RICE, CODEC_HCOMPRESS, CODEC_NONE};
+
+    printf("%-30s %-10s %10s %8s\n", "frame", "codec", "MB/s", "ratio");
+    for (size_t f = 0; f < frame_count; f++)
+    {
+        double raw_bytes = frames[f].width*frames[f].height*sizeof(uint16_t);
+        for (size_t c = 0; c < sizeof(codecs) / sizeof(codecs[0]); c++)
+        {
+            char path[1024];
+            snprintf(path, 1024, "%s/codec_bench%s", output_dir, pn_output_codec_suffix(codecs[c]));
+
+            int status = 0;
+            double start = now();
+            for (size_t i = 0; i < ITERATIONS && !status; i++)
+                status = write_frame(&frames[f], path, codecs[c]);
+            double elapsed = (now() - start) / ITERATIONS;
+
+            struct stat st;
+            if (status || stat(path, &st))
+            {
+                printf("%-30s %-10s %10s %8s (cfitsio status %d)\n", frames[f].name, codec_names[c], "-", "-", status);
+                continue;
+            }
+
+            printf("%-30s %-10s %10.1f %8.2f\n", frames[f].name, codec_names[c],
+                   raw_bytes / elapsed / 1e6, raw_bytes / st.st_size);
+            remove(path);
+        }
+
+        free(frames[f].name);
+        free(frames[f].data);
+    }
+
+    free(frames);
+    return 0;
+}
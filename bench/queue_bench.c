@@ -0,0 +1,112 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Compares the linked-list atomicqueue with the SPSC ringbuffer
+// used for the frame and trigger queues.
+// For each backlog size the queue is pre-filled, and then the cost of
+// a push + pop + length (the work done per frame) is measured in steady state.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../atomicqueue.h"
+#include "../ringbuffer.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Keep total work roughly constant so the O(n) cases finish in reasonable time
+static size_t iterations_for_backlog(size_t backlog)
+{
+    size_t n = 100000000 / (backlog + 1);
+    if (n < 200)
+        n = 200;
+    if (n > 2000000)
+        n = 2000000;
+    return n;
+}
+
+static double bench_atomicqueue(size_t backlog, size_t iterations)
+{
+    struct atomicqueue *queue = atomicqueue_create();
+    if (!queue)
+        return -1;
+
+    static int dummy;
+    for (size_t i = 0; i < backlog; i++)
+        atomicqueue_push(queue, &dummy);
+
+    size_t checksum = 0;
+    double start = now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        atomicqueue_push(queue, &dummy);
+        checksum += atomicqueue_length(queue);
+        atomicqueue_pop(queue);
+        checksum += atomicqueue_length(queue);
+    }
+    double elapsed = now() - start;
+
+    while (atomicqueue_pop(queue));
+    atomicqueue_destroy(queue);
+
+    if (checksum != iterations*(2*backlog + 1))
+        fprintf(stderr, "atomicqueue: unexpected length\n");
+
+    return elapsed * 1e9 / iterations;
+}
+
+static double bench_ringbuffer(size_t backlog, size_t iterations)
+{
+    struct ringbuffer *ring = ringbuffer_create(backlog + 1);
+    if (!ring)
+        return -1;
+
+    static int dummy;
+    for (size_t i = 0; i < backlog; i++)
+        ringbuffer_push(ring, &dummy);
+
+    size_t checksum = 0;
+    double start = now();
+    for (size_t i = 0; i < iterations; i++)
+    {
+        ringbuffer_push(ring, &dummy);
+        checksum += ringbuffer_length(ring);
+        ringbuffer_pop(ring);
+        checksum += ringbuffer_length(ring);
+    }
+    double elapsed = now() - start;
+
+    while (ringbuffer_pop(ring));
+    ringbuffer_destroy(ring);
+
+    if (checksum != iterations*(2*backlog + 1))
+        fprintf(stderr, "ringbuffer: unexpected length\n");
+
+    return elapsed * 1e9 / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t backlogs[] = {10, 1000, 100000};
+
+    printf("ns per push + pop + 2x length at a steady backlog\n");
+    printf("%10s %16s %16s %10s\n", "backlog", "atomicqueue", "ringbuffer", "speedup");
+    for (size_t i = 0; i < sizeof(backlogs) / sizeof(backlogs[0]); i++)
+    {
+        double list = bench_atomicqueue(backlogs[i], iterations_for_backlog(backlogs[i]));
+        double ring = bench_ringbuffer(backlogs[i], iterations_for_backlog(0));
+        printf("%10zu %16.1f %16.1f %9.0fx\n", backlogs[i], list, ring, list / ring);
+    }
+
+    return 0;
+}
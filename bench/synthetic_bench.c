@@ -0,0 +1,101 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Measures the frame rate of the simulated camera's synthetic frame generator
+// against the rand() fill it replaced, and checks that rendering in row bands
+// (as the simulated camera does across threads) matches rendering in one pass.
+// The statistics of a bias frame are printed as a sanity check of the noise model.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../synthetic_frame.h"
+
+#define ITERATIONS 50
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void rand_fill(uint16_t *data, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++)
+        data[i] = rand() % 10000;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint16_t sizes[] = {512, 1024, 2048};
+    printf("%6s %14s %14s %9s\n", "size", "rand() (fps)", "synthetic (fps)", "speedup");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        uint16_t size = sizes[s];
+        size_t pixels = (size_t)size*size;
+        uint16_t *a = malloc(pixels*sizeof(uint16_t));
+        uint16_t *b = malloc(pixels*sizeof(uint16_t));
+        struct synthetic_frame *sky = synthetic_frame_new(size, size, 1);
+        if (!a || !b || !sky)
+        {
+            fprintf(stderr, "allocation failed\n");
+            return 1;
+        }
+
+        double start = now();
+        for (size_t i = 0; i < ITERATIONS; i++)
+            rand_fill(a, pixels);
+        double original = (now() - start) / ITERATIONS;
+
+        start = now();
+        for (size_t i = 0; i < ITERATIONS; i++)
+        {
+            synthetic_frame_step(sky);
+            synthetic_frame_render(sky, a, false, 0, size);
+        }
+        double synthetic = (now() - start) / ITERATIONS;
+
+        printf("%6d %14.1f %14.1f %8.1fx\n", size, 1 / original, 1 / synthetic, original / synthetic);
+
+        // Uneven bands must reproduce the single pass exactly
+        for (uint16_t row = 0; row < size; row += 37)
+            synthetic_frame_render(sky, b, false, row, row + 37 < size ? row + 37 : size);
+
+        if (memcmp(a, b, pixels*sizeof(uint16_t)))
+        {
+            fprintf(stderr, "banded render differs for %dx%d\n", size, size);
+            return 1;
+        }
+
+        synthetic_frame_free(sky);
+        free(b);
+
+        if (s == 0)
+        {
+            sky = synthetic_frame_new(size, size, 1);
+            synthetic_frame_render(sky, a, true, 0, size);
+            double sum = 0, sum2 = 0;
+            for (size_t i = 0; i < pixels; i++)
+            {
+                sum += a[i];
+                sum2 += (double)a[i]*a[i];
+            }
+            double mean = sum / pixels;
+            printf("bias frame: mean %.2f ADU, standard deviation %.2f ADU\n", mean, sqrt(sum2 / pixels - mean*mean));
+            synthetic_frame_free(sky);
+        }
+
+        free(a);
+    }
+
+    return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Measures the throughput of the timer packet parser for clean streams,
+// streams with checksum errors, and streams dominated by garbage (e.g. a GPS
+// receiver spewing NMEA into the port), when fed one byte at a time (as the
+// timer thread used to) and in the larger chunks returned by bulk reads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "../timer_packet.h"
+
+#define STREAM_LENGTH (64*1024*1024)
+#define REPEATS 3
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void count_packet(struct timer_packet *p, void *context)
+{
+    (*(uint64_t *)context) += p->length;
+}
+
+static size_t timestamp_packet(uint8_t *buf)
+{
+    struct packet_time t = {.year = 2013, .month = 6, .day = 1, .hours = 12,
+                            .minutes = rand() % 60, .seconds = rand() % 60,
+                            .milliseconds = rand() % 1000, .flags = TIMESTAMP_LOCKED};
+    return timer_packet_encode(buf, rand() % 10 ? TIMESTAMP : TRIGGER, &t, sizeof(t));
+}
+
+// Timestamp and trigger packets, with a fraction of
+// corrupted checksums and a fraction of garbage bytes
+static size_t generate_stream(uint8_t *buf, size_t capacity, int bad_checksum_percent, int garbage_percent)
+{
+    const char *nmea = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n";
+    size_t length = 0;
+    while (length + MAX_PACKET_LENGTH <= capacity)
+    {
+        if (rand() % 100 < garbage_percent)
+        {
+            for (const char *c = nmea; *c && length < capacity; c++)
+                buf[length++] = *c;
+            continue;
+        }
+
+        size_t n = timestamp_packet(&buf[length]);
+        if (rand() % 100 < bad_checksum_percent)
+            buf[length + n - 3] ^= 0x55;
+        length += n;
+    }
+
+    return length;
+}
+
+static void bench_stream(const char *name, const uint8_t *stream, size_t length)
+{
+    const size_t chunks[] = {1, 64, 4096};
+    for (size_t c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++)
+    {
+        double best = 0;
+        struct timer_parser parser;
+        for (size_t r = 0; r < REPEATS; r++)
+        {
+            uint64_t data_bytes = 0;
+            timer_parser_init(&parser, count_packet, NULL, &data_bytes);
+
+            double start = now();
+            for (size_t offset = 0; offset < length; offset += chunks[c])
+            {
+                size_t n = length - offset < chunks[c] ? length - offset : chunks[c];
+                timer_parser_parse(&parser, stream + offset, n);
+            }
+            double elapsed = now() - start;
+            if (r == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        printf("%-16s %6zu %10.1f %12llu %10llu %12llu\n", name, chunks[c], length / best / 1e6,
+               (unsigned long long)parser.packet_count, (unsigned long long)parser.error_count,
+               (unsigned long long)parser.skipped_bytes);
+    }
+}
+
+int main()
+{
+    uint8_t *stream = malloc(STREAM_LENGTH);
+    if (!stream)
+        return 1;
+
+    srand(1);
+    printf("%-16s %6s %10s %12s %10s %12s\n", "stream", "chunk", "MB/s", "packets", "errors", "skipped");
+
+    size_t length = generate_stream(stream, STREAM_LENGTH, 0, 0);
+    bench_stream("clean", stream, length);
+
+    length = generate_stream(stream, STREAM_LENGTH, 10, 0);
+    bench_stream("10% checksum", stream, length);
+
+    length = generate_stream(stream, STREAM_LENGTH, 0, 50);
+    bench_stream("50% nmea", stream, length);
+
+    length = generate_stream(stream, STREAM_LENGTH, 0, 95);
+    bench_stream("95% nmea", stream, length);
+
+    free(stream);
+    return 0;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Fuzz target for the timer packet parser.
+// Each input is parsed in one call and again split into chunks whose sizes
+// are taken from the input itself; both must produce the same packets, every
+// packet must be well formed, and re-encoding a packet must reproduce it.
+//
+// Built standalone (make bench/timer_parser_fuzz) it runs the given input
+// files, or random streams of valid, corrupted and garbage packets if none are given.
+// For coverage-guided fuzzing build with libFuzzer instead:
+//   clang -g -O1 -std=c99 -DUSE_LIBFUZZER -fsanitize=fuzzer,address
+//         -o timer_parser_fuzz bench/timer_parser_fuzz.c timer_packet.c
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "../timer_packet.h"
+
+#define MAX_PACKETS 65536
+
+struct packet_log
+{
+    size_t count;
+    uint8_t types[MAX_PACKETS];
+    uint8_t lengths[MAX_PACKETS];
+    uint8_t data[MAX_PACKETS][MAX_DATA_LENGTH];
+};
+
+static struct packet_log whole, chunked;
+
+static void fail(const char *message)
+{
+    fprintf(stderr, "FAILED: %s\n", message);
+    abort();
+}
+
+static void record_packet(struct timer_packet *p, void *context)
+{
+    struct packet_log *log = context;
+    if (p->length > MAX_DATA_LENGTH)
+        fail("packet longer than MAX_DATA_LENGTH");
+
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < p->length; i++)
+        checksum ^= p->data.bytes[i];
+    if (checksum != p->checksum)
+        fail("packet accepted with incorrect checksum");
+
+    // Re-encoding must reproduce a packet that parses identically
+    uint8_t encoded[MAX_PACKET_LENGTH];
+    size_t length = timer_packet_encode(encoded, p->type, p->data.bytes, p->length);
+    if (length != (size_t)p->length + 7 || encoded[0] != '$' || encoded[1] != '$' ||
+        encoded[2] != (uint8_t)p->type || encoded[3] != p->length || encoded[4 + p->length] != p->checksum ||
+        memcmp(&encoded[4], p->data.bytes, p->length))
+        fail("re-encoded packet differs");
+
+    if (log->count < MAX_PACKETS)
+    {
+        log->types[log->count] = p->type;
+        log->lengths[log->count] = p->length;
+        memcpy(log->data[log->count], p->data.bytes, p->length);
+    }
+    log->count++;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    struct timer_parser parser;
+
+    whole.count = 0;
+    timer_parser_init(&parser, record_packet, NULL, &whole);
+    timer_parser_parse(&parser, data, size);
+    uint64_t whole_errors = parser.error_count;
+
+    // Split into chunks of 1-16 bytes, with sizes taken from the data
+    chunked.count = 0;
+    timer_parser_init(&parser, record_packet, NULL, &chunked);
+    for (size_t offset = 0; offset < size;)
+    {
+        size_t n = (data[offset] & 0x0F) + 1;
+        if (n > size - offset)
+            n = size - offset;
+        timer_parser_parse(&parser, data + offset, n);
+        offset += n;
+    }
+
+    if (whole.count != chunked.count || whole_errors != parser.error_count)
+        fail("chunked parse differs from whole parse");
+
+    size_t count = whole.count < MAX_PACKETS ? whole.count : MAX_PACKETS;
+    for (size_t i = 0; i < count; i++)
+        if (whole.types[i] != chunked.types[i] || whole.lengths[i] != chunked.lengths[i] ||
+            memcmp(whole.data[i], chunked.data[i], whole.lengths[i]))
+            fail("chunked parse produced a different packet");
+
+    return 0;
+}
+
+#ifndef USE_LIBFUZZER
+
+#define RANDOM_ITERATIONS 20000
+#define RANDOM_STREAM_LENGTH 4096
+
+// Valid packets mixed with truncated, corrupted and random data
+static size_t random_stream(uint8_t *buf, size_t capacity)
+{
+    const uint8_t types[] = {TIMESTAMP, TRIGGER, MESSAGE, MESSAGE_RAW, STOP_EXPOSURE, STATUS};
+    size_t length = 0;
+    while (length + MAX_PACKET_LENGTH <= capacity)
+    {
+        uint8_t data[MAX_DATA_LENGTH];
+        uint8_t data_length = rand() % 32;
+        for (uint8_t i = 0; i < data_length; i++)
+            data[i] = rand();
+
+        size_t n = timer_packet_encode(&buf[length], types[rand() % sizeof(types)], data, data_length);
+        switch (rand() % 8)
+        {
+            case 0:
+                // Truncate
+                n = rand() % n;
+                break;
+            case 1:
+                // Flip a byte
+                buf[length + rand() % n] ^= 1 << (rand() % 8);
+                break;
+            case 2:
+                // Replace with garbage, biased towards header bytes
+                for (size_t i = 0; i < n; i++)
+                    buf[length + i] = rand() % 4 ? rand() : '$';
+                break;
+        }
+        length += n;
+    }
+
+    return length;
+}
+
+static int run_file(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "Failed to open `%s'\n", path);
+        return 1;
+    }
+
+    uint8_t *buf = NULL;
+    size_t size = 0, capacity = 0;
+    while (!feof(f))
+    {
+        if (size == capacity)
+        {
+            capacity = capacity ? 2*capacity : 65536;
+            buf = realloc(buf, capacity);
+        }
+        size += fread(buf + size, 1, capacity - size, f);
+    }
+
+    fclose(f);
+    LLVMFuzzerTestOneInput(buf, size);
+    free(buf);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+    {
+        int ret = 0;
+        for (int i = 1; i < argc; i++)
+            ret |= run_file(argv[i]);
+        return ret;
+    }
+
+    srand(1);
+    uint8_t buf[RANDOM_STREAM_LENGTH];
+    for (size_t i = 0; i < RANDOM_ITERATIONS; i++)
+        LLVMFuzzerTestOneInput(buf, random_stream(buf, sizeof(buf)));
+
+    printf("%d random streams parsed successfully\n", RANDOM_ITERATIONS);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Compares the fused frame_orient kernel with the original
+// flip x / flip y / transpose sequence for all eight orientations.
+// The output of each orientation is checked against the original
+// implementation (including an odd-sized frame to exercise the edge cases).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "../frame_transform.h"
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The in-place implementation used before frame_orient
+static void reference_orient(uint16_t *data, uint16_t width, uint16_t height, uint8_t orientation)
+{
+    if (orientation & ORIENTATION_FLIP_X)
+        for (uint16_t j = 0; j < height; j++)
+            for (uint16_t i = 0; i < width/2; i++)
+            {
+                uint16_t temp = data[j*width + i];
+                data[j*width + i] = data[j*width + (width - i - 1)];
+                data[j*width + (width - i - 1)] = temp;
+            }
+
+    if (orientation & ORIENTATION_FLIP_Y)
+        for (uint16_t j = 0; j < height/2; j++)
+            for (uint16_t i = 0; i < width; i++)
+            {
+                uint16_t temp = data[j*width + i];
+                data[j*width + i] = data[(height - j - 1)*width + i];
+                data[(height - j - 1)*width + i] = temp;
+            }
+
+    if (orientation & ORIENTATION_TRANSPOSE)
+    {
+        size_t s = width*height*sizeof(uint16_t);
+        uint16_t *copy = malloc(s);
+        memcpy(copy, data, s);
+        for (uint16_t j = 0; j < height; j++)
+            for (uint16_t i = 0; i < width; i++)
+                data[i*height + j] = copy[j*width + i];
+        free(copy);
+    }
+}
+
+static void fill(uint16_t *data, size_t pixels)
+{
+    for (size_t i = 0; i < pixels; i++)
+        data[i] = rand();
+}
+
+static int verify(uint16_t width, uint16_t height)
+{
+    size_t pixels = (size_t)width*height;
+    uint16_t *in = malloc(pixels*sizeof(uint16_t));
+    uint16_t *out = malloc(pixels*sizeof(uint16_t));
+    uint16_t *expected = malloc(pixels*sizeof(uint16_t));
+    fill(in, pixels);
+
+    int failed = 0;
+    for (uint8_t o = 0; o < 8; o++)
+    {
+        memcpy(expected, in, pixels*sizeof(uint16_t));
+        reference_orient(expected, width, height, o);
+        frame_orient(in, out, width, height, o);
+        if (memcmp(expected, out, pixels*sizeof(uint16_t)))
+        {
+            fprintf(stderr, "orientation %d mismatch for %dx%d\n", o, width, height);
+            failed = 1;
+        }
+    }
+
+    free(in);
+    free(out);
+    free(expected);
+    return failed;
+}
+
+int main(int argc, char *argv[])
+{
+    if (verify(517, 301) || verify(64, 64) || verify(7, 3))
+        return 1;
+
+    const uint16_t sizes[] = {512, 1024, 2048};
+    printf("%6s %12s %14s %14s %9s\n", "size", "orientation", "original (ms)", "fused (ms)", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        uint16_t size = sizes[s];
+        size_t pixels = (size_t)size*size;
+        size_t iterations = 2048*2048*8 / pixels;
+
+        uint16_t *in = malloc(pixels*sizeof(uint16_t));
+        uint16_t *out = malloc(pixels*sizeof(uint16_t));
+        fill(in, pixels);
+
+        // The identity orientation is skipped by frame_process_transforms
+        for (uint8_t o = 1; o < 8; o++)
+        {
+            double start = now();
+            for (size_t i = 0; i < iterations; i++)
+                reference_orient(in, size, size, o);
+            double original = (now() - start) * 1e3 / iterations;
+
+            start = now();
+            for (size_t i = 0; i < iterations; i++)
+            {
+                frame_orient(in, out, size, size, o);
+                uint16_t *temp = in;
+                in = out;
+                out = temp;
+            }
+            double fused = (now() - start) * 1e3 / iterations;
+
+            char name[4];
+            snprintf(name, sizeof(name), "%c%c%c",
+                     o & ORIENTATION_FLIP_X ? 'x' : '-',
+                     o & ORIENTATION_FLIP_Y ? 'y' : '-',
+                     o & ORIENTATION_TRANSPOSE ? 't' : '-');
+            printf("%6d %12s %14.3f %14.3f %8.1fx\n", size, name, original, fused, original / fused);
+        }
+
+        free(in);
+        free(out);
+    }
+
+    return 0;
+}
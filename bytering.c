@@ -0,0 +1,167 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bytering.h"
+
+// Keep the producer and consumer indices on separate cache lines
+// so that the threads don't invalidate each other's caches
+#define CACHE_LINE_SIZE 64
+
+// Each record is a 4 byte header holding the payload length + 1 (zero while
+// the record is still being written), followed by the payload padded to a
+// multiple of 4 bytes. This keeps every header aligned and contiguous.
+#define HEADER_SIZE sizeof(uint32_t)
+#define RECORD_SIZE(length) (HEADER_SIZE + (((length) + 3) & ~(size_t)3))
+
+struct bytering
+{
+    // Immutable after creation
+    uint8_t *buffer;
+    size_t mask;
+    char pad0[CACHE_LINE_SIZE];
+
+    // Reserved by producers
+    size_t head;
+    char pad1[CACHE_LINE_SIZE];
+
+    // Owned by the consumer
+    size_t tail;
+    char pad2[CACHE_LINE_SIZE];
+};
+
+struct bytering *bytering_create(size_t capacity)
+{
+    struct bytering *ring = calloc(1, sizeof(struct bytering));
+    if (!ring)
+        return NULL;
+
+    // Round capacity up to a power of two so that
+    // indices can be wrapped with a mask
+    size_t size = HEADER_SIZE;
+    while (size < capacity)
+        size <<= 1;
+
+    ring->buffer = calloc(size, 1);
+    if (!ring->buffer)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    ring->mask = size - 1;
+    return ring;
+}
+
+// Not thread safe: must only be called once the producers and consumer have stopped
+void bytering_destroy(struct bytering *ring)
+{
+    if (!ring)
+        return;
+
+    free(ring->buffer);
+    free(ring);
+}
+
+static void copy_in(struct bytering *ring, size_t offset, const uint8_t *data, size_t length)
+{
+    size_t start = offset & ring->mask;
+    size_t first = ring->mask + 1 - start;
+    if (first > length)
+        first = length;
+
+    memcpy(&ring->buffer[start], data, first);
+    memcpy(ring->buffer, data + first, length - first);
+}
+
+static void copy_out(struct bytering *ring, size_t offset, uint8_t *data, size_t length)
+{
+    size_t start = offset & ring->mask;
+    size_t first = ring->mask + 1 - start;
+    if (first > length)
+        first = length;
+
+    memcpy(data, &ring->buffer[start], first);
+    memcpy(data + first, ring->buffer, length - first);
+}
+
+static void clear(struct bytering *ring, size_t offset, size_t length)
+{
+    size_t start = offset & ring->mask;
+    size_t first = ring->mask + 1 - start;
+    if (first > length)
+        first = length;
+
+    memset(&ring->buffer[start], 0, first);
+    memset(ring->buffer, 0, length - first);
+}
+
+// Safe to call from any thread.
+// Returns false without enqueuing anything if there is not enough space.
+bool bytering_push(struct bytering *ring, const uint8_t *data, size_t length)
+{
+    size_t size = RECORD_SIZE(length);
+    if (size > ring->mask + 1)
+        return false;
+
+    // Reserve space for the record. The consumer never passes head, so loading
+    // head after tail guarantees tail <= head. A head loaded before tail (or left
+    // by a failed exchange) may be stale, and the consumer may since have moved
+    // tail past it, which would make the ring look full.
+    size_t head;
+    do
+    {
+        size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (head - tail + size > ring->mask + 1)
+            return false;
+    }
+    while (!__atomic_compare_exchange_n(&ring->head, &head, head + size, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    copy_in(ring, head + HEADER_SIZE, data, length);
+
+    // Publish the record to the consumer
+    uint32_t *header = (uint32_t *)&ring->buffer[head & ring->mask];
+    __atomic_store_n(header, (uint32_t)length + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Called by the consumer thread only.
+// Copies as many complete records as fit into out, and returns the number of bytes copied.
+// Stops at the first record that is still being written, to preserve ordering.
+size_t bytering_pop(struct bytering *ring, uint8_t *out, size_t out_length)
+{
+    size_t tail = ring->tail;
+    size_t copied = 0;
+
+    while (true)
+    {
+        uint32_t *header = (uint32_t *)&ring->buffer[tail & ring->mask];
+        uint32_t value = __atomic_load_n(header, __ATOMIC_ACQUIRE);
+        if (value == 0)
+            break;
+
+        size_t length = value - 1;
+        if (copied + length > out_length)
+            break;
+
+        copy_out(ring, tail + HEADER_SIZE, out + copied, length);
+        copied += length;
+
+        // Zero the whole record so that stale payload bytes can't be
+        // mistaken for the header of a later record
+        size_t size = RECORD_SIZE(length);
+        clear(ring, tail, size);
+        tail += size;
+    }
+
+    if (tail != ring->tail)
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+    return copied;
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef BYTERING_H
+#define BYTERING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Fixed-capacity lock-free queue of variable length byte records.
+// Safe for any number of producer threads and exactly one consumer thread.
+// Each push is enqueued whole, and records are popped in the order that space
+// was reserved for them, so concurrent pushes never interleave.
+struct bytering *bytering_create(size_t capacity);
+void bytering_destroy(struct bytering *ring);
+bool bytering_push(struct bytering *ring, const uint8_t *data, size_t length);
+size_t bytering_pop(struct bytering *ring, uint8_t *out, size_t out_length);
+
+#endif
@@ -11,12 +11,16 @@
 #include <pthread.h>
 #include <signal.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
 
 #include "main.h"
 #include "camera.h"
 #include "timer.h"
 #include "preferences.h"
 #include "platform.h"
+#include "frame_pool.h"
+#include "run_stats.h"
 
 #include "camera_simulated.h"
 #ifdef USE_PVCAM
@@ -28,6 +32,9 @@
 
 enum camera_type {PVCAM, PICAM, SIMULATED};
 
+// Interval between temperature checks, in seconds
+#define TEMPERATURE_CHECK_INTERVAL 5
+
 struct Camera
 {
     enum camera_type type;
@@ -37,6 +44,12 @@ struct Camera
     bool thread_alive;
 
     pthread_mutex_t read_mutex;
+
+    // Signalled by commands from other threads and by backend
+    // frame notifications to wake the camera thread
+    pthread_cond_t wake_condition;
+    bool wake_pending;
+
     PNCameraMode desired_mode;
     PNCameraMode mode;
     bool desired_shutter;
@@ -45,9 +58,24 @@ struct Camera
     struct camera_port_option *port_options;
     uint8_t port_count;
     double readout_time;
-    double temperature;
     uint16_t ccd_region[4];
 
+    // Most recent temperature sample and its monotonic_time().
+    // Written only by the camera thread, and read without locking (from the
+    // backend callbacks and GUI) using temperature_sequence as a seqlock.
+    uint32_t temperature_sequence;
+    double temperature;
+    TimestampNS temperature_time;
+
+    // Preallocated frames that are checked out by the backend and
+    // returned by the frame manager. Only replaced by the camera thread
+    // while the backend is not acquiring.
+    struct frame_pool *frame_pool;
+
+    // Readout settings referenced by each claimed frame.
+    // Only replaced by the camera thread while the backend is not acquiring.
+    struct camera_readout *readout;
+
     bool camera_settings_dirty;
 
     int (*initialize)(Camera *, void **);
@@ -55,6 +83,7 @@ struct Camera
     int (*port_table)(Camera *, void *, struct camera_port_option **, uint8_t *);
     int (*uninitialize)(Camera *, void *);
     int (*tick)(Camera *, void *, PNCameraMode);
+    int (*tick_timeout)(Camera *, void *, PNCameraMode);
     int (*start_acquiring)(Camera *, void *, bool);
     int (*stop_acquiring)(Camera *, void *);
     int (*read_temperature)(Camera *, void *, double *);
@@ -74,6 +103,7 @@ struct Camera
     HOOK(type, port_table);               \
     HOOK(type, uninitialize);             \
     HOOK(type, tick);                     \
+    HOOK(type, tick_timeout);             \
     HOOK(type, start_acquiring);          \
     HOOK(type, stop_acquiring);           \
     HOOK(type, read_temperature);         \
@@ -93,6 +123,7 @@ Camera *camera_new(bool simulate_hardware)
     camera->mode = UNINITIALIZED;
     camera->desired_mode = IDLE;
     pthread_mutex_init(&camera->read_mutex, NULL);
+    pthread_cond_init(&camera->wake_condition, NULL);
 
     camera->type = SIMULATED;
     if (!simulate_hardware)
@@ -122,6 +153,7 @@ Camera *camera_new(bool simulate_hardware)
 
 void camera_free(Camera *camera)
 {
+    pthread_cond_destroy(&camera->wake_condition);
     pthread_mutex_destroy(&camera->read_mutex);
 }
 
@@ -132,6 +164,110 @@ static void set_mode(Camera *camera, PNCameraMode mode)
     pthread_mutex_unlock(&camera->read_mutex);
 }
 
+// (Re)allocate the frame pool if the requested size has changed.
+// Each buffer is large enough to hold a full-chip readout, so window and
+// binning changes don't require a new pool.
+static int prepare_frame_pool(Camera *camera)
+{
+    size_t frame_count = pn_preference_int(FRAME_POOL_SIZE);
+    size_t buffer_size = pn_preference_int(CAMERA_FRAME_BUFFER_SIZE);
+
+    // Must be able to absorb a full camera buffer in a single burst
+    if (frame_count < buffer_size)
+    {
+        pn_log("Invalid frame pool size: %zu. Reset to %zu.", frame_count, buffer_size);
+        frame_count = buffer_size;
+        pn_preference_set_int(FRAME_POOL_SIZE, frame_count);
+    }
+
+    size_t frame_pixels = (size_t)(camera->ccd_region[1] - camera->ccd_region[0] + 1) *
+                                  (camera->ccd_region[3] - camera->ccd_region[2] + 1);
+
+    if (!frame_pool_matches(camera->frame_pool, frame_count, frame_pixels))
+    {
+        frame_pool_retire(camera->frame_pool);
+        camera->frame_pool = frame_pool_new(frame_count, frame_pixels);
+        if (!camera->frame_pool)
+        {
+            pn_log("Failed to allocate frame pool (%zu frames of %zu pixels).", frame_count, frame_pixels);
+            return CAMERA_ALLOCATION_FAILED;
+        }
+        pn_log("Allocated frame pool (%zu frames of %zu pixels).", frame_count, frame_pixels);
+    }
+
+    return CAMERA_OK;
+}
+
+static void publish_temperature(Camera *camera, double temperature, TimestampNS time)
+{
+    // An odd sequence number marks an update in progress
+    uint32_t sequence = __atomic_load_n(&camera->temperature_sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&camera->temperature_sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    __atomic_store(&camera->temperature, &temperature, __ATOMIC_RELAXED);
+    __atomic_store_n(&camera->temperature_time, time, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&camera->temperature_sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static void read_temperature_snapshot(Camera *camera, double *temperature, TimestampNS *time)
+{
+    uint32_t sequence;
+    do
+    {
+        sequence = __atomic_load_n(&camera->temperature_sequence, __ATOMIC_ACQUIRE);
+        __atomic_load(&camera->temperature, temperature, __ATOMIC_RELAXED);
+        *time = __atomic_load_n(&camera->temperature_time, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((sequence & 1) || sequence != __atomic_load_n(&camera->temperature_sequence, __ATOMIC_RELAXED));
+}
+
+// Must be called with read_mutex held
+static void notify_event_locked(Camera *camera)
+{
+    camera->wake_pending = true;
+    pthread_cond_signal(&camera->wake_condition);
+}
+
+// Sleep until another thread or the backend notifies an event, or timeout_ms has passed.
+// A negative timeout waits indefinitely. Must be called with read_mutex held.
+static void wait_for_event_locked(Camera *camera, int timeout_ms)
+{
+    if (timeout_ms < 0)
+    {
+        while (!camera->wake_pending)
+            pthread_cond_wait(&camera->wake_condition, &camera->read_mutex);
+    }
+    else
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (timeout_ms % 1000)*1000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (!camera->wake_pending)
+            if (pthread_cond_timedwait(&camera->wake_condition, &camera->read_mutex, &deadline) == ETIMEDOUT)
+                break;
+    }
+
+    camera->wake_pending = false;
+}
+
+// True if the loop can make progress without waiting for another event.
+// Must be called with read_mutex held.
+static bool transition_pending_locked(Camera *camera)
+{
+    return (camera->mode == IDLE && (camera->camera_settings_dirty || camera->desired_mode == ACQUIRING)) ||
+           (camera->mode == ACQUIRING && camera->desired_mode != ACQUIRING) ||
+           (camera->mode == IDLE_WHEN_SAFE && camera->safe_to_stop_acquiring);
+}
+
 // Main camera thread loop
 static void *camera_thread(void *_modules)
 {
@@ -178,7 +314,7 @@ static void *camera_thread(void *_modules)
     set_mode(camera, IDLE);
 
     // Loop and respond to user commands
-    time_t last_temperature_check = 0;
+    TimestampNS last_temperature_check = 0;
 
     pthread_mutex_lock(&camera->read_mutex);
     PNCameraMode desired_mode = camera->desired_mode;
@@ -188,6 +324,22 @@ static void *camera_thread(void *_modules)
     PNCameraMode current_mode;
     while (desired_mode != SHUTDOWN)
     {
+        // Sample the temperature for the GUI and for stamping into frames.
+        // Frames use the cached value so that the hardware isn't queried for every readout.
+        TimestampNS t = monotonic_time();
+        if (last_temperature_check == 0 || t - last_temperature_check >= TEMPERATURE_CHECK_INTERVAL*NS_PER_SECOND)
+        {
+            last_temperature_check = t;
+            double temperature;
+            if (camera->read_temperature(camera, camera->internal, &temperature)!= CAMERA_OK)
+            {
+                pn_log("Failed to query camera temperature");
+                goto failure;
+            }
+
+            publish_temperature(camera, temperature, t);
+        }
+
         current_mode = camera_mode(camera);
         pthread_mutex_lock(&camera->read_mutex);
         bool camera_settings_dirty = camera->camera_settings_dirty;
@@ -215,6 +367,11 @@ static void *camera_thread(void *_modules)
             set_mode(camera, ACQUIRE_START);
             pn_log("Camera is preparing for acquisition.");
 
+            if (prepare_frame_pool(camera) != CAMERA_OK)
+                goto failure;
+
+            notify_acquisition_started();
+
             if (camera->start_acquiring(camera, camera->internal, desired_shutter) != CAMERA_OK)
             {
                 pn_log("Failed to start camera acquisition");
@@ -247,6 +404,7 @@ static void *camera_thread(void *_modules)
                 goto failure;
             }
 
+            notify_acquisition_stopped();
             pn_log("Camera is now idle.");
             set_mode(camera, IDLE);
         }
@@ -258,25 +416,24 @@ static void *camera_thread(void *_modules)
             goto failure;
         }
 
-        // Check temperature
-        time_t t = time(NULL);
-        if (difftime(t, last_temperature_check) > 5)
-        {
-            last_temperature_check = t;
-            double temperature;
-            if (camera->read_temperature(camera, camera->internal, &temperature)!= CAMERA_OK)
-            {
-                pn_log("Failed to query camera temperature");
-                goto failure;
-            }
+        // Sleep until there is something to do: a command from another thread,
+        // a frame notification from the backend, or the next scheduled check.
+        // Backends that can't notify new frames ask to be ticked periodically.
+        int timeout = (last_temperature_check + TEMPERATURE_CHECK_INTERVAL*NS_PER_SECOND - monotonic_time()) / NS_PER_MILLISECOND;
+        if (timeout < 0)
+            timeout = 0;
 
-            pthread_mutex_lock(&camera->read_mutex);
-            camera->temperature = temperature;
-            pthread_mutex_unlock(&camera->read_mutex);
-        }
-        millisleep(100);
+        int tick_timeout = camera->tick_timeout(camera, camera->internal, camera_mode(camera));
+        if (tick_timeout >= 0 && tick_timeout < timeout)
+            timeout = tick_timeout;
 
+        // Commands issued while this iteration was running leave wake_pending set
         pthread_mutex_lock(&camera->read_mutex);
+        if (transition_pending_locked(camera))
+            camera->wake_pending = false;
+        else
+            wait_for_event_locked(camera, timeout);
+
         desired_mode = camera->desired_mode;
         safe_to_stop_acquiring = camera->safe_to_stop_acquiring;
         pthread_mutex_unlock(&camera->read_mutex);
@@ -302,6 +459,13 @@ setup_failure:
 initialization_failure:
     pn_log("Camera uninitialized.");
 
+    // Any frames still held by the frame manager keep the pool alive until they are released
+    frame_pool_retire(camera->frame_pool);
+    camera->frame_pool = NULL;
+
+    camera_readout_unref(camera->readout);
+    camera->readout = NULL;
+
     camera->thread_alive = false;
     return NULL;
 }
@@ -320,6 +484,7 @@ void camera_notify_shutdown(Camera *camera)
 {
     pthread_mutex_lock(&camera->read_mutex);
     camera->desired_mode = SHUTDOWN;
+    notify_event_locked(camera);
     pthread_mutex_unlock(&camera->read_mutex);
 }
 
@@ -339,6 +504,7 @@ void camera_notify_safe_to_stop(Camera *camera)
 {
     pthread_mutex_lock(&camera->read_mutex);
     camera->safe_to_stop_acquiring = true;
+    notify_event_locked(camera);
     pthread_mutex_unlock(&camera->read_mutex);
 }
 
@@ -352,6 +518,7 @@ void camera_start_exposure(Camera *camera, bool shutter_open)
     pthread_mutex_lock(&camera->read_mutex);
     camera->desired_mode = ACQUIRING;
     camera->desired_shutter = shutter_open;
+    notify_event_locked(camera);
     pthread_mutex_unlock(&camera->read_mutex);
 }
 
@@ -359,14 +526,15 @@ void camera_stop_exposure(Camera *camera)
 {
     pthread_mutex_lock(&camera->read_mutex);
     camera->desired_mode = IDLE;
+    notify_event_locked(camera);
     pthread_mutex_unlock(&camera->read_mutex);
 }
 
 double camera_temperature(Camera *camera)
 {
-    pthread_mutex_lock(&camera->read_mutex);
-    double temperature = camera->temperature;
-    pthread_mutex_unlock(&camera->read_mutex);
+    double temperature;
+    TimestampNS time;
+    read_temperature_snapshot(camera, &temperature, &time);
     return temperature;
 }
 
@@ -398,6 +566,7 @@ void camera_update_settings(Camera *camera)
 {
     pthread_mutex_lock(&camera->read_mutex);
     camera->camera_settings_dirty = true;
+    notify_event_locked(camera);
     pthread_mutex_unlock(&camera->read_mutex);
 }
 
@@ -434,6 +603,92 @@ uint8_t camera_port_options(Camera *camera, struct camera_port_option **options)
     return camera->port_count;
 }
 
+// Called by the camera backends to obtain a frame for new image data.
+// The frame temperature is set from the most recent sample.
+// Returns NULL if no frames are available; the frame is then counted as dropped.
+// Ownership passes to the frame manager via queue_framedata, which returns it to the pool.
+CameraFrame *camera_claim_frame(Camera *camera, uint16_t width, uint16_t height)
+{
+    CameraFrame *frame = frame_pool_checkout(camera->frame_pool, width, height);
+    if (!frame)
+    {
+        run_stats_add(RUN_POOL_EXHAUSTED, 1);
+        return NULL;
+    }
+
+    frame->readout = camera->readout ? camera_readout_ref(camera->readout) : NULL;
+    frame->orientation = 0;
+
+    // Stamp the cached temperature instead of querying the hardware
+    TimestampNS sample_time;
+    read_temperature_snapshot(camera, &frame->temperature, &sample_time);
+    frame->temperature_age = (double)(monotonic_time() - sample_time) / NS_PER_SECOND;
+    return frame;
+}
+
+// Return a claimed frame that won't be passed to the frame manager
+void camera_discard_frame(CameraFrame *frame)
+{
+    camera_readout_unref(frame->readout);
+    frame->readout = NULL;
+    frame_pool_release(frame);
+}
+
+// Called by the camera backends from update_camera_settings (on the camera thread,
+// and never while acquiring) to replace the readout settings given to new frames.
+// Takes ownership of the caller's reference.
+void camera_set_readout(Camera *camera, struct camera_readout *readout)
+{
+    camera_readout_unref(camera->readout);
+    camera->readout = readout;
+}
+
+struct camera_readout *camera_readout_new(const char *port_desc, const char *speed_desc, const char *gain_desc)
+{
+    struct camera_readout *readout = calloc(1, sizeof(struct camera_readout));
+    if (!readout)
+        return NULL;
+
+    readout->port_desc = strdup(port_desc);
+    readout->speed_desc = strdup(speed_desc);
+    readout->gain_desc = strdup(gain_desc);
+    readout->refs = 1;
+
+    if (!readout->port_desc || !readout->speed_desc || !readout->gain_desc)
+    {
+        camera_readout_unref(readout);
+        return NULL;
+    }
+
+    return readout;
+}
+
+struct camera_readout *camera_readout_ref(struct camera_readout *readout)
+{
+    __atomic_add_fetch(&readout->refs, 1, __ATOMIC_RELAXED);
+    return readout;
+}
+
+void camera_readout_unref(struct camera_readout *readout)
+{
+    if (!readout || __atomic_sub_fetch(&readout->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    free(readout->port_desc);
+    free(readout->speed_desc);
+    free(readout->gain_desc);
+    free(readout);
+}
+
+// Called by the camera backends (from any thread) when new frames are
+// ready or released slots can be recycled, to wake the camera thread
+void camera_notify_event(Camera *camera)
+{
+    pthread_mutex_lock(&camera->read_mutex);
+    notify_event_locked(camera);
+    pthread_mutex_unlock(&camera->read_mutex);
+}
+
 void camera_simulate_frame(Camera *camera)
 {
     if (camera->type != SIMULATED)
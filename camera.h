@@ -36,6 +36,37 @@ struct camera_port_option
     uint8_t speed_count;
 };
 
+// Readout settings that apply to every frame until the camera settings next change.
+// Created by the backends when the settings are updated and immutable afterwards,
+// so frames share a reference instead of copying them.
+struct camera_readout
+{
+    char *port_desc;
+    char *speed_desc;
+    char *gain_desc;
+
+    double readout_time;
+    double vertical_shift_us;
+
+    // [x1, x2, y1, y2] in frame pixels
+    bool has_image_region;
+    bool has_bias_region;
+    uint16_t image_region[4];
+    uint16_t bias_region[4];
+
+    bool has_em_gain;
+    double em_gain;
+
+    bool has_exposure_shortcut;
+    uint16_t exposure_shortcut_ms;
+
+    int refs;
+};
+
+struct camera_readout *camera_readout_new(const char *port_desc, const char *speed_desc, const char *gain_desc);
+struct camera_readout *camera_readout_ref(struct camera_readout *readout);
+void camera_readout_unref(struct camera_readout *readout);
+
 typedef struct Camera Camera;
 
 typedef enum
@@ -74,6 +105,10 @@ bool camera_supports_bias_acquisition(Camera *camera);
 void camera_normalize_trigger(Camera *camera, TimerTimestamp *trigger);
 
 void camera_simulate_frame(Camera *camera);
+void camera_notify_event(Camera *camera);
+void camera_set_readout(Camera *camera, struct camera_readout *readout);
+CameraFrame *camera_claim_frame(Camera *camera, uint16_t width, uint16_t height);
+void camera_discard_frame(CameraFrame *frame);
 
 // Warning: These are not thread safe, but this is only touched by the camera
 // thread during startup, when the main thread is designed to not call these
@@ -18,12 +18,62 @@
 #include "camera.h"
 #include "preferences.h"
 #include "platform.h"
+#include "ringbuffer.h"
+#include "run_stats.h"
+
+// Number of acquisition buffer slots that must separate PICAM's write position
+// from the oldest frame lent to the frame manager. Frames are copied instead of
+// lent once lending them would risk PICAM overwriting a frame still in use.
+// PICAM fills slots before the acquisition callback counts them, and may count
+// several at once, so a readout within this margin is also treated as overwritten.
+#define ZERO_COPY_RESERVE_SLOTS 2
+
+struct readout_ring;
+struct readout_slot
+{
+    struct readout_ring *ring;
+    size_t index;
+
+    // Set by the acquisition callback when PICAM fills the slot
+    uint64_t sequence;
+    uint64_t timestamp;
+
+    // Set while the slot is lent to the frame manager, with
+    // the sequence of the readout that was lent
+    bool lent;
+    uint64_t lent_sequence;
+};
+
+// PICAM acquisition buffer plus the readouts that the acquisition callback has
+// published to the camera thread. PICAM doesn't wait for slots to be returned,
+// so lent slots are only safe until it next wraps around the buffer, and the
+// frame manager must check readout_slot_valid after reading one.
+struct readout_ring
+{
+    Camera *camera;
+    pibyte *memory;
+    piint stride;
+    size_t slot_count;
+    struct readout_slot *slots;
+
+    // Filled slots, pushed by the acquisition callback and popped by the camera thread
+    struct ringbuffer *pending;
+
+    // Number of readouts published by the acquisition callback
+    uint64_t written;
+    uint64_t lost;
+
+    // One reference for the camera plus one for each lent frame
+    size_t refs;
+};
 
 struct internal
 {
+    Camera *camera;
     PicamHandle device_handle;
     PicamHandle model_handle;
-    pibyte *image_buffer;
+    struct readout_ring *ring;
+    bool zero_copy;
     piint readout_stride;
 
     uint16_t frame_width;
@@ -151,53 +201,170 @@ static int read_temperature(PicamHandle model_handle, double *out_temperature)
     return CAMERA_OK;
 }
 
-static void acquired_frame(struct internal *internal, uint8_t *frame_data, uint64_t timestamp)
+static struct readout_ring *readout_ring_new(Camera *camera, piint stride, size_t slot_count)
 {
-    // Copy frame data and pass ownership to main thread
-    CameraFrame *frame = malloc(sizeof(CameraFrame));
-    if (frame)
+    struct readout_ring *ring = calloc(1, sizeof(struct readout_ring));
+    if (!ring)
+        return NULL;
+
+    ring->memory = malloc(slot_count*stride*sizeof(pibyte));
+    ring->slots = calloc(slot_count, sizeof(struct readout_slot));
+    ring->pending = ringbuffer_create(slot_count);
+    if (!ring->memory || !ring->slots || !ring->pending)
     {
-        frame->data = malloc(internal->frame_bytes);
-        if (frame->data)
-        {
-            if (internal->first_frame)
-            {
-                internal->start_timestamp = timestamp;
-                timestamp = 0;
-                internal->first_frame = false;
-            }
-            else
-                timestamp -= internal->start_timestamp;
+        free(ring->memory);
+        free(ring->slots);
+        if (ring->pending)
+            ringbuffer_destroy(ring->pending);
+        free(ring);
+        return NULL;
+    }
 
-            memcpy(frame->data, frame_data, internal->frame_bytes);
-            frame->width = internal->frame_width;
-            frame->height = internal->frame_height;
-            read_temperature(internal->model_handle, &frame->temperature);
+    for (size_t i = 0; i < slot_count; i++)
+        ring->slots[i] = (struct readout_slot){.ring = ring, .index = i};
+
+    ring->camera = camera;
+    ring->stride = stride;
+    ring->slot_count = slot_count;
+    ring->refs = 1;
+    return ring;
+}
+
+static void readout_ring_unref(struct readout_ring *ring)
+{
+    if (__atomic_sub_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    // Unprocessed readouts point into the slots, which are freed below
+    while (ringbuffer_pop(ring->pending));
+    ringbuffer_destroy(ring->pending);
+    free(ring->memory);
+    free(ring->slots);
+    free(ring);
+}
+
+// Number of readouts that PICAM has completed since the slot was filled.
+// The slot is overwritten once this reaches the slot count.
+static uint64_t readout_slot_age(struct readout_ring *ring, uint64_t sequence)
+{
+    return __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE) - sequence;
+}
+
+// Whether the readout at the given sequence can still be trusted. PICAM may
+// already be writing up to ZERO_COPY_RESERVE_SLOTS readouts that the acquisition
+// callback hasn't counted, so those slots are treated as overwritten.
+static bool readout_intact(struct readout_ring *ring, uint64_t sequence)
+{
+    return readout_slot_age(ring, sequence) + ZERO_COPY_RESERVE_SLOTS < ring->slot_count;
+}
+
+// Called by the frame manager to check that PICAM hasn't wrapped around
+// and overwritten a lent frame since it was queued. The frame manager
+// discards (and counts) any frame that fails this after it was read.
+static bool readout_slot_valid(void *_slot)
+{
+    struct readout_slot *slot = _slot;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return readout_intact(slot->ring, slot->lent_sequence);
+}
+
+// Called by the frame manager when it has finished with a lent frame.
+// PICAM has no notion of locked slots, so this only needs to check
+// whether the frame was overwritten while it was in use.
+static void readout_slot_release(void *_slot)
+{
+    struct readout_slot *slot = _slot;
+    struct readout_ring *ring = slot->ring;
+    if (!readout_slot_valid(slot))
+        pn_log("WARNING: A lent frame was overwritten before it was released. Increase CameraFrameBufferSize.");
+
+    __atomic_store_n(&slot->lent, false, __ATOMIC_RELEASE);
+    readout_ring_unref(ring);
+}
+
+// Whether the oldest lent frame (including one at the given sequence) would still be
+// at least ZERO_COPY_RESERVE_SLOTS readouts away from no longer being intact
+static bool can_lend(struct readout_ring *ring, uint64_t sequence)
+{
+    uint64_t oldest = sequence;
+    for (size_t i = 0; i < ring->slot_count; i++)
+    {
+        struct readout_slot *slot = &ring->slots[i];
+        if (__atomic_load_n(&slot->lent, __ATOMIC_ACQUIRE) && slot->lent_sequence < oldest)
+            oldest = slot->lent_sequence;
+    }
+
+    return readout_slot_age(ring, oldest) + 2*ZERO_COPY_RESERVE_SLOTS < ring->slot_count;
+}
 
-            frame->has_timestamp = true;
-            frame->timestamp = timestamp*1.0/internal->timestamp_resolution;
-            frame->has_image_region = false;
-            frame->has_bias_region = false;
-            frame->readout_time = internal->readout_time;
-            frame->vertical_shift_us = internal->vertical_shift_us;
+// Pass readouts published by the acquisition callback to the frame manager.
+// Called on the camera thread.
+static void process_readouts(struct internal *internal, bool allow_lend)
+{
+    struct readout_ring *ring = internal->ring;
+    struct readout_slot *slot;
+    while ((slot = ringbuffer_pop(ring->pending)))
+    {
+        uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        uint64_t timestamp = __atomic_load_n(&slot->timestamp, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
 
-            frame->port_desc = strdup(internal->current_port_desc);
-            frame->speed_desc = strdup(internal->current_speed_desc);
-            frame->gain_desc = strdup(internal->current_gain_desc);
+        // PICAM may already have reused the slot if the camera thread fell behind
+        if (!readout_intact(ring, sequence))
+        {
+            pn_log("Readout was overwritten before it could be processed. Discarding frame.");
+            run_stats_add(RUN_CAMERA_LOST, 1);
+            continue;
+        }
 
-            frame->has_em_gain = internal->current_port_is_em;
-            frame->em_gain = internal->current_em_gain;
+        CameraFrame *frame = camera_claim_frame(internal->camera, internal->frame_width, internal->frame_height);
+        if (!frame)
+            continue;
 
-            frame->has_exposure_shortcut = true;
-            frame->exposure_shortcut_ms = internal->exposure_shortcut_ms;
+        if (internal->first_frame)
+        {
+            internal->start_timestamp = timestamp;
+            timestamp = 0;
+            internal->first_frame = false;
+        }
+        else
+            timestamp -= internal->start_timestamp;
 
-            queue_framedata(frame);
+        uint8_t *frame_data = (uint8_t *)ring->memory + slot->index*ring->stride;
+        if (allow_lend && internal->zero_copy && can_lend(ring, sequence))
+        {
+            __atomic_add_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL);
+            slot->lent_sequence = sequence;
+            __atomic_store_n(&slot->lent, true, __ATOMIC_RELEASE);
+            frame->data = (uint16_t *)frame_data;
+            frame->release_data = readout_slot_release;
+            frame->release_data_ref = slot;
+            frame->data_valid = readout_slot_valid;
         }
         else
-            pn_log("Failed to allocate CameraFrame->data. Discarding frame.");
+        {
+            memcpy(frame->data, frame_data, internal->frame_bytes);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (!readout_intact(ring, sequence))
+            {
+                pn_log("Readout was overwritten while it was copied. Discarding frame.");
+                run_stats_add(RUN_CAMERA_LOST, 1);
+                camera_discard_frame(frame);
+                continue;
+            }
+        }
+
+        frame->has_timestamp = true;
+        frame->timestamp = timestamp*1.0/internal->timestamp_resolution;
+        queue_framedata(frame);
+    }
+
+    uint64_t lost = __atomic_exchange_n(&ring->lost, 0, __ATOMIC_RELAXED);
+    if (lost > 0)
+    {
+        pn_log("WARNING: %llu readouts were discarded because the camera thread fell behind.", (unsigned long long)lost);
+        run_stats_add(RUN_CAMERA_LOST, lost);
     }
-    else
-        pn_log("Failed to allocate CameraFrame. Discarding frame.");
 }
 
 // Frame status change callback
@@ -209,6 +376,8 @@ static void acquired_frame(struct internal *internal, uint8_t *frame_data, uint6
 //   - an acquisition error occurs
 // - called on another thread
 // - all update callbacks are serialized
+// Readouts are only published to the camera thread here, so that
+// the callback returns before PICAM needs the next slot
 static struct internal *callback_internal_ref;
 PicamError PIL_CALL acquisitionUpdatedCallback(PicamHandle handle, const PicamAvailableData *data, const PicamAcquisitionStatus* status)
 {
@@ -216,19 +385,36 @@ PicamError PIL_CALL acquisitionUpdatedCallback(PicamHandle handle, const PicamAv
     {
         // Print errors
         if (status->errors & PicamAcquisitionErrorsMask_DataLost)
+        {
             pn_log("Camera error: Frame data lost. Continuing...");
+            run_stats_add(RUN_CAMERA_LOST, 1);
+        }
 
         if (status->errors & PicamAcquisitionErrorsMask_ConnectionLost)
             pn_log("Camera error: Connection lost. Continuing...");
     }
-    else if (data)
+    else if (data && data->readout_count > 0)
     {
+        struct readout_ring *ring = callback_internal_ref->ring;
+        size_t first = ((pibyte *)data->initial_readout - ring->memory) / ring->stride;
         for (pi64s i = 0; i < data->readout_count; i++)
         {
-            uint8_t *frame_data = (uint8_t *)data->initial_readout + i*callback_internal_ref->readout_stride;
-            uint64_t timestamp = *(uint64_t *)(frame_data + callback_internal_ref->frame_bytes);
-            acquired_frame(callback_internal_ref, frame_data, timestamp);
+            struct readout_slot *slot = &ring->slots[(first + i) % ring->slot_count];
+            uint8_t *frame_data = (uint8_t *)ring->memory + slot->index*ring->stride;
+
+            // Count the readout before updating the slot, so that the camera
+            // thread sees a stale entry as overwritten rather than a torn one
+            uint64_t sequence = __atomic_fetch_add(&ring->written, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_RELEASE);
+            __atomic_store_n(&slot->timestamp, *(uint64_t *)(frame_data + callback_internal_ref->frame_bytes), __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->sequence, sequence, __ATOMIC_RELEASE);
+
+            // The slot is already queued if the camera thread is a full buffer behind
+            if (!ringbuffer_push(ring->pending, slot))
+                __atomic_add_fetch(&ring->lost, 1, __ATOMIC_RELAXED);
         }
+
+        camera_notify_event(ring->camera);
     }
 
     // Check for buffer overrun. Should never happen in practice, but we log this
@@ -297,6 +483,7 @@ int camera_picam_initialize(Camera *camera, void **out_internal)
     if (!internal)
         return CAMERA_ALLOCATION_FAILED;
 
+    internal->camera = camera;
     Picam_InitializeLibrary();
 
     connect_camera(camera, internal);
@@ -647,6 +834,23 @@ int camera_picam_update_camera_settings(Camera *camera, void *_internal, double
         }
     }
 
+    // Shared by every frame until the settings next change
+    struct camera_readout *readout = camera_readout_new(internal->current_port_desc,
+        internal->current_speed_desc, internal->current_gain_desc);
+    if (!readout)
+    {
+        pn_log("Failed to allocate readout settings.");
+        return CAMERA_ERROR;
+    }
+
+    readout->readout_time = internal->readout_time;
+    readout->vertical_shift_us = internal->vertical_shift_us;
+    readout->has_em_gain = internal->current_port_is_em;
+    readout->em_gain = internal->current_em_gain;
+    readout->has_exposure_shortcut = true;
+    readout->exposure_shortcut_ms = internal->exposure_shortcut_ms;
+    camera_set_readout(camera, readout);
+
     *out_readout_time = internal->readout_time;
     return CAMERA_OK;
 }
@@ -767,7 +971,13 @@ int camera_picam_start_acquiring(Camera *camera, void *_internal, bool shutter_o
     internal->first_frame = true;
 
     // Create a buffer large enough for PICAM to hold multiple frames.
+    // Readouts are only trusted outside the reserve, so at least one more slot is needed.
     size_t buffer_size = pn_preference_int(CAMERA_FRAME_BUFFER_SIZE);
+    if (buffer_size <= ZERO_COPY_RESERVE_SLOTS)
+    {
+        pn_log("CameraFrameBufferSize must be greater than %d. Using %d.", ZERO_COPY_RESERVE_SLOTS, ZERO_COPY_RESERVE_SLOTS + 1);
+        buffer_size = ZERO_COPY_RESERVE_SLOTS + 1;
+    }
 
     internal->readout_stride = 0;
     error = Picam_GetParameterIntegerValue(internal->model_handle, PicamParameter_ReadoutStride, &internal->readout_stride);
@@ -778,13 +988,18 @@ int camera_picam_start_acquiring(Camera *camera, void *_internal, bool shutter_o
         return CAMERA_ERROR;
     }
 
-    internal->image_buffer = (pibyte *)malloc(buffer_size*internal->readout_stride*sizeof(pibyte));
-    if (!internal->image_buffer)
+    internal->ring = readout_ring_new(camera, internal->readout_stride, buffer_size);
+    if (!internal->ring)
         return CAMERA_ALLOCATION_FAILED;
 
+    // Lending frames requires enough slots to keep some free for the camera
+    internal->zero_copy = pn_preference_char(CAMERA_ZERO_COPY) && buffer_size > 2*ZERO_COPY_RESERVE_SLOTS;
+    if (pn_preference_char(CAMERA_ZERO_COPY) && !internal->zero_copy)
+        pn_log("Zero-copy frames require CameraFrameBufferSize > %d. Frames will be copied.", 2*ZERO_COPY_RESERVE_SLOTS);
+
     PicamAcquisitionBuffer buffer =
     {
-        .memory = internal->image_buffer,
+        .memory = internal->ring->memory,
         .memory_size = buffer_size*internal->readout_stride
     };
 
@@ -893,17 +1108,35 @@ int camera_picam_stop_acquiring(Camera *camera, void *_internal)
         log_picam_error(error);
         // Continue cleanup on failure
     }
-    free(internal->image_buffer);
-    
+
+    // Copy out any readouts that arrived after the last tick.
+    // Frames that are still lent to the frame manager keep the buffer alive
+    if (internal->ring)
+    {
+        process_readouts(internal, false);
+        readout_ring_unref(internal->ring);
+        internal->ring = NULL;
+    }
+
     return CAMERA_OK;
 }
 
-// New frames are notified by callback, so we don't need to do anything here
-int camera_picam_tick(Camera *camera, void *internal, PNCameraMode current_mode)
+// Pass on readouts that the acquisition callback has published
+int camera_picam_tick(Camera *camera, void *_internal, PNCameraMode current_mode)
 {
+    struct internal *internal = _internal;
+    if (internal->ring)
+        process_readouts(internal, true);
+
     return CAMERA_OK;
 }
 
+// The acquisition callback wakes the camera thread when readouts arrive
+int camera_picam_tick_timeout(Camera *camera, void *internal, PNCameraMode current_mode)
+{
+    return -1;
+}
+
 int camera_picam_read_temperature(Camera *camera, void *_internal, double *out_temperature)
 {
     struct internal *internal = _internal;
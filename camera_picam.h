@@ -20,6 +20,7 @@ int camera_picam_uninitialize(Camera *camera, void *internal);
 int camera_picam_start_acquiring(Camera *camera, void *internal, bool shutter_open);
 int camera_picam_stop_acquiring(Camera *camera, void *internal);
 int camera_picam_tick(Camera *camera, void *internal, PNCameraMode current_mode);
+int camera_picam_tick_timeout(Camera *camera, void *internal, PNCameraMode current_mode);
 int camera_picam_read_temperature(Camera *camera, void *internal, double *temperature);
 int camera_picam_query_ccd_region(Camera *camera, void *internal, uint16_t region[4]);
 
@@ -28,12 +28,56 @@ enum ForceReadOut {
     MAKE_AUTOMATIC
 };
 
+// Number of circular buffer slots that are kept free for the camera when
+// lending frames to the frame manager. Frames are copied instead of lent
+// once the locked slots would leave less than this many free.
+#define ZERO_COPY_RESERVE_SLOTS 2
+
+// Number of frame hashes remembered from the previous acquisition, and the number of
+// frames after a warm start that are compared against them. Must cover the PVCAM
+// circular buffer and anything held by the driver.
+#define STALE_FRAME_HISTORY 32
+
+// Interval to poll for new frames while acquiring, in ms.
+// The PVCAM 2.7 API has no frame notification to wait on.
+#define FRAME_POLL_INTERVAL 20
+
+struct frame_ring;
+struct frame_slot
+{
+    struct frame_ring *ring;
+    size_t index;
+};
+
+// PVCAM circular buffer plus tracking for slots that have been lent
+// to the frame manager. Slots are retrieved and unlocked in ring order,
+// so the locked slots are always a contiguous run starting at head.
+struct frame_ring
+{
+    Camera *camera;
+    uns8 *memory;
+    uns32 slot_bytes;
+    size_t slot_count;
+
+    // Owned by the camera thread
+    size_t head;
+    size_t locked;
+
+    // Set by the frame manager when a lent slot can be unlocked
+    uint8_t *released;
+    struct frame_slot *slots;
+
+    // One reference for the camera plus one for each lent frame
+    size_t refs;
+};
+
 // Holds the state of a camera
 struct internal
 {
     int16 handle;
     uns32 frame_size;
-    uns16 *frame_buffer;
+    struct frame_ring *ring;
+    bool zero_copy;
 
     uint16_t ccd_width;
     uint16_t ccd_height;
@@ -58,6 +102,24 @@ struct internal
 
     double readout_time;
     double vertical_shift_us;
+
+    // Parameters most recently applied to the camera, so that a warm start
+    // only needs to send the ones that have changed. Invalid after (re)opening.
+    bool applied_valid;
+    uns32 applied_port;
+    int16 applied_speed;
+    int16 applied_gain;
+    int applied_temperature;
+
+    // PVCAM can't return to the default readout mode after forcing frame
+    // transfer, so bias acquisitions after triggered ones need a full reinit
+    bool frame_transfer_forced;
+
+    // Hashes of the most recent frames, to recognise stale frames
+    // returned by the driver after a warm start
+    uint64_t recent_hashes[STALE_FRAME_HISTORY];
+    size_t recent_hash_count;
+    size_t stale_check_remaining;
 };
 
 static char *gain_names[] = {"Low", "Medium", "High"};
@@ -72,6 +134,111 @@ static void log_pvcam_error()
     pn_log("PVCAM error: %d = %s.", error, pvmsg);
 }
 
+// FNV-1a hash of a sparse sample of the frame data.
+// Stale frames are exact copies of earlier readouts, while read noise
+// makes genuine frames differ throughout, so a sample is sufficient.
+static uint64_t frame_hash(const uns8 *data, uns32 size)
+{
+    const uint16_t *pixels = (const uint16_t *)data;
+    size_t count = size / sizeof(uint16_t);
+    size_t stride = count > 4096 ? count / 4096 : 1;
+
+    uint64_t hash = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < count; i += stride)
+    {
+        hash ^= pixels[i];
+        hash *= UINT64_C(1099511628211);
+    }
+
+    return hash;
+}
+
+static bool is_recent_frame(struct internal *internal, uint64_t hash)
+{
+    size_t count = internal->recent_hash_count < STALE_FRAME_HISTORY ? internal->recent_hash_count : STALE_FRAME_HISTORY;
+    for (size_t i = 0; i < count; i++)
+        if (internal->recent_hashes[i] == hash)
+            return true;
+
+    return false;
+}
+
+static void remember_frame(struct internal *internal, uint64_t hash)
+{
+    internal->recent_hashes[internal->recent_hash_count++ % STALE_FRAME_HISTORY] = hash;
+}
+
+static struct frame_ring *frame_ring_new(Camera *camera, uns32 slot_bytes, size_t slot_count)
+{
+    struct frame_ring *ring = calloc(1, sizeof(struct frame_ring));
+    if (!ring)
+        return NULL;
+
+    ring->memory = malloc(slot_bytes*slot_count);
+    ring->released = calloc(slot_count, sizeof(uint8_t));
+    ring->slots = calloc(slot_count, sizeof(struct frame_slot));
+    if (!ring->memory || !ring->released || !ring->slots)
+    {
+        free(ring->memory);
+        free(ring->released);
+        free(ring->slots);
+        free(ring);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < slot_count; i++)
+        ring->slots[i] = (struct frame_slot){.ring = ring, .index = i};
+
+    ring->camera = camera;
+    ring->slot_bytes = slot_bytes;
+    ring->slot_count = slot_count;
+    ring->refs = 1;
+    return ring;
+}
+
+static void frame_ring_unref(struct frame_ring *ring)
+{
+    if (__atomic_sub_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    free(ring->memory);
+    free(ring->released);
+    free(ring->slots);
+    free(ring);
+}
+
+// Called by the frame manager when it has finished with a lent frame.
+// The slot itself is unlocked by the camera thread, as PVCAM
+// must only be called from there.
+static void frame_slot_release(void *_slot)
+{
+    struct frame_slot *slot = _slot;
+    __atomic_store_n(&slot->ring->released[slot->index], 1, __ATOMIC_RELEASE);
+    camera_notify_event(slot->ring->camera);
+    frame_ring_unref(slot->ring);
+}
+
+// Unlock the oldest locked slots that have been released by the frame manager
+static int unlock_released_slots(struct internal *internal)
+{
+    struct frame_ring *ring = internal->ring;
+    while (ring->locked > 0 && __atomic_load_n(&ring->released[ring->head], __ATOMIC_ACQUIRE))
+    {
+        ring->released[ring->head] = 0;
+        ring->head = (ring->head + 1) % ring->slot_count;
+        ring->locked--;
+
+        if (!pl_exp_unlock_oldest_frame(internal->handle))
+        {
+            pn_log("Failed to unlock oldest frame.");
+            log_pvcam_error();
+            return CAMERA_ERROR;
+        }
+    }
+
+    return CAMERA_OK;
+}
+
 static int frame_available(struct internal *internal, bool *available)
 {
     int16 status = READOUT_NOT_ACTIVE;
@@ -212,6 +379,8 @@ static int initialize_camera(struct internal *internal)
     }
 
     pn_log("Camera ID: \"%s\".", cameraName);
+    internal->applied_valid = false;
+    internal->frame_transfer_forced = false;
 
     // Check camera status
     if (!pl_cam_get_diags(internal->handle))
@@ -327,7 +496,10 @@ int camera_pvcam_update_camera_settings(Camera *camera, void *_internal, double
         port_id = 0;
     }
 
-    if (port_count > 1)
+    // Only send parameters that have changed since they were last applied.
+    // Changing the port or speed may reset the dependent parameters, so those are always resent.
+    bool port_changed = !internal->applied_valid || internal->applied_port != port_id;
+    if (port_changed && port_count > 1)
         set_param(error, internal->handle, PARAM_READOUT_PORT, &port_id);
 
     uint8_t speed_id = pn_preference_char(CAMERA_READSPEED_MODE);
@@ -342,7 +514,10 @@ int camera_pvcam_update_camera_settings(Camera *camera, void *_internal, double
         pn_preference_set_char(CAMERA_READSPEED_MODE, 0);
         speed_value = speed_min;
     }
-    set_param(error, internal->handle, PARAM_SPDTAB_INDEX, &speed_value);
+
+    bool speed_changed = port_changed || internal->applied_speed != speed_value;
+    if (speed_changed)
+        set_param(error, internal->handle, PARAM_SPDTAB_INDEX, &speed_value);
 
     uint8_t gain_id = pn_preference_char(CAMERA_GAIN_MODE);
     int16 gain_min, gain_max;
@@ -357,22 +532,31 @@ int camera_pvcam_update_camera_settings(Camera *camera, void *_internal, double
         gain_value = gain_min;
     }
 
-    set_param(error, internal->handle, PARAM_GAIN_INDEX, &gain_value);
-
-    // Store port/speed/gain descriptions to store in frames
-    free(internal->current_port_desc);
-    if (port_description(internal, &internal->current_port_desc) != CAMERA_OK)
-        goto error;
-
-    free(internal->current_speed_desc);
-    if (speed_description(internal, &internal->current_speed_desc) != CAMERA_OK)
-        goto error;
-
-    free(internal->current_gain_desc);
-    if (gain_description(internal, &internal->current_gain_desc) != CAMERA_OK)
-        goto error;
+    bool gain_changed = speed_changed || internal->applied_gain != gain_value;
+    if (gain_changed)
+    {
+        set_param(error, internal->handle, PARAM_GAIN_INDEX, &gain_value);
+
+        // Store port/speed/gain descriptions to store in frames
+        free(internal->current_port_desc);
+        internal->current_port_desc = NULL;
+        if (port_description(internal, &internal->current_port_desc) != CAMERA_OK)
+            goto error;
+
+        free(internal->current_speed_desc);
+        internal->current_speed_desc = NULL;
+        if (speed_description(internal, &internal->current_speed_desc) != CAMERA_OK)
+            goto error;
+
+        free(internal->current_gain_desc);
+        internal->current_gain_desc = NULL;
+        if (gain_description(internal, &internal->current_gain_desc) != CAMERA_OK)
+            goto error;
+    }
 
-    set_param(error, internal->handle, PARAM_TEMP_SETPOINT, &(int){pn_preference_int(CAMERA_TEMPERATURE)});
+    int temperature = pn_preference_int(CAMERA_TEMPERATURE);
+    if (!internal->applied_valid || internal->applied_temperature != temperature)
+        set_param(error, internal->handle, PARAM_TEMP_SETPOINT, &temperature);
 
     // Set readout area
     uint16_t ww = pn_preference_int(CAMERA_WINDOW_WIDTH);
@@ -453,8 +637,12 @@ int camera_pvcam_update_camera_settings(Camera *camera, void *_internal, double
     // If bias mode is requested then ignore triggers and acquire as fast as possible
 
     uint8_t trigger_mode = pn_preference_char(TIMER_TRIGGER_MODE);
-    if (trigger_mode != TRIGGER_BIAS)
+    bool frame_transfer = trigger_mode != TRIGGER_BIAS;
+    if (frame_transfer && !internal->frame_transfer_forced)
+    {
         set_param(error, internal->handle, PARAM_FORCE_READOUT_MODE, &(int){MAKE_FRAME_TRANSFER});
+        internal->frame_transfer_forced = true;
+    }
 
     int16 pv_trigger_mode = trigger_mode == TRIGGER_BIAS ? TIMED_MODE : STROBED_MODE;
     if (!pl_exp_setup_cont(internal->handle, 1, &region, pv_trigger_mode, 0, &internal->frame_size, CIRC_NO_OVERWRITE))
@@ -464,6 +652,13 @@ int camera_pvcam_update_camera_settings(Camera *camera, void *_internal, double
         return CAMERA_ERROR;
     }
 
+    // Everything that was sent has now been applied
+    internal->applied_valid = true;
+    internal->applied_port = port_id;
+    internal->applied_speed = speed_value;
+    internal->applied_gain = gain_value;
+    internal->applied_temperature = temperature;
+
     // Query readout time
     flt64 readout_time;
     get_param(error, internal->handle, PARAM_READOUT_TIME, ATTR_CURRENT, &readout_time);
@@ -482,6 +677,23 @@ int camera_pvcam_update_camera_settings(Camera *camera, void *_internal, double
         pn_log("Increasing EXPOSURE_TIME to %d.", new_exposure);
     }
 
+    // Shared by every frame until the settings next change
+    struct camera_readout *readout = camera_readout_new(internal->current_port_desc,
+        internal->current_speed_desc, internal->current_gain_desc);
+    if (!readout)
+    {
+        pn_log("Failed to allocate readout settings.");
+        goto error;
+    }
+
+    readout->readout_time = internal->readout_time;
+    readout->vertical_shift_us = internal->vertical_shift_us;
+    readout->has_image_region = internal->has_image_region;
+    memcpy(readout->image_region, internal->image_region, 4*sizeof(uint16_t));
+    readout->has_bias_region = internal->has_bias_region;
+    memcpy(readout->bias_region, internal->bias_region, 4*sizeof(uint16_t));
+    camera_set_readout(camera, readout);
+
     *out_readout_time = internal->readout_time;
 
     return CAMERA_OK;
@@ -568,24 +780,52 @@ int camera_pvcam_start_acquiring(Camera *camera, void *_internal, bool shutter_o
 {
     struct internal *internal = _internal;
 
-    // Reinitialize camera from scratch to work around a driver bug/PVCAM that causes
-    // several stale frames to be returned before the real frame data resulting in
-    // frames that are recieved several exposure periods after their actual time
-    pn_log("Reinitializing camera.");
-    uninitialize_camera(internal);
-    initialize_camera(internal);
+    // A driver bug/PVCAM returns several stale frames before the real frame data,
+    // resulting in frames that are recieved several exposure periods after their
+    // actual time. By default the camera is kept open and only changed settings
+    // are applied, and the stale frames are recognised and discarded as they arrive.
+    // Reinitializing the camera from scratch also avoids them, but takes several seconds.
+    bool bias = pn_preference_char(TIMER_TRIGGER_MODE) == TRIGGER_BIAS;
+    bool warm_start = !pn_preference_char(CAMERA_FULL_REINIT) && !(bias && internal->frame_transfer_forced);
+
     double readout_time;
-    camera_pvcam_update_camera_settings(camera, internal, &readout_time);
+    if (warm_start && camera_pvcam_update_camera_settings(camera, internal, &readout_time) != CAMERA_OK)
+    {
+        pn_log("Failed to update camera settings. Falling back to full reinitialization.");
+        warm_start = false;
+    }
+
+    if (!warm_start)
+    {
+        pn_log("Reinitializing camera.");
+        uninitialize_camera(internal);
+        if (initialize_camera(internal) != CAMERA_OK)
+            return CAMERA_ERROR;
+
+        if (camera_pvcam_update_camera_settings(camera, internal, &readout_time) != CAMERA_OK)
+            return CAMERA_ERROR;
+
+        internal->recent_hash_count = 0;
+    }
+
+    // Compare the first frames against the end of the previous acquisition
+    internal->stale_check_remaining = warm_start ? STALE_FRAME_HISTORY : 0;
 
     // Create a buffer large enough to hold multiple frames. PVCAM and the USB driver
     // tend to give frames in batches for very fast exposures, which need a bigger buffer.
-    uns32 buffer_size = internal->frame_size*pn_preference_int(CAMERA_FRAME_BUFFER_SIZE);
-    internal->frame_buffer = malloc(buffer_size*sizeof(uns16));
-    if (!internal->frame_buffer)
+    size_t buffer_frames = pn_preference_int(CAMERA_FRAME_BUFFER_SIZE);
+    internal->ring = frame_ring_new(camera, internal->frame_size, buffer_frames);
+    if (!internal->ring)
         return CAMERA_ALLOCATION_FAILED;
 
+    // Lending frames requires enough slots to keep some free for the camera
+    internal->zero_copy = pn_preference_char(CAMERA_ZERO_COPY) && buffer_frames > ZERO_COPY_RESERVE_SLOTS;
+    if (pn_preference_char(CAMERA_ZERO_COPY) && !internal->zero_copy)
+        pn_log("Zero-copy frames require CameraFrameBufferSize > %d. Frames will be copied.", ZERO_COPY_RESERVE_SLOTS);
+
     // Start waiting for sync pulses to trigger exposures
-    if (!pl_exp_start_cont(internal->handle, internal->frame_buffer, buffer_size))
+    uns32 buffer_size = internal->frame_size*buffer_frames;
+    if (!pl_exp_start_cont(internal->handle, internal->ring->memory, buffer_size))
     {
         pn_log("Failed to start exposure sequence.");
         log_pvcam_error();
@@ -598,25 +838,10 @@ int camera_pvcam_start_acquiring(Camera *camera, void *_internal, bool shutter_o
 int camera_pvcam_stop_acquiring(Camera *camera, void *_internal)
 {
     struct internal *internal = _internal;
+    struct frame_ring *ring = internal->ring;
     int ret = CAMERA_OK;
 
-    // Clear any buffered frames
-    void_ptr camera_frame;
-    bool available;
-    do
-    {
-        ret = frame_available(internal, &available);
-        if (ret != CAMERA_OK)
-            break;
-
-        if (available)
-        {
-            pl_exp_get_oldest_frame(internal->handle, &camera_frame);
-            pl_exp_unlock_oldest_frame(internal->handle);
-            pn_log("Discarding buffered frame.");
-        }
-    } while (available);
-
+    // Stop the sequence first so that no new frames are written while the buffer is drained
     if (!pl_exp_stop_cont(internal->handle, CCS_HALT))
     {
         pn_log("Failed to stop exposure sequence.");
@@ -624,14 +849,47 @@ int camera_pvcam_stop_acquiring(Camera *camera, void *_internal)
         ret = CAMERA_ERROR;
     }
 
-    if (!pl_exp_finish_seq(internal->handle, internal->frame_buffer, 0))
+    if (unlock_released_slots(internal) != CAMERA_OK)
+        ret = CAMERA_ERROR;
+
+    // pl_exp_unlock_oldest_frame always applies to the oldest locked slot, so buffered
+    // frames can only be discarded once the frame manager has returned every lent slot.
+    // Otherwise they are left for pl_exp_finish_seq to drop with the rest of the buffer.
+    if (ring->locked > 0)
+        pn_log("%zu frames are still being processed. Skipping buffered frames.", ring->locked);
+    else
+    {
+        void_ptr camera_frame;
+        bool available = false;
+        do
+        {
+            if (frame_available(internal, &available) != CAMERA_OK)
+            {
+                ret = CAMERA_ERROR;
+                break;
+            }
+
+            if (available)
+            {
+                // Remember the frame in case the driver returns it again after a warm start
+                if (pl_exp_get_oldest_frame(internal->handle, &camera_frame))
+                    remember_frame(internal, frame_hash(camera_frame, internal->frame_size));
+                pl_exp_unlock_oldest_frame(internal->handle);
+                pn_log("Discarding buffered frame.");
+            }
+        } while (available);
+    }
+
+    if (!pl_exp_finish_seq(internal->handle, ring->memory, 0))
     {
         pn_log("Failed to finish exposure sequence.");
         log_pvcam_error();
         ret = CAMERA_ERROR;
     }
 
-    free(internal->frame_buffer);
+    // Frames that are still lent to the frame manager keep the buffer alive
+    frame_ring_unref(ring);
+    internal->ring = NULL;
     return ret;
 }
 
@@ -655,6 +913,10 @@ int camera_pvcam_tick(Camera *camera, void *_internal, PNCameraMode current_mode
     // Check for new frame
     while (current_mode == ACQUIRING)
     {
+        // Unlock frames that the frame manager has finished with
+        if (unlock_released_slots(internal) != CAMERA_OK)
+            return CAMERA_ERROR;
+
         bool available = false;
         int status = frame_available(internal, &available);
         if (status != CAMERA_OK || !available)
@@ -668,57 +930,77 @@ int camera_pvcam_tick(Camera *camera, void *_internal, PNCameraMode current_mode
             return CAMERA_ERROR;
         }
 
-        // Copy frame data and pass ownership to main thread
-        CameraFrame *frame = malloc(sizeof(CameraFrame));
-        if (frame)
+        // Frames are expected to arrive in ring order following any that are still locked.
+        // A frame from any other slot can't be lent, so it is copied out and accounted
+        // against the expected slot. This keeps the number of unlocks (which always apply
+        // to the oldest frame) in step with the driver without stalling retrieval.
+        struct frame_ring *ring = internal->ring;
+        size_t slot = ((uns8 *)camera_frame - ring->memory) / ring->slot_bytes;
+        if (ring->locked == 0)
+            ring->head = slot;
+
+        size_t expected = (ring->head + ring->locked) % ring->slot_count;
+        bool in_order = slot == expected;
+        if (!in_order)
+            pn_log("WARNING: Frame arrived in buffer slot %zu instead of %zu. Copying.", slot, expected);
+        ring->locked++;
+
+        // The first frames after a warm start may be repeats from the previous acquisition
+        uint64_t hash = frame_hash(camera_frame, internal->frame_size);
+        bool stale = false;
+        if (internal->stale_check_remaining > 0)
         {
-            size_t frame_bytes = internal->frame_width*internal->frame_height*sizeof(uint16_t);
-            frame->data = malloc(frame_bytes);
-            if (frame->data)
-            {
-                memcpy(frame->data, camera_frame, frame_bytes);
-                frame->width = internal->frame_width;
-                frame->height = internal->frame_height;
-                camera_pvcam_read_temperature(camera, internal, &frame->temperature);
-                frame->has_timestamp = false;
-
-                frame->has_image_region = internal->has_image_region;
-                if (frame->has_image_region)
-                    memcpy(frame->image_region, internal->image_region, 4*sizeof(uint16_t));
-
-                frame->has_bias_region = internal->has_bias_region;
-                if (frame->has_bias_region)
-                    memcpy(frame->bias_region, internal->bias_region, 4*sizeof(uint16_t));
+            internal->stale_check_remaining--;
+            stale = is_recent_frame(internal, hash);
+        }
 
-                frame->readout_time = internal->readout_time;
-                frame->vertical_shift_us = internal->vertical_shift_us;
+        if (stale)
+            pn_log("Discarding stale frame from previous acquisition.");
+        else
+            remember_frame(internal, hash);
 
-                frame->port_desc = strdup(internal->current_port_desc);
-                frame->speed_desc = strdup(internal->current_speed_desc);
-                frame->gain_desc = strdup(internal->current_gain_desc);
-                frame->has_em_gain = false;
-                frame->has_exposure_shortcut = false;
+        // Lend the slot directly unless the camera is running out of free slots
+        bool lend = in_order && internal->zero_copy && ring->locked + ZERO_COPY_RESERVE_SLOTS <= ring->slot_count;
 
-                queue_framedata(frame);
+        // Pass ownership of the frame to main thread
+        CameraFrame *frame = stale ? NULL : camera_claim_frame(camera, internal->frame_width, internal->frame_height);
+        if (frame)
+        {
+            if (lend)
+            {
+                __atomic_add_fetch(&ring->refs, 1, __ATOMIC_ACQ_REL);
+                frame->data = camera_frame;
+                frame->release_data = frame_slot_release;
+                frame->release_data_ref = &ring->slots[slot];
             }
             else
-                pn_log("Failed to allocate CameraFrame->data. Discarding frame.");
+            {
+                size_t frame_bytes = internal->frame_width*internal->frame_height*sizeof(uint16_t);
+                memcpy(frame->data, camera_frame, frame_bytes);
+            }
+
+            frame->has_timestamp = false;
+            queue_framedata(frame);
         }
-        else
-            pn_log("Failed to allocate CameraFrame. Discarding frame.");
 
-        // Unlock the frame buffer for reuse
-        if (!pl_exp_unlock_oldest_frame(internal->handle))
+        // Copied, stale or discarded frames can be unlocked as soon as all older slots are
+        if (!frame || !lend)
         {
-            pn_log("Failed to unlock oldest frame.");
-            log_pvcam_error();
-            return CAMERA_ERROR;
+            ring->released[expected] = 1;
+            if (unlock_released_slots(internal) != CAMERA_OK)
+                return CAMERA_ERROR;
         }
     }
 
     return CAMERA_OK;
 }
 
+// Released slots wake the camera thread, but new frames must be polled
+int camera_pvcam_tick_timeout(Camera *camera, void *internal, PNCameraMode current_mode)
+{
+    return current_mode == ACQUIRING ? FRAME_POLL_INTERVAL : -1;
+}
+
 int camera_pvcam_query_ccd_region(Camera *camera, void *_internal, uint16_t region[4])
 {
     struct internal *internal = _internal;
@@ -748,13 +1030,5 @@ void camera_pvcam_normalize_trigger(Camera *camera, void *internal, TimerTimesta
 {
     // Convert trigger time from end of exposure to start of exposure
     uint16_t exposure = pn_preference_int(EXPOSURE_TIME);
-    if (pn_preference_char(TIMER_TRIGGER_MODE) != TRIGGER_SECONDS)
-    {
-        trigger->seconds -= exposure / 1000;
-        trigger->milliseconds -= exposure % 1000;
-    }
-    else
-        trigger->seconds -= exposure;
-
-    timestamp_normalize(trigger);
+    trigger->time -= exposure*timestamp_exposure_unit(pn_preference_char(TIMER_TRIGGER_MODE));
 }
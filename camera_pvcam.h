@@ -20,6 +20,7 @@ int camera_pvcam_uninitialize(Camera *camera, void *internal);
 int camera_pvcam_start_acquiring(Camera *camera, void *internal, bool shutter_open);
 int camera_pvcam_stop_acquiring(Camera *camera, void *internal);
 int camera_pvcam_tick(Camera *camera, void *internal, PNCameraMode current_mode);
+int camera_pvcam_tick_timeout(Camera *camera, void *internal, PNCameraMode current_mode);
 int camera_pvcam_read_temperature(Camera *camera, void *internal, double *temperature);
 int camera_pvcam_query_ccd_region(Camera *camera, void *internal, uint16_t region[4]);
 
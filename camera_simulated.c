@@ -10,6 +10,7 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <string.h>
+#include <time.h>
 
 #include "camera_simulated.h"
 #include "main.h"
@@ -17,6 +18,10 @@
 #include "timer.h"
 #include "preferences.h"
 #include "platform.h"
+#include "synthetic_frame.h"
+
+// Bias frames that fall further behind than this are skipped rather than generated in a burst
+#define BIAS_MAX_BACKLOG NS_PER_SECOND
 
 // Holds the state of a camera
 struct internal
@@ -28,12 +33,10 @@ struct internal
     bool acquiring;
     size_t queued_frames;
     pthread_mutex_t queue_mutex;
-    TimerTimestamp bias_last_updated;
+    TimestampNS bias_last_updated;
+    TimestampNS bias_interval;
 
-    // String descriptions to store in frame headers
-    char *current_port_desc;
-    char *current_speed_desc;
-    char *current_gain_desc;
+    struct synthetic_frame *sky;
 };
 
 static char *speed_names[] = {"Slow", "Fast"};
@@ -45,10 +48,33 @@ int camera_simulated_initialize(Camera *camera, void **out_internal)
     if (!internal)
         return CAMERA_ALLOCATION_FAILED;
 
-    pthread_mutex_init(&internal->queue_mutex, NULL);
+    int width = pn_preference_int(SIMULATED_FRAME_WIDTH);
+    if (width < 64 || width > 8192)
+    {
+        pn_log("Invalid simulated frame width: %d. Reset to %d.", width, 512);
+        width = 512;
+        pn_preference_set_int(SIMULATED_FRAME_WIDTH, width);
+    }
+
+    int height = pn_preference_int(SIMULATED_FRAME_HEIGHT);
+    if (height < 64 || height > 8192)
+    {
+        pn_log("Invalid simulated frame height: %d. Reset to %d.", height, 512);
+        height = 512;
+        pn_preference_set_int(SIMULATED_FRAME_HEIGHT, height);
+    }
+
+    internal->frame_width = width;
+    internal->frame_height = height;
+    internal->bias_interval = NS_PER_SECOND / 10;
+    internal->sky = synthetic_frame_new(width, height, (uint32_t)time(NULL));
+    if (!internal->sky)
+    {
+        free(internal);
+        return CAMERA_ALLOCATION_FAILED;
+    }
 
-    internal->frame_height = 512;
-    internal->frame_width = 512;
+    pthread_mutex_init(&internal->queue_mutex, NULL);
 
     *out_internal = internal;
     return CAMERA_OK;
@@ -79,9 +105,14 @@ int camera_simulated_update_camera_settings(Camera *camera, void *_internal, dou
         pn_preference_set_char(CAMERA_GAIN_MODE, 0);
     }
 
-    internal->current_port_desc = "Normal";
-    internal->current_speed_desc = speed_names[speed_id];
-    internal->current_gain_desc = gain_names[speed_id*3 + gain_id];
+    struct camera_readout *readout = camera_readout_new("Normal", speed_names[speed_id], gain_names[speed_id*3 + gain_id]);
+    if (!readout)
+    {
+        pn_log("Failed to allocate readout settings.");
+        return CAMERA_ERROR;
+    }
+
+    camera_set_readout(camera, readout);
 
     // Set readout area
     uint16_t ww = pn_preference_int(CAMERA_WINDOW_WIDTH);
@@ -124,6 +155,18 @@ int camera_simulated_update_camera_settings(Camera *camera, void *_internal, dou
         pn_preference_set_char(CAMERA_BINNING, bin);
     }
 
+    int bias_rate = pn_preference_int(SIMULATED_BIAS_RATE);
+    if (bias_rate < 1 || bias_rate > 10000)
+    {
+        pn_log("Invalid simulated bias rate: %d. Reset to %d.", bias_rate, 10);
+        bias_rate = 10;
+        pn_preference_set_int(SIMULATED_BIAS_RATE, bias_rate);
+    }
+
+    pthread_mutex_lock(&internal->queue_mutex);
+    internal->bias_interval = NS_PER_SECOND / bias_rate;
+    pthread_mutex_unlock(&internal->queue_mutex);
+
     *out_readout_time = 0;
     return CAMERA_OK;
 }
@@ -161,12 +204,13 @@ int camera_simulated_port_table(Camera *camera, void *internal, struct camera_po
     return CAMERA_OK;
 }
 
-int camera_simulated_query_ccd_region(Camera *camera, void *internal, uint16_t region[4])
+int camera_simulated_query_ccd_region(Camera *camera, void *_internal, uint16_t region[4])
 {
+    struct internal *internal = _internal;
     region[0] = 0;
-    region[1] = 511;
+    region[1] = internal->frame_width - 1;
     region[2] = 0;
-    region[3] = 511;
+    region[3] = internal->frame_height - 1;
     return CAMERA_OK;
 }
 
@@ -174,6 +218,7 @@ int camera_simulated_uninitialize(Camera *camera, void *_internal)
 {
     struct internal *internal = _internal;
     pthread_mutex_destroy(&internal->queue_mutex);
+    synthetic_frame_free(internal->sky);
     free(internal);
     return CAMERA_OK;
 }
@@ -214,74 +259,75 @@ int camera_simulated_tick(Camera *camera, void *_internal, PNCameraMode current_
     size_t queued = internal->queued_frames;
     internal->queued_frames = 0;
 
-    if (internal->acquiring && pn_preference_char(TIMER_TRIGGER_MODE) == TRIGGER_BIAS)
+    bool bias = pn_preference_char(TIMER_TRIGGER_MODE) == TRIGGER_BIAS;
+    if (internal->acquiring && bias)
     {
-        // Simulate a new bias every 100ms
-        TimerTimestamp bias_updated = system_time();
-        double dt = (timestamp_to_unixtime(&bias_updated) - timestamp_to_unixtime(&internal->bias_last_updated));
-        if (dt >= 0.1)
+        // Simulate a new bias every bias_interval, catching up after a slow tick
+        TimestampNS now = system_time().time;
+        if (now - internal->bias_last_updated > BIAS_MAX_BACKLOG)
+            internal->bias_last_updated = now - internal->bias_interval;
+
+        while (now - internal->bias_last_updated >= internal->bias_interval)
         {
             queued++;
-            internal->bias_last_updated = bias_updated;
+            internal->bias_last_updated += internal->bias_interval;
         }
     }
     pthread_mutex_unlock(&internal->queue_mutex);
 
     for (size_t i = 0; i < queued; i++)
     {
-        // Copy frame data and pass ownership to main thread
-        CameraFrame *frame = malloc(sizeof(CameraFrame));
-        if (frame)
-        {
-            size_t frame_bytes = internal->frame_width*internal->frame_height*sizeof(uint16_t);
-            frame->data = malloc(frame_bytes);
+        // The scene keeps drifting even if the pool is exhausted
+        synthetic_frame_step(internal->sky);
+
+        // Fill a pooled frame and pass ownership to main thread
+        CameraFrame *frame = camera_claim_frame(camera, internal->frame_width, internal->frame_height);
+        if (!frame)
+            continue;
 
-            if (frame->data)
+        synthetic_frame_render(internal->sky, frame->data, bias, 0, internal->frame_height);
+
+        // Add orientation squares to top corners of frame
+        for (size_t y = 20; y < 30; y++)
+            for (size_t x = 20; x < 30; x++)
             {
-                // Fill frame with random numbers
-                for (size_t i = 0; i < internal->frame_width*internal->frame_height; i++)
-                    frame->data[i] = rand() % 10000;
-
-                // Add orientation squares to top corners of frame
-                for (size_t j = 20; j < 30; j++)
-                    for (size_t i = 20; i < 30; i++)
-                    {
-                        frame->data[(internal->frame_height - j)*internal->frame_width + i] = 0;
-                        frame->data[(internal->frame_height - j)*internal->frame_width +
-                                    internal->frame_width - i] = 65535;
-
-                        frame->data[(internal->frame_height/2 - j + 25)*internal->frame_width +
-                                    internal->frame_width/2 - i + 25] = 20000;
-                    }
-                frame->width = internal->frame_width;
-                frame->height = internal->frame_height;
-                camera_simulated_read_temperature(camera, internal, &frame->temperature);
-
-                frame->readout_time = 0;
-                frame->vertical_shift_us = 0;
-
-                frame->has_timestamp = false;
-                frame->has_image_region = false;
-                frame->has_bias_region = false;
-
-                frame->port_desc = strdup(internal->current_port_desc);
-                frame->speed_desc = strdup(internal->current_speed_desc);
-                frame->gain_desc = strdup(internal->current_gain_desc);
-                frame->has_em_gain = false;
-                frame->has_exposure_shortcut = false;
-
-                queue_framedata(frame);
+                frame->data[(internal->frame_height - y)*internal->frame_width + x] = 0;
+                frame->data[(internal->frame_height - y)*internal->frame_width +
+                            internal->frame_width - x] = 65535;
+
+                frame->data[(internal->frame_height/2 - y + 25)*internal->frame_width +
+                            internal->frame_width/2 - x + 25] = 20000;
             }
-            else
-                pn_log("Failed to allocate CameraFrame->data. Discarding frame.");
-        }
-        else
-            pn_log("Failed to allocate CameraFrame. Discarding frame.");
+
+        frame->has_timestamp = false;
+        queue_framedata(frame);
     }
 
     return CAMERA_OK;
 }
 
+// Triggered frames wake the camera thread via camera_simulated_trigger_frame,
+// but bias frames are generated on a timer
+int camera_simulated_tick_timeout(Camera *camera, void *_internal, PNCameraMode current_mode)
+{
+    struct internal *internal = _internal;
+    if (!internal->acquiring || pn_preference_char(TIMER_TRIGGER_MODE) != TRIGGER_BIAS)
+        return -1;
+
+    pthread_mutex_lock(&internal->queue_mutex);
+    TimestampNS interval = internal->bias_interval;
+    TimestampNS next_bias = internal->bias_last_updated + interval;
+    pthread_mutex_unlock(&internal->queue_mutex);
+
+    // Round up so that the camera thread doesn't spin until the frame is due
+    int64_t remaining = next_bias - system_time().time;
+    if (remaining <= 0)
+        return 0;
+    if (remaining > interval)
+        remaining = interval;
+    return (remaining + NS_PER_MILLISECOND - 1) / NS_PER_MILLISECOND;
+}
+
 bool camera_simulated_supports_readout_display(Camera *camera, void *internal)
 {
     return false;
@@ -301,15 +347,7 @@ void camera_simulated_normalize_trigger(Camera *camera, void *internal, TimerTim
 {
     // Convert trigger time from end of exposure to start of exposure
     uint16_t exposure = pn_preference_int(EXPOSURE_TIME);
-    if (pn_preference_char(TIMER_TRIGGER_MODE) != TRIGGER_SECONDS)
-    {
-        trigger->seconds -= exposure / 1000;
-        trigger->milliseconds -= exposure % 1000;
-    }
-    else
-        trigger->seconds -= exposure;
-    
-    timestamp_normalize(trigger);
+    trigger->time -= exposure*timestamp_exposure_unit(pn_preference_char(TIMER_TRIGGER_MODE));
 }
 
 void camera_simulated_trigger_frame(Camera *camera, void *_internal)
@@ -319,4 +357,6 @@ void camera_simulated_trigger_frame(Camera *camera, void *_internal)
     pthread_mutex_lock(&internal->queue_mutex);
     internal->queued_frames++;
     pthread_mutex_unlock(&internal->queue_mutex);
+
+    camera_notify_event(camera);
 }
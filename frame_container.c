@@ -0,0 +1,283 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fitsio.h>
+#include "frame_container.h"
+#include "preferences.h"
+#include "main.h"
+
+// A run saved as a single FITS file: the primary HDU holds the static
+// header keys, each frame is appended as an image extension, and a
+// binary table of per-frame times and temperatures is kept as the last HDU.
+struct frame_container
+{
+    fitsfile *fptr;
+    char *filepath;
+    uint8_t codec;
+
+    // Per-frame metadata, rewritten as the table at each checkpoint
+    size_t frame_count;
+    size_t frame_capacity;
+    int *run_numbers;
+    char (*dates)[15];
+    char (*start_times)[15];
+    char (*end_times)[15];
+    double *ccd_times;
+    float *temperatures;
+
+    // The table is removed while frames are appended and restored by the next checkpoint
+    bool has_table;
+    bool dirty;
+    time_t last_checkpoint;
+};
+
+static void log_fits_errors(const char *message, int status)
+{
+    char fitserr[128];
+    pn_log("%s fitsio error %d.", message, status);
+    while (fits_read_errmsg(fitserr))
+        pn_log("cfitsio error: %s.", fitserr);
+}
+
+// Filename suffix for containers written with a given OUTPUT_CODEC.
+// Whole-file gzip would prevent appending, so gzip uses tile compression instead.
+const char *frame_container_suffix(uint8_t codec)
+{
+    return codec == CODEC_NONE ? ".fits" : ".fits.fz";
+}
+
+struct frame_container *frame_container_open(const char *filepath, struct frame_header *header, uint8_t codec)
+{
+    struct frame_container *container = calloc(1, sizeof(struct frame_container));
+    if (!container)
+        return NULL;
+
+    container->filepath = strdup(filepath);
+    if (!container->filepath)
+    {
+        free(container);
+        return NULL;
+    }
+
+    int status = 0;
+    if (fits_create_file(&container->fptr, filepath, &status))
+    {
+        log_fits_errors("Failed to create container file.", status);
+        free(container->filepath);
+        free(container);
+        return NULL;
+    }
+
+    // Empty primary HDU holding the keys that are shared by every frame
+    fits_create_img(container->fptr, USHORT_IMG, 0, NULL, &status);
+    frame_header_write(header, container->fptr, &status);
+    fits_flush_file(container->fptr, &status);
+    if (status)
+    {
+        log_fits_errors("Failed to write container header.", status);
+        fits_close_file(container->fptr, &(int){0});
+        free(container->filepath);
+        free(container);
+        return NULL;
+    }
+
+    container->codec = codec;
+    container->last_checkpoint = time(NULL);
+    return container;
+}
+
+static bool grow_metadata(struct frame_container *container)
+{
+    size_t capacity = container->frame_capacity ? 2*container->frame_capacity : 256;
+
+    int *run_numbers = realloc(container->run_numbers, capacity*sizeof(int));
+    if (run_numbers)
+        container->run_numbers = run_numbers;
+
+    char (*dates)[15] = realloc(container->dates, capacity*15);
+    if (dates)
+        container->dates = dates;
+
+    char (*start_times)[15] = realloc(container->start_times, capacity*15);
+    if (start_times)
+        container->start_times = start_times;
+
+    char (*end_times)[15] = realloc(container->end_times, capacity*15);
+    if (end_times)
+        container->end_times = end_times;
+
+    double *ccd_times = realloc(container->ccd_times, capacity*sizeof(double));
+    if (ccd_times)
+        container->ccd_times = ccd_times;
+
+    float *temperatures = realloc(container->temperatures, capacity*sizeof(float));
+    if (temperatures)
+        container->temperatures = temperatures;
+
+    if (!run_numbers || !dates || !start_times || !end_times || !ccd_times || !temperatures)
+        return false;
+
+    container->frame_capacity = capacity;
+    return true;
+}
+
+bool frame_container_append(struct frame_container *container, CameraFrame *frame, TimerTimestamp *timestamp,
+                            struct frame_header *header, int run_number)
+{
+    if (container->frame_count == container->frame_capacity && !grow_metadata(container))
+    {
+        pn_log("Failed to allocate container metadata. Discarding frame.");
+        return false;
+    }
+
+    int status = 0;
+    fitsfile *fptr = container->fptr;
+
+    // The table is always the last HDU, so removing it just truncates the file
+    if (container->has_table)
+    {
+        int hdu_count;
+        fits_get_num_hdus(fptr, &hdu_count, &status);
+        fits_movabs_hdu(fptr, hdu_count, NULL, &status);
+        fits_delete_hdu(fptr, NULL, &status);
+        container->has_table = false;
+    }
+
+    switch (container->codec)
+    {
+        case CODEC_GZIP:
+            fits_set_compression_type(fptr, GZIP_1, &status);
+            break;
+        case CODEC_RICE:
+            fits_set_compression_type(fptr, RICE_1, &status);
+            break;
+        case CODEC_HCOMPRESS:
+            fits_set_compression_type(fptr, HCOMPRESS_1, &status);
+
+            // Zero scale is lossless
+            fits_set_hcomp_scale(fptr, 0, &status);
+            break;
+    }
+
+    long size[2] = { frame->width, frame->height };
+    fits_create_img(fptr, USHORT_IMG, 2, size, &status);
+    fits_update_key(fptr, TINT, "RUN-NUM", &run_number, "Run number of this frame", &status);
+    frame_header_write_frame_keys(header, fptr, frame, timestamp, &status);
+    fits_write_img(fptr, TUSHORT, 1, frame->width*frame->height, frame->data, &status);
+
+    if (status)
+    {
+        log_fits_errors("Failed to append frame to container.", status);
+        return false;
+    }
+
+    size_t i = container->frame_count++;
+    container->run_numbers[i] = run_number;
+    frame_header_format_times(header, timestamp, container->dates[i], container->start_times[i], container->end_times[i]);
+    container->ccd_times[i] = frame->has_timestamp ? frame->timestamp : NAN;
+    container->temperatures[i] = frame->temperature;
+    container->dirty = true;
+
+    return true;
+}
+
+// Rewrite the per-frame table and flush everything to disk, so that
+// the file is complete and readable if the program stops unexpectedly
+bool frame_container_checkpoint(struct frame_container *container)
+{
+    if (!container->dirty)
+        return true;
+
+    int status = 0;
+    fitsfile *fptr = container->fptr;
+    size_t n = container->frame_count;
+
+    char *ttype[] = {"RUN-NUM", "UTC-DATE", "UTC-BEG", "UTC-END", "CCD-TIME", "CCD-TEMP"};
+    char *tform[] = {"1J", "10A", "12A", "12A", "1D", "1E"};
+    char *tunit[] = {"", "", "", "", "s", "deg C"};
+    fits_create_tbl(fptr, BINARY_TBL, n, 6, ttype, tform, tunit, "FRAMES", &status);
+
+    char **dates = malloc(n*sizeof(char *));
+    char **start_times = malloc(n*sizeof(char *));
+    char **end_times = malloc(n*sizeof(char *));
+    if (dates && start_times && end_times)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            dates[i] = container->dates[i];
+            start_times[i] = container->start_times[i];
+            end_times[i] = container->end_times[i];
+        }
+
+        fits_write_col(fptr, TINT, 1, 1, 1, n, container->run_numbers, &status);
+        fits_write_col(fptr, TSTRING, 2, 1, 1, n, dates, &status);
+        fits_write_col(fptr, TSTRING, 3, 1, 1, n, start_times, &status);
+        fits_write_col(fptr, TSTRING, 4, 1, 1, n, end_times, &status);
+        fits_write_col(fptr, TDOUBLE, 5, 1, 1, n, container->ccd_times, &status);
+        fits_write_col(fptr, TFLOAT, 6, 1, 1, n, container->temperatures, &status);
+    }
+    else
+        pn_log("Failed to allocate container table.");
+
+    free(dates);
+    free(start_times);
+    free(end_times);
+
+    fits_flush_file(fptr, &status);
+    container->has_table = true;
+    container->dirty = false;
+    container->last_checkpoint = time(NULL);
+
+    if (status)
+    {
+        log_fits_errors("Failed to checkpoint container.", status);
+        return false;
+    }
+
+    return true;
+}
+
+bool frame_container_checkpoint_due(struct frame_container *container)
+{
+    return container->dirty && time(NULL) - container->last_checkpoint >= CONTAINER_CHECKPOINT_INTERVAL;
+}
+
+void frame_container_close(struct frame_container *container)
+{
+    if (!container)
+        return;
+
+    frame_container_checkpoint(container);
+
+    int status = 0;
+    fits_close_file(container->fptr, &status);
+    if (status)
+        log_fits_errors("Failed to close container.", status);
+
+    free(container->filepath);
+    free(container->run_numbers);
+    free(container->dates);
+    free(container->start_times);
+    free(container->end_times);
+    free(container->ccd_times);
+    free(container->temperatures);
+    free(container);
+}
+
+const char *frame_container_filepath(struct frame_container *container)
+{
+    return container->filepath;
+}
+
+size_t frame_container_frame_count(struct frame_container *container)
+{
+    return container->frame_count;
+}
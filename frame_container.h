@@ -0,0 +1,31 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef FRAME_CONTAINER_H
+#define FRAME_CONTAINER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "frame_header.h"
+#include "main.h"
+
+// Maximum time (in seconds) between checkpoints while frames are being appended
+#define CONTAINER_CHECKPOINT_INTERVAL 10
+
+struct frame_container;
+
+const char *frame_container_suffix(uint8_t codec);
+struct frame_container *frame_container_open(const char *filepath, struct frame_header *header, uint8_t codec);
+bool frame_container_append(struct frame_container *container, CameraFrame *frame, TimerTimestamp *timestamp,
+                            struct frame_header *header, int run_number);
+bool frame_container_checkpoint(struct frame_container *container);
+bool frame_container_checkpoint_due(struct frame_container *container);
+void frame_container_close(struct frame_container *container);
+const char *frame_container_filepath(struct frame_container *container);
+size_t frame_container_frame_count(struct frame_container *container);
+
+#endif
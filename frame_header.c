@@ -0,0 +1,301 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fitsio.h>
+#include "frame_header.h"
+#include "frame_transform.h"
+#include "camera.h"
+#include "preferences.h"
+#include "timer.h"
+#include "version.h"
+#include "main.h"
+
+// Write a readout region, reoriented to match the transformed frame
+static void write_region(fitsfile *fptr, const char *key, const uint16_t readout_region[4],
+                         CameraFrame *frame, const char *comment, int *status)
+{
+    // The region is oriented relative to the frame size before transposing
+    bool transposed = frame->orientation & ORIENTATION_TRANSPOSE;
+    uint16_t width = transposed ? frame->height : frame->width;
+    uint16_t height = transposed ? frame->width : frame->height;
+
+    uint16_t region[4];
+    memcpy(region, readout_region, 4*sizeof(uint16_t));
+    frame_orient_region(region, width, height, frame->orientation);
+
+    char buf[25];
+    snprintf(buf, 25, "[%d, %d, %d, %d]", region[0], region[1], region[2], region[3]);
+    fits_update_key(fptr, TSTRING, key, buf, comment, status);
+}
+
+// Write the keys that don't change during an acquisition
+static void write_static_keys(fitsfile *fptr, struct frame_header *header, CameraFrame *frame, int *status)
+{
+    if (header->trigger_mode == TRIGGER_BIAS)
+    {
+        fits_update_key(fptr, TSTRING, "OBJECT", "Bias", "Object name", status);
+    }
+    else
+    {
+        switch (pn_preference_char(OBJECT_TYPE))
+        {
+            case OBJECT_DARK:
+                fits_update_key(fptr, TSTRING, "OBJECT", "Dark", "Object name", status);
+                break;
+            case OBJECT_FLAT:
+                fits_update_key(fptr, TSTRING, "OBJECT", "Flat Field", "Object name", status);
+                break;
+            case OBJECT_FOCUS:
+                fits_update_key(fptr, TSTRING, "OBJECT", "Focus", "Object name", status);
+                break;
+            case OBJECT_TARGET:
+            default:
+            {
+                char *object_name = pn_preference_string(OBJECT_NAME);
+                fits_update_key(fptr, TSTRING, "OBJECT", (void *)object_name, "Object name", status);
+                free(object_name);
+                break;
+            }
+        }
+
+        if (header->trigger_mode == TRIGGER_MILLISECONDS)
+        {
+            double exptime = header->exposure_time / 1000.0;
+            fits_update_key(fptr, TDOUBLE, "EXPTIME", &exptime, "Actual integration time (sec)", status);
+        }
+        else
+            fits_update_key(fptr, TLONG, "EXPTIME", &(long){header->exposure_time}, "Actual integration time (sec)", status);
+    }
+
+    char *observers = pn_preference_string(OBSERVERS);
+    fits_update_key(fptr, TSTRING, "OBSERVER", (void *)observers, "Observers", status);
+    free(observers);
+
+    char *observatory = pn_preference_string(OBSERVATORY);
+    fits_update_key(fptr, TSTRING, "OBSERVAT", (void *)observatory, "Observatory", status);
+    free(observatory);
+
+    char *telescope = pn_preference_string(TELESCOPE);
+    fits_update_key(fptr, TSTRING, "TELESCOP", (void *)telescope, "Telescope name", status);
+    free(telescope);
+
+    char *instrument = pn_preference_string(INSTRUMENT);
+    fits_update_key(fptr, TSTRING, "INSTRUME", (void *)instrument, "Instrument name", status);
+    free(instrument);
+
+    char *filter = pn_preference_string(FILTER);
+    fits_update_key(fptr, TSTRING, "FILTER", (void *)filter, "Filter type", status);
+    free(filter);
+
+    fits_update_key(fptr, TSTRING, "PROG-VER", (void *)program_version() , "Acquisition program version reported by git", status);
+
+    // Readout settings can't be changed during an acquisition
+    struct camera_readout *readout = frame->readout;
+    if (readout)
+    {
+        fits_update_key(fptr, TSTRING, "CCD-PORT", (void *)readout->port_desc, "CCD readout port description", status);
+        fits_update_key(fptr, TSTRING, "CCD-RATE", (void *)readout->speed_desc, "CCD readout rate description", status);
+        fits_update_key(fptr, TSTRING, "CCD-GAIN", (void *)readout->gain_desc, "CCD readout gain description", status);
+    }
+
+    fits_update_key(fptr, TLONG,   "CCD-BIN",  &(long){pn_preference_char(CAMERA_BINNING)},  "CCD pixel binning", status);
+
+    if (readout)
+    {
+        fits_update_key(fptr, TDOUBLE, "CCD-ROUT",  &readout->readout_time,  "CCD readout time (s)", status);
+        fits_update_key(fptr, TDOUBLE, "CCD-SHFT",  &readout->vertical_shift_us,  "CCD vertical shift time (us)", status);
+
+        if (readout->has_em_gain)
+            fits_update_key(fptr, TDOUBLE,   "CCD-EMGN",  &readout->em_gain,  "CCD electron multiplication gain", status);
+
+        if (readout->has_exposure_shortcut)
+            fits_update_key(fptr, TUSHORT, "CCD-SCUT", &readout->exposure_shortcut_ms, "ProEM exposure shortcut (ms)", status);
+    }
+
+    char *trigger_mode_str;
+    switch (header->trigger_mode)
+    {
+        case TRIGGER_MILLISECONDS: trigger_mode_str = "High Resolution"; break;
+        case TRIGGER_SECONDS: trigger_mode_str = "Low Resolution"; break;
+        case TRIGGER_BIAS: trigger_mode_str = "Bias (no triggers)"; break;
+            break;
+    }
+    fits_update_key(fptr, TSTRING, "TRG-MODE", (void *)trigger_mode_str, "Instrument trigger mode", status);
+
+    if (header->trigger_mode != TRIGGER_BIAS)
+        fits_update_key(fptr, TLOGICAL, "TRG-ALGN", &(int){pn_preference_char(TIMER_ALIGN_FIRST_EXPOSURE)}, "Initial trigger aligned to a full minute", status);
+
+    char *pscale = pn_preference_string(CAMERA_PLATESCALE);
+    fits_update_key(fptr, TDOUBLE, "IM-SCALE",  &(double){pn_preference_char(CAMERA_BINNING)*atof(pscale)},  "Image scale (arcsec/px)", status);
+    free(pscale);
+
+    if (readout && readout->has_image_region)
+        write_region(fptr, "IMAG-RGN", readout->image_region, frame, "Frame image subregion", status);
+
+    if (readout && readout->has_bias_region)
+        write_region(fptr, "BIAS-RGN", readout->bias_region, frame, "Frame bias subregion", status);
+}
+
+// Render the static header cards for an acquisition using the current
+// preferences and the readout settings of its first (transformed) frame
+struct frame_header *frame_header_new(CameraFrame *frame)
+{
+    struct frame_header *header = calloc(1, sizeof(struct frame_header));
+    if (!header)
+        return NULL;
+
+    // Read the generation first so that changes made while
+    // the header is being built cause it to be rebuilt
+    header->generation = pn_preference_generation();
+    header->trigger_mode = pn_preference_char(TIMER_TRIGGER_MODE);
+    header->exposure_time = pn_preference_int(EXPOSURE_TIME);
+    header->refs = 1;
+
+    // Write the keys to a scratch in-memory file and read back the
+    // formatted cards, so they match what fits_update_key would write
+    fitsfile *fptr;
+    int status = 0;
+    size_t buffer_size = 2880;
+    void *buffer = malloc(buffer_size);
+    if (!buffer || fits_create_memfile(&fptr, &buffer, &buffer_size, 2880, realloc, &status))
+    {
+        pn_log("Failed to create FITS header block. fitsio error %d.", status);
+        free(buffer);
+        free(header);
+        return NULL;
+    }
+
+    fits_create_img(fptr, USHORT_IMG, 0, NULL, &status);
+
+    int first, count;
+    fits_get_hdrspace(fptr, &first, NULL, &status);
+    write_static_keys(fptr, header, frame, &status);
+    fits_get_hdrspace(fptr, &count, NULL, &status);
+
+    if (!status && count > first)
+    {
+        header->card_count = count - first;
+        header->cards = calloc(header->card_count, FLEN_CARD);
+        for (size_t i = 0; header->cards && i < header->card_count; i++)
+            fits_read_record(fptr, first + 1 + i, header->cards[i], &status);
+    }
+
+    fits_close_file(fptr, &status);
+    free(buffer);
+
+    if (status || !header->cards)
+    {
+        char fitserr[128];
+        pn_log("Failed to create FITS header block. fitsio error %d.", status);
+        while (fits_read_errmsg(fitserr))
+            pn_log("cfitsio error: %s.", fitserr);
+
+        free(header->cards);
+        free(header);
+        return NULL;
+    }
+
+    return header;
+}
+
+struct frame_header *frame_header_ref(struct frame_header *header)
+{
+    __atomic_add_fetch(&header->refs, 1, __ATOMIC_RELAXED);
+    return header;
+}
+
+void frame_header_unref(struct frame_header *header)
+{
+    if (!header || __atomic_sub_fetch(&header->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    free(header->cards);
+    free(header);
+}
+
+// Format the exposure start date and start/end times for a frame.
+// The strings are empty for bias frames, which have no trigger.
+void frame_header_format_times(struct frame_header *header, TimerTimestamp *timestamp,
+                               char date[15], char start_time[15], char end_time[15])
+{
+    date[0] = start_time[0] = end_time[0] = '\0';
+    if (header->trigger_mode == TRIGGER_BIAS)
+        return;
+
+    // Trigger timestamp defines the *start* of the frame
+    TimestampCivil start = timestamp_to_civil(timestamp->time);
+    TimestampCivil end = timestamp_to_civil(timestamp->time +
+        header->exposure_time*timestamp_exposure_unit(header->trigger_mode));
+
+    snprintf(date, 15, "%04d-%02d-%02d", start.year, start.month, start.day);
+
+    if (header->trigger_mode == TRIGGER_MILLISECONDS)
+    {
+        snprintf(start_time, 15, "%02d:%02d:%02d.%03d", start.hours, start.minutes, start.seconds, start.milliseconds);
+        snprintf(end_time, 15, "%02d:%02d:%02d.%03d", end.hours, end.minutes, end.seconds, end.milliseconds);
+    }
+    else
+    {
+        snprintf(start_time, 15, "%02d:%02d:%02d", start.hours, start.minutes, start.seconds);
+        snprintf(end_time, 15, "%02d:%02d:%02d", end.hours, end.minutes, end.seconds);
+    }
+}
+
+// Write the keys that change with each frame to the current HDU
+void frame_header_write_frame_keys(struct frame_header *header, fitsfile *fptr, CameraFrame *frame, TimerTimestamp *timestamp, int *status)
+{
+    if (header->trigger_mode != TRIGGER_BIAS)
+    {
+        char datebuf[15], startbuf[15], endbuf[15];
+        frame_header_format_times(header, timestamp, datebuf, startbuf, endbuf);
+
+        // Used by ImageJ and other programs
+        fits_update_key(fptr, TSTRING, "UT_DATE", datebuf, "Exposure start date (GPS)", status);
+        fits_update_key(fptr, TSTRING, "UT_TIME", startbuf, "Exposure start time (GPS)", status);
+
+        // Used by tsreduce
+        fits_update_key(fptr, TSTRING, "UTC-DATE", datebuf, "Exposure start date (GPS)", status);
+        fits_update_key(fptr, TSTRING, "UTC-BEG", startbuf, "Exposure start time (GPS)", status);
+        fits_update_key(fptr, TSTRING, "UTC-END", endbuf, "Exposure end time (GPS)", status);
+        fits_update_key(fptr, TLOGICAL, "UTC-LOCK", &(int){timestamp->locked}, "UTC time has GPS lock", status);
+    }
+
+    time_t pctime = time(NULL);
+    struct tm pctm;
+#ifdef _WIN32
+    // gmtime uses thread-local storage on Windows
+    pctm = *gmtime(&pctime);
+#else
+    gmtime_r(&pctime, &pctm);
+#endif
+
+    char timebuf[15];
+    strftime(timebuf, 15, "%Y-%m-%d", &pctm);
+    fits_update_key(fptr, TSTRING, "PC-DATE", (void *)timebuf, "PC Date when frame was saved to disk", status);
+
+    strftime(timebuf, 15, "%H:%M:%S", &pctm);
+    fits_update_key(fptr, TSTRING, "PC-TIME", (void *)timebuf, "PC Time when frame was saved to disk", status);
+
+    if (frame->has_timestamp)
+        fits_update_key(fptr, TDOUBLE, "CCD-TIME", &frame->timestamp, "CCD time relative to first exposure in seconds", status);
+
+    // Camera temperature
+    char tempbuf[10];
+    snprintf(tempbuf, 10, "%0.02f", frame->temperature);
+    fits_update_key(fptr, TSTRING, "CCD-TEMP", (void *)tempbuf, "CCD temperature sampled near readout (deg C)", status);
+    fits_update_key_fixdbl(fptr, "CCD-TAGE", frame->temperature_age, 3, "Age of CCD-TEMP sample at readout (s)", status);
+}
+
+// Append the static header cards to the current HDU
+void frame_header_write(struct frame_header *header, fitsfile *fptr, int *status)
+{
+    for (size_t i = 0; i < header->card_count; i++)
+        fits_write_record(fptr, header->cards[i], status);
+}
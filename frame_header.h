@@ -0,0 +1,40 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef FRAME_HEADER_H
+#define FRAME_HEADER_H
+
+#include <stdint.h>
+#include <fitsio.h>
+#include "main.h"
+
+// FITS header cards that are constant for an acquisition, rendered once
+// and shared (read-only) between the frame and writer threads
+struct frame_header
+{
+    // Preference generation that the header was built from
+    unsigned int generation;
+
+    // Preferences needed to build the per-frame keys
+    uint8_t trigger_mode;
+    int exposure_time;
+
+    char (*cards)[FLEN_CARD];
+    size_t card_count;
+
+    int refs;
+};
+
+struct frame_header *frame_header_new(CameraFrame *frame);
+struct frame_header *frame_header_ref(struct frame_header *header);
+void frame_header_unref(struct frame_header *header);
+void frame_header_write(struct frame_header *header, fitsfile *fptr, int *status);
+void frame_header_format_times(struct frame_header *header, TimerTimestamp *timestamp,
+                               char date[15], char start_time[15], char end_time[15]);
+void frame_header_write_frame_keys(struct frame_header *header, fitsfile *fptr, CameraFrame *frame, TimerTimestamp *timestamp, int *status);
+
+#endif
@@ -6,10 +6,19 @@
  */
 
 #include <string.h>
+#include <errno.h>
 #include <fitsio.h>
 #include <pthread.h>
 #include <math.h>
-#include "atomicqueue.h"
+#include "ringbuffer.h"
+#include "frame_pool.h"
+#include "frame_transform.h"
+#include "frame_header.h"
+#include "frame_container.h"
+#include "latency.h"
+#include "run_stats.h"
+#include "load_shed.h"
+#include "frame_spool.h"
 #include "camera.h"
 #include "reduction_script.h"
 #include "preview_script.h"
@@ -20,6 +29,55 @@
 #include "platform.h"
 #include "main.h"
 
+// Maximum number of frames or triggers that can be waiting for processing
+#define FRAME_QUEUE_CAPACITY 65536
+#define TRIGGER_QUEUE_CAPACITY 65536
+
+// Maximum difference (in seconds) between the estimated frame start and
+// its trigger. Allows for the delay in recieving the GPS time and any other factors.
+#define MATCH_TOLERANCE 1.5
+
+// Work that is handed to the writer threads
+typedef enum
+{
+    // Encode a frame to a temporary file, then rename it into place
+    JOB_SAVE_FILE,
+
+    // Append a frame to the open run container
+    JOB_CONTAINER_APPEND,
+    JOB_CONTAINER_CHECKPOINT,
+    JOB_CONTAINER_CLOSE
+} WriteJobType;
+
+struct write_job
+{
+    WriteJobType type;
+    int run_number;
+    CameraFrame *frame;
+    TimerTimestamp *timestamp;
+    struct frame_header *header;
+    char *filepath;
+    char *temppath;
+    uint8_t codec;
+    bool preview;
+    bool encoded;
+    bool saved;
+
+    // Dark, flat and bias frames are the first to be dropped when shedding load
+    bool calibration;
+
+    // Set by the frame thread while shedding load: a spilled frame's data is
+    // in the spool at spool_offset, and a dropped frame has been released
+    bool spilled;
+    bool dropped;
+    uint64_t spool_offset;
+
+    // monotonic_time() when the frame was matched and its trigger received
+    TimestampNS matched_time;
+    TimestampNS trigger_time;
+    struct write_job *next;
+};
+
 struct FrameManager
 {
     pthread_t frame_thread;
@@ -27,12 +85,71 @@ struct FrameManager
     pthread_cond_t signal_condition;
     pthread_mutex_t signal_mutex;
 
-    struct atomicqueue *frame_queue;
-    struct atomicqueue *trigger_queue;
+    // Single producer (camera / timer thread), single consumer (frame thread).
+    // Consumers must hold frame_mutex so that purges from other threads are safe.
+    struct ringbuffer *frame_queue;
+    struct ringbuffer *trigger_queue;
     bool first_frame;
 
+    // Frames and triggers discarded by the matcher since the last match,
+    // and in total for the acquisition. Protected by frame_mutex.
+    size_t resync_frames;
+    size_t resync_triggers;
+    size_t resync_count;
+    size_t resync_total_frames;
+    size_t resync_total_triggers;
+
+    // Static FITS header keys for the current acquisition.
+    // Owned by the frame thread; writer jobs hold their own reference.
+    struct frame_header *header;
+
     bool thread_alive;
     bool shutdown;
+
+    // Frames are encoded concurrently by the writer threads, but renamed into
+    // place and passed to the reduction script strictly in acquisition order.
+    // Jobs are kept in a list in acquisition order: commit_head is the oldest
+    // job that hasn't been renamed, and pending_head the oldest job that
+    // hasn't been taken by a writer. All protected by write_mutex.
+    pthread_t *writer_threads;
+    size_t writer_count;
+    pthread_mutex_t write_mutex;
+    pthread_cond_t write_condition;
+    struct write_job *commit_head;
+    struct write_job *pending_head;
+    struct write_job *tail;
+    size_t write_queue_length;
+    bool writers_shutdown;
+
+    // Set while a writer is committing jobs, so that only one thread
+    // commits at a time and write_mutex can be released while committing
+    bool committing;
+
+    // Bytes of pooled frame data held by the frame manager, and the size of
+    // the most recent frame. Compared against FrameBacklogBudget to choose
+    // the load shedding stage. Accessed atomically.
+    uint64_t backlog_bytes;
+    uint64_t frame_bytes;
+
+    // Frame data spilled while shedding load. Opened by the frame thread when
+    // first needed, and closed once the writer threads have exited.
+    struct frame_spool *spool;
+    bool spool_failed;
+
+    // Run container that frames are appended to. Only accessed while committing.
+    struct frame_container *container;
+
+    // Owned by the frame thread: set once frames have been queued for a
+    // container, and cleared when the container close is queued
+    bool container_open;
+    uint8_t container_codec;
+
+    // Set by the camera thread when an acquisition stops (protected by signal_mutex).
+    // Once the frame thread has processed the queued frames it sets summary_due
+    // (protected by write_mutex), and the run summary is logged when the writers
+    // have committed every job.
+    bool acquisition_stopped;
+    bool summary_due;
 };
 
 FrameManager *frame_manager_new()
@@ -42,12 +159,12 @@ FrameManager *frame_manager_new()
         return NULL;
 
     frame->first_frame = true;
-    frame->frame_queue = atomicqueue_create();
-    frame->trigger_queue = atomicqueue_create();
+    frame->frame_queue = ringbuffer_create(FRAME_QUEUE_CAPACITY);
+    frame->trigger_queue = ringbuffer_create(TRIGGER_QUEUE_CAPACITY);
     if (!frame->frame_queue || !frame->trigger_queue)
     {
-        atomicqueue_destroy(frame->frame_queue);
-        atomicqueue_destroy(frame->trigger_queue);
+        ringbuffer_destroy(frame->frame_queue);
+        ringbuffer_destroy(frame->trigger_queue);
         free(frame);
         return NULL;
     }
@@ -55,117 +172,134 @@ FrameManager *frame_manager_new()
     pthread_mutex_init(&frame->frame_mutex, NULL);
     pthread_cond_init(&frame->signal_condition, NULL);
     pthread_mutex_init(&frame->signal_mutex, NULL);
+    pthread_mutex_init(&frame->write_mutex, NULL);
+    pthread_cond_init(&frame->write_condition, NULL);
     return frame;
 }
 
 void frame_manager_free(FrameManager *frame)
 {
+    // Queued frames are returned to their pool, and triggers freed
     clear_queued_data(true);
 
-    atomicqueue_destroy(frame->trigger_queue);
-    atomicqueue_destroy(frame->frame_queue);
+    ringbuffer_destroy(frame->trigger_queue);
+    ringbuffer_destroy(frame->frame_queue);
     pthread_mutex_destroy(&frame->frame_mutex);
     pthread_mutex_destroy(&frame->signal_mutex);
     pthread_cond_destroy(&frame->signal_condition);
+    pthread_mutex_destroy(&frame->write_mutex);
+    pthread_cond_destroy(&frame->write_condition);
+    free(frame->writer_threads);
     free(frame);
 }
 
-// Transform the frame data in a CameraFrame with the
-// flip/transpose operations specified in the preferences.
-void frame_process_transforms(CameraFrame *frame)
+// Choose the load shedding stage from the memory held by queued frames.
+// Once the frame pool is exhausted new frames are lost regardless of type,
+// so the budget is limited to the size of the pool.
+static enum load_shed_stage update_load_stage(FrameManager *frame)
 {
-    if (pn_preference_char(FRAME_FLIP_X))
+    uint64_t pool = pn_preference_int(FRAME_POOL_SIZE)*__atomic_load_n(&frame->frame_bytes, __ATOMIC_RELAXED);
+    int budget_mb = pn_preference_int(FRAME_BACKLOG_BUDGET);
+    uint64_t budget = budget_mb > 0 ? (uint64_t)budget_mb*1024*1024 : pool;
+    if (budget > pool)
+        budget = pool;
+
+    return load_shed_update(__atomic_load_n(&frame->backlog_bytes, __ATOMIC_RELAXED), budget);
+}
+
+// Release a frame and its metadata back to the camera frame pool.
+// Frames that were spilled to the spool are freed instead.
+static void frame_release(FrameManager *frame, CameraFrame *f)
+{
+    camera_readout_unref(f->readout);
+    f->readout = NULL;
+
+    if (!f->pool)
     {
-        for (uint16_t j = 0; j < frame->height; j++)
-            for (uint16_t i = 0; i < frame->width/2; i++)
-            {
-                uint16_t temp = frame->data[j*frame->width + i];
-                frame->data[j*frame->width + i] = frame->data[j*frame->width + (frame->width - i - 1)];
-                frame->data[j*frame->width + (frame->width - i - 1)] = temp;
-            }
-        
-        if (frame->has_image_region)
-        {
-            uint16_t temp = frame->width - frame->image_region[0];
-            frame->image_region[0] = frame->width - frame->image_region[1];
-            frame->image_region[1] = temp;
-        }
-        
-        if (frame->has_bias_region)
-        {
-            uint16_t temp = frame->width - frame->bias_region[0];
-            frame->bias_region[0] = frame->width - frame->bias_region[1];
-            frame->bias_region[1] = temp;
-        }
+        free(f->data);
+        free(f);
+        return;
     }
-    
-    if (pn_preference_char(FRAME_FLIP_Y))
+
+    __atomic_sub_fetch(&frame->backlog_bytes, (uint64_t)f->width*f->height*sizeof(uint16_t), __ATOMIC_RELAXED);
+    frame_pool_release(f);
+    update_load_stage(frame);
+}
+
+// Abandon the spool record of a spilled frame that won't be saved,
+// so that the spool can rewind once the other records are read
+static void discard_spilled_frame(FrameManager *frame, struct write_job *job)
+{
+    if (job->spilled)
+        frame_spool_read(frame->spool, job->spool_offset, NULL, (size_t)job->frame->width*job->frame->height);
+}
+
+// Read the data of a spilled frame back from the spool
+static bool restore_spilled_frame(FrameManager *frame, struct write_job *job)
+{
+    if (!job->spilled)
+        return true;
+
+    CameraFrame *f = job->frame;
+    size_t pixels = (size_t)f->width*f->height;
+    f->data = malloc(pixels*sizeof(uint16_t));
+    if (!f->data || !frame_spool_read(frame->spool, job->spool_offset, f->data, pixels))
     {
-        for (uint16_t j = 0; j < frame->height/2; j++)
-            for (uint16_t i = 0; i < frame->width; i++)
-            {
-                uint16_t temp = frame->data[j*frame->width + i];
-                frame->data[j*frame->width + i] = frame->data[(frame->height - j - 1)*frame->width + i];
-                frame->data[(frame->height - j - 1)*frame->width + i] = temp;
-            }
-        
-        if (frame->has_image_region)
-        {
-            uint16_t temp = frame->height - frame->image_region[2];
-            frame->image_region[2] = frame->height - frame->image_region[3];
-            frame->image_region[3] = temp;
-        }
-        
-        if (frame->has_bias_region)
-        {
-            uint16_t temp = frame->height - frame->bias_region[2];
-            frame->bias_region[2] = frame->height - frame->bias_region[3];
-            frame->bias_region[3] = temp;
-        }
+        if (!f->data)
+            frame_spool_read(frame->spool, job->spool_offset, NULL, pixels);
+
+        pn_log("Failed to restore frame %d from the spool. Discarding frame.", job->run_number);
+        return false;
     }
-    
-    if (pn_preference_char(FRAME_TRANSPOSE))
+
+    return true;
+}
+
+// Transform the frame data in a CameraFrame with the
+// flip/transpose operations specified in the preferences.
+void frame_process_transforms(CameraFrame *frame)
+{
+    uint8_t orientation = frame_orientation(pn_preference_char(FRAME_FLIP_X),
+                                            pn_preference_char(FRAME_FLIP_Y),
+                                            pn_preference_char(FRAME_TRANSPOSE));
+    if (!orientation)
+        return;
+
+    // Reorient into the pool's spare buffer in a single pass, then swap it in
+    frame_orient(frame->data, frame_pool_spare(frame), frame->width, frame->height, orientation);
+    frame_pool_swap_spare(frame);
+
+    // The shared readout regions are reoriented when the header is written
+    frame->orientation = orientation;
+    if (orientation & ORIENTATION_TRANSPOSE)
     {
-        // Create a copy of the frame to simplify transpose when width != height
-        size_t s = frame->width*frame->height*sizeof(uint16_t);
-        uint16_t *data = malloc(s);
-        if (!data)
-        {
-            pn_log("Failed to allocate memory. Discarding frame");
-            return;
-        }
-        memcpy(data, frame->data, s);
-        
-        for (uint16_t j = 0; j < frame->height; j++)
-            for (uint16_t i = 0; i < frame->width; i++)
-                frame->data[i*frame->height + j] = data[j*frame->width + i];
-        free(data);
-        
-        if (frame->has_image_region)
-            for (uint8_t i = 0; i < 2; i++)
-            {
-                uint16_t temp = frame->image_region[i];
-                frame->image_region[i] = frame->image_region[i+2];
-                frame->image_region[i+2] = temp;
-            }
-        
-        if (frame->has_bias_region)
-            for (uint8_t i = 0; i < 2; i++)
-            {
-                uint16_t temp = frame->bias_region[i];
-                frame->bias_region[i] = frame->bias_region[i+2];
-                frame->bias_region[i+2] = temp;
-            }
-        
         uint16_t temp = frame->height;
         frame->height = frame->width;
         frame->width = temp;
     }
 }
 
+// cfitsio may only be called from several threads at once if it was built with
+// --enable-reentrant. Otherwise spawn_writer_threads limits the pool to a single
+// writer, which takes turns with the frame thread's preview encodes through this lock.
+static pthread_mutex_t cfitsio_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool cfitsio_serialized = false;
+
+static void lock_cfitsio()
+{
+    if (cfitsio_serialized)
+        pthread_mutex_lock(&cfitsio_mutex);
+}
+
+static void unlock_cfitsio()
+{
+    if (cfitsio_serialized)
+        pthread_mutex_unlock(&cfitsio_mutex);
+}
+
 // Save a frame and trigger to disk
 // Returns true on success or false on failure
-bool frame_save(CameraFrame *frame, TimerTimestamp *timestamp, char *filepath)
+bool frame_save(CameraFrame *frame, TimerTimestamp *timestamp, struct frame_header *header, char *filepath, uint8_t codec)
 {
     fitsfile *fptr;
     int status = 0;
@@ -181,197 +315,62 @@ bool frame_save(CameraFrame *frame, TimerTimestamp *timestamp, char *filepath)
         return false;
     }
     
-    // Create the primary array image (16-bit short integer pixels
-    long size[2] = { frame->width, frame->height };
-    fits_create_img(fptr, USHORT_IMG, 2, size, &status);
-
-    // Write header keys
-    uint8_t trigger_mode = pn_preference_char(TIMER_TRIGGER_MODE);
-    long exposure_time = pn_preference_int(EXPOSURE_TIME);
-
-    if (trigger_mode == TRIGGER_BIAS)
+    // Gzip is applied to the whole file by cfitsio based on the .gz suffix.
+    // Tile compressed images are stored in a compressed image extension.
+    if (codec == CODEC_RICE)
+        fits_set_compression_type(fptr, RICE_1, &status);
+    else if (codec == CODEC_HCOMPRESS)
     {
-        fits_update_key(fptr, TSTRING, "OBJECT", "Bias", "Object name", &status);
-    }
-    else
-    {
-        switch (pn_preference_char(OBJECT_TYPE))
-        {
-            case OBJECT_DARK:
-                fits_update_key(fptr, TSTRING, "OBJECT", "Dark", "Object name", &status);
-                break;
-            case OBJECT_FLAT:
-                fits_update_key(fptr, TSTRING, "OBJECT", "Flat Field", "Object name", &status);
-                break;
-            case OBJECT_FOCUS:
-                fits_update_key(fptr, TSTRING, "OBJECT", "Focus", "Object name", &status);
-                break;
-            case OBJECT_TARGET:
-            default:
-            {
-                char *object_name = pn_preference_string(OBJECT_NAME);
-                fits_update_key(fptr, TSTRING, "OBJECT", (void *)object_name, "Object name", &status);
-                free(object_name);
-                break;
-            }
-        }
-    
-        if (trigger_mode == TRIGGER_MILLISECONDS)
-        {
-            double exptime = exposure_time / 1000.0;
-            fits_update_key(fptr, TDOUBLE, "EXPTIME", &exptime, "Actual integration time (sec)", &status);
-        }
-        else
-            fits_update_key(fptr, TLONG, "EXPTIME", &exposure_time, "Actual integration time (sec)", &status);
-    }
+        fits_set_compression_type(fptr, HCOMPRESS_1, &status);
 
-    char *observers = pn_preference_string(OBSERVERS);
-    fits_update_key(fptr, TSTRING, "OBSERVER", (void *)observers, "Observers", &status);
-    free(observers);
-    
-    char *observatory = pn_preference_string(OBSERVATORY);
-    fits_update_key(fptr, TSTRING, "OBSERVAT", (void *)observatory, "Observatory", &status);
-    free(observatory);
-    
-    char *telescope = pn_preference_string(TELESCOPE);
-    fits_update_key(fptr, TSTRING, "TELESCOP", (void *)telescope, "Telescope name", &status);
-    free(telescope);
-    
-    char *instrument = pn_preference_string(INSTRUMENT);
-    fits_update_key(fptr, TSTRING, "INSTRUME", (void *)instrument, "Instrument name", &status);
-    free(instrument);
-    
-    char *filter = pn_preference_string(FILTER);
-    fits_update_key(fptr, TSTRING, "FILTER", (void *)filter, "Filter type", &status);
-    free(filter);
-    
-    fits_update_key(fptr, TSTRING, "PROG-VER", (void *)program_version() , "Acquisition program version reported by git", &status);
-    
-    // Trigger timestamp defines the *start* of the frame
-    if (trigger_mode != TRIGGER_BIAS)
-    {
-        TimerTimestamp start = *timestamp;
-        TimerTimestamp end = start;
-        if (trigger_mode == TRIGGER_MILLISECONDS)
-            end.milliseconds += exposure_time;
-        else
-            end.seconds += exposure_time;
-        timestamp_normalize(&end);
-    
-        char datebuf[15], gpstimebuf[15];
-        snprintf(datebuf, 15, "%04d-%02d-%02d", start.year, start.month, start.day);
-    
-        if (trigger_mode == TRIGGER_MILLISECONDS)
-            snprintf(gpstimebuf, 15, "%02d:%02d:%02d.%03d", start.hours, start.minutes, start.seconds, start.milliseconds);
-        else
-            snprintf(gpstimebuf, 15, "%02d:%02d:%02d", start.hours, start.minutes, start.seconds);
-    
-        // Used by ImageJ and other programs
-        fits_update_key(fptr, TSTRING, "UT_DATE", datebuf, "Exposure start date (GPS)", &status);
-        fits_update_key(fptr, TSTRING, "UT_TIME", gpstimebuf, "Exposure start time (GPS)", &status);
-    
-        // Used by tsreduce
-        fits_update_key(fptr, TSTRING, "UTC-DATE", datebuf, "Exposure start date (GPS)", &status);
-        fits_update_key(fptr, TSTRING, "UTC-BEG", gpstimebuf, "Exposure start time (GPS)", &status);
-    
-        if (trigger_mode == TRIGGER_MILLISECONDS)
-            snprintf(gpstimebuf, 15, "%02d:%02d:%02d.%03d", end.hours, end.minutes, end.seconds, end.milliseconds);
-        else
-            snprintf(gpstimebuf, 15, "%02d:%02d:%02d", end.hours, end.minutes, end.seconds);
-    
-        fits_update_key(fptr, TSTRING, "UTC-END", gpstimebuf, "Exposure end time (GPS)", &status);
-        fits_update_key(fptr, TLOGICAL, "UTC-LOCK", &(int){start.locked}, "UTC time has GPS lock", &status);
+        // Zero scale is lossless
+        fits_set_hcomp_scale(fptr, 0, &status);
     }
 
-    time_t pctime = time(NULL);
-    
-    char timebuf[15];
-    strftime(timebuf, 15, "%Y-%m-%d", gmtime(&pctime));
-    fits_update_key(fptr, TSTRING, "PC-DATE", (void *)timebuf, "PC Date when frame was saved to disk", &status);
-    
-    strftime(timebuf, 15, "%H:%M:%S", gmtime(&pctime));
-    fits_update_key(fptr, TSTRING, "PC-TIME", (void *)timebuf, "PC Time when frame was saved to disk", &status);
+    // Create the primary array image (16-bit short integer pixels
+    long size[2] = { frame->width, frame->height };
+    fits_create_img(fptr, USHORT_IMG, 2, size, &status);
 
-    if (frame->has_timestamp)
-        fits_update_key(fptr, TDOUBLE, "CCD-TIME", &frame->timestamp, "CCD time relative to first exposure in seconds", &status);
-    
-    // Camera temperature
-    char tempbuf[10];
-    snprintf(tempbuf, 10, "%0.02f", frame->temperature);
-    fits_update_key(fptr, TSTRING, "CCD-TEMP", (void *)tempbuf, "CCD temperature at end of exposure (deg C)", &status);
-    fits_update_key(fptr, TSTRING, "CCD-PORT", (void *)frame->port_desc, "CCD readout port description", &status);
-    fits_update_key(fptr, TSTRING, "CCD-RATE", (void *)frame->speed_desc, "CCD readout rate description", &status);
-    fits_update_key(fptr, TSTRING, "CCD-GAIN", (void *)frame->gain_desc, "CCD readout gain description", &status);
-    fits_update_key(fptr, TLONG,   "CCD-BIN",  &(long){pn_preference_char(CAMERA_BINNING)},  "CCD pixel binning", &status);
-    fits_update_key(fptr, TDOUBLE, "CCD-ROUT",  &frame->readout_time,  "CCD readout time (s)", &status);
-    fits_update_key(fptr, TDOUBLE, "CCD-SHFT",  &frame->vertical_shift_us,  "CCD vertical shift time (us)", &status);
-
-    if (frame->has_em_gain)
-        fits_update_key(fptr, TDOUBLE,   "CCD-EMGN",  &frame->em_gain,  "CCD electron multiplication gain", &status);
-
-    if (frame->has_exposure_shortcut)
-        fits_update_key(fptr, TUSHORT, "CCD-SCUT", &frame->exposure_shortcut_ms, "ProEM exposure shortcut (ms)", &status);
-
-    char *trigger_mode_str;
-    switch (trigger_mode)
-    {
-        case TRIGGER_MILLISECONDS: trigger_mode_str = "High Resolution"; break;
-        case TRIGGER_SECONDS: trigger_mode_str = "Low Resolution"; break;
-        case TRIGGER_BIAS: trigger_mode_str = "Bias (no triggers)"; break;
-            break;
-    }
-    fits_update_key(fptr, TSTRING, "TRG-MODE", (void *)trigger_mode_str, "Instrument trigger mode", &status);
+    // Header keys that are constant for the acquisition
+    frame_header_write(header, fptr, &status);
 
-    if (trigger_mode != TRIGGER_BIAS)
-        fits_update_key(fptr, TLOGICAL, "TRG-ALGN", &(int){pn_preference_char(TIMER_ALIGN_FIRST_EXPOSURE)}, "Initial trigger aligned to a full minute", &status);
+    // Times and other keys that change with each frame
+    frame_header_write_frame_keys(header, fptr, frame, timestamp, &status);
 
-    char *pscale = pn_preference_string(CAMERA_PLATESCALE);
-    fits_update_key(fptr, TDOUBLE, "IM-SCALE",  &(double){pn_preference_char(CAMERA_BINNING)*atof(pscale)},  "Image scale (arcsec/px)", &status);
-    free(pscale);
-    
-    if (frame->has_image_region)
-    {
-        char buf[25];
-        snprintf(buf, 25, "[%d, %d, %d, %d]",
-                 frame->image_region[0], frame->image_region[1],
-                 frame->image_region[2], frame->image_region[3]);
-        fits_update_key(fptr, TSTRING, "IMAG-RGN", buf, "Frame image subregion", &status);
-    }
-    
-    if (frame->has_bias_region)
-    {
-        char buf[25];
-        snprintf(buf, 25, "[%d, %d, %d, %d]",
-                 frame->bias_region[0], frame->bias_region[1],
-                 frame->bias_region[2], frame->bias_region[3]);
-        fits_update_key(fptr, TSTRING, "BIAS-RGN", buf, "Frame bias subregion", &status);
-    }
-    
-    // Write the frame data to the image and close the file
+    // Write the frame data to the image and close the file.
+    // cfitsio still closes the file if an earlier call failed.
     fits_write_img(fptr, TUSHORT, 1, frame->width*frame->height, frame->data, &status);
     fits_close_file(fptr, &status);
-    
+
     // Log any error messages
     while (fits_read_errmsg(fitserr))
         pn_log("cfitsio error: %s.", fitserr);
-    
+
+    // Don't leave a partial file behind, e.g. if the disk filled up
+    if (status)
+    {
+        pn_log("Failed to save file. fitsio error %d.", status);
+        delete_file(filepath);
+        return false;
+    }
+
     return true;
 }
 
 // Helper function for determining the
 // filepath of the next frame
-static char *next_filepath()
+static char *next_filepath(const char *suffix)
 {
     // Construct the output filepath from the output dir, run prefix, and run number.
     int run_number = pn_preference_int(RUN_NUMBER);
     char *output_dir = pn_preference_string(OUTPUT_DIR);
     char *run_prefix = pn_preference_string(RUN_PREFIX);
 
-    size_t filepath_len = snprintf(NULL, 0, "%s/%s-%04d.fits.gz", output_dir, run_prefix, run_number) + 1;
+    size_t filepath_len = snprintf(NULL, 0, "%s/%s-%04d%s", output_dir, run_prefix, run_number, suffix) + 1;
     char *filepath = malloc(filepath_len*sizeof(char));
 
     if (filepath)
-        snprintf(filepath, filepath_len, "%s/%s-%04d.fits.gz", output_dir, run_prefix, run_number);
+        snprintf(filepath, filepath_len, "%s/%s-%04d%s", output_dir, run_prefix, run_number, suffix);
 
     free(run_prefix);
     free(output_dir);
@@ -379,9 +378,10 @@ static char *next_filepath()
     return filepath;
 }
 
-static char *temporary_filepath(const char *prefix, size_t length)
+static char *temporary_filepath(const char *prefix, size_t length, const char *suffix)
 {
-    char *path = malloc((length + 14)*sizeof(char));
+    size_t suffix_length = strlen(suffix) + 6;
+    char *path = malloc((length + suffix_length)*sizeof(char));
 
     if (path)
     {
@@ -400,7 +400,7 @@ static char *temporary_filepath(const char *prefix, size_t length)
             // Windows will only return numbers in the range 0-0x7FFF
             // but this still gives 32k potential files
             uint32_t test = rand() & 0xFFFF;
-            snprintf(path + length, 14, ".%04x.fits.gz", test);
+            snprintf(path + length, suffix_length, ".%04x%s", test, suffix);
         }
         while (file_exists(path));
     }
@@ -408,72 +408,727 @@ static char *temporary_filepath(const char *prefix, size_t length)
     return path;
 }
 
-// Save a matched frame and trigger timestamp to disk.
-static void save_frame(CameraFrame *frame, TimerTimestamp *timestamp, Modules *modules)
+// The preview is named after its codec, so remove any written with a different
+// codec to stop preview.sh from picking up an old frame
+static void remove_stale_previews(const char *suffix)
 {
-    char *filepath = next_filepath();
-    if (!filepath)
+    for (uint8_t codec = CODEC_GZIP; codec <= CODEC_NONE; codec++)
     {
-        pn_log("Failed to determine next file path. Discarding frame");
-        return;
+        const char *stale_suffix = pn_output_codec_suffix(codec);
+        if (strcmp(stale_suffix, suffix) == 0)
+            continue;
+
+        char stale_path[32];
+        snprintf(stale_path, 32, "preview%s", stale_suffix);
+        if (file_exists(stale_path))
+            delete_file(stale_path);
     }
+}
 
-    char *temppath = temporary_filepath(filepath, strlen(filepath) - 8);
-    if (!temppath)
+// Replace the preview with a copy of an already encoded frame
+static void publish_preview(const char *source, uint8_t codec, TimestampNS matched_time, Modules *modules)
+{
+    const char *suffix = pn_output_codec_suffix(codec);
+    char *temp_preview = temporary_filepath("./preview", 9, suffix);
+    if (!temp_preview)
     {
-        pn_log("Failed to create unique temporary filename. Discarding frame");
+        pn_log("Error creating temporary filepath. Skipping preview");
         return;
     }
 
-    if (!frame_save(frame, timestamp, temppath))
+    char preview_path[32];
+    snprintf(preview_path, 32, "preview%s", suffix);
+
+    if (!copy_file(source, temp_preview))
     {
-        free(filepath);
-        free(temppath);
-        pn_log("Failed to save temporary file. Discarding frame.");
-        return;
+        pn_log("Failed to copy preview frame.");
+        delete_file(temp_preview);
+    }
+    else if (!rename_atomically(temp_preview, preview_path, true))
+    {
+        pn_log("Failed to overwrite preview frame.");
+        delete_file(temp_preview);
     }
-
-    // Don't overwrite existing files
-    if (!rename_atomically(temppath, filepath, false))
-        pn_log("Failed to save `%s' (already exists?). Saved instead as `%s' ",
-               last_path_component(filepath), last_path_component(temppath));
     else
     {
-        reduction_push_frame(modules->reduction, filepath);
-        pn_log("Saved `%s'.", last_path_component(filepath));
+        remove_stale_previews(suffix);
+        preview_script_run(modules->preview);
+        latency_record(LATENCY_MATCH_PREVIEW, matched_time, monotonic_time());
     }
 
-    pn_preference_increment_framecount();
-    free(filepath);
-    free(temppath);
+    free(temp_preview);
 }
 
-static void preview_frame(CameraFrame *frame, TimerTimestamp *timestamp, Modules *modules)
+// Encode a frame that isn't being saved directly to the preview
+static void preview_frame(CameraFrame *frame, TimerTimestamp *timestamp, struct frame_header *header, Modules *modules)
 {
+    uint8_t codec = pn_preference_char(OUTPUT_CODEC);
+    const char *suffix = pn_output_codec_suffix(codec);
+
     // Update frame preview atomically
-    char *temp_preview = temporary_filepath("./preview", 9);
+    char *temp_preview = temporary_filepath("./preview", 9, suffix);
     if (!temp_preview)
     {
         pn_log("Error creating temporary filepath. Skipping preview");
         return;
     }
 
-    frame_save(frame, timestamp, temp_preview);
-    if (!rename_atomically(temp_preview, "preview.fits.gz", true))
+    char preview_path[32];
+    snprintf(preview_path, 32, "preview%s", suffix);
+
+    lock_cfitsio();
+    bool saved = frame_save(frame, timestamp, header, temp_preview, codec);
+    unlock_cfitsio();
+
+    if (!saved)
+        pn_log("Failed to encode preview frame.");
+    else if (!rename_atomically(temp_preview, preview_path, true))
     {
         pn_log("Failed to overwrite preview frame.");
         delete_file(temp_preview);
     }
     else
+    {
+        remove_stale_previews(suffix);
         preview_script_run(modules->preview);
+        latency_record(LATENCY_MATCH_PREVIEW, frame->matched_time, monotonic_time());
+    }
 
     free(temp_preview);
 }
 
+// Rename an encoded frame into place and notify the reduction script.
+// Called by the committing writer, in acquisition order.
+static void commit_frame(struct write_job *job, Modules *modules)
+{
+    // Dropped frames have already been logged and counted
+    if (job->dropped)
+        return;
+
+    if (!job->temppath || !job->saved)
+    {
+        if (!job->temppath)
+            pn_log("Failed to create unique temporary filename. Discarding frame");
+        else
+            pn_log("Failed to save temporary file. Discarding frame.");
+
+        run_stats_add(RUN_SAVE_FAILED, 1);
+        return;
+    }
+
+    run_stats_add(RUN_FRAMES_SAVED, 1);
+    if (!rename_atomically(job->temppath, job->filepath, false))
+    {
+        // Don't overwrite existing files
+        pn_log("Failed to save `%s' (already exists?). Saved instead as `%s' ",
+               last_path_component(job->filepath), last_path_component(job->temppath));
+
+        if (job->preview)
+            publish_preview(job->temppath, job->codec, job->matched_time, modules);
+    }
+    else
+    {
+        reduction_push_frame(modules->reduction, job->filepath);
+        pn_log("Saved `%s'.", last_path_component(job->filepath));
+
+        // Reuse the compressed file instead of encoding the frame again
+        if (job->preview)
+            publish_preview(job->filepath, job->codec, job->matched_time, modules);
+    }
+}
+
+static void record_save_latency(struct write_job *job)
+{
+    TimestampNS saved_time = monotonic_time();
+    latency_record(LATENCY_MATCH_SAVE, job->matched_time, saved_time);
+    latency_record(LATENCY_TRIGGER_SAVE, job->trigger_time, saved_time);
+}
+
+static void open_container(FrameManager *frame, struct write_job *job)
+{
+    // Don't overwrite existing files
+    char *filepath = job->filepath;
+    if (file_exists(filepath))
+    {
+        const char *suffix = frame_container_suffix(job->codec);
+        filepath = temporary_filepath(job->filepath, strlen(job->filepath) - strlen(suffix), suffix);
+        if (!filepath)
+        {
+            pn_log("Failed to create unique container filename.");
+            return;
+        }
+
+        pn_log("`%s' already exists. Saving instead as `%s'.",
+               last_path_component(job->filepath), last_path_component(filepath));
+    }
+
+    frame->container = frame_container_open(filepath, job->header, job->codec);
+    if (filepath != job->filepath)
+        free(filepath);
+}
+
+static void close_container(FrameManager *frame, Modules *modules)
+{
+    if (!frame->container)
+        return;
+
+    char *filepath = strdup(frame_container_filepath(frame->container));
+    size_t count = frame_container_frame_count(frame->container);
+    frame_container_close(frame->container);
+    frame->container = NULL;
+
+    if (filepath)
+    {
+        reduction_push_frame(modules->reduction, filepath);
+        pn_log("Saved `%s' (%zu frames).", last_path_component(filepath), count);
+        free(filepath);
+    }
+}
+
+// Log the run summary once the writers have committed the stopped acquisition.
+// Called with write_mutex held.
+static void log_due_run_summary(FrameManager *frame)
+{
+    if (frame->summary_due && !frame->commit_head)
+    {
+        frame->summary_due = false;
+        run_stats_log_summary();
+    }
+}
+
+// Called by the committing writer, in acquisition order.
+static void commit_job(FrameManager *frame, struct write_job *job, Modules *modules)
+{
+    switch (job->type)
+    {
+        case JOB_SAVE_FILE:
+            commit_frame(job, modules);
+            break;
+        case JOB_CONTAINER_APPEND:
+            // The first frame of a container carries its filepath
+            if (!frame->container && job->filepath)
+                open_container(frame, job);
+
+            // Dropped frames have already been released
+            if (!job->dropped)
+            {
+                if (!frame->container)
+                {
+                    pn_log("Run container is not available. Discarding frame %d.", job->run_number);
+                    run_stats_add(RUN_SAVE_FAILED, 1);
+                    discard_spilled_frame(frame, job);
+                }
+                else if (restore_spilled_frame(frame, job) &&
+                         frame_container_append(frame->container, job->frame, job->timestamp, job->header, job->run_number))
+                {
+                    // The container can't be rewound, so a frame overwritten
+                    // while it was appended can only be reported
+                    if (!frame_pool_data_valid(job->frame))
+                    {
+                        pn_log("WARNING: Frame %d was overwritten by the camera while it was appended. Its container data is corrupt.", job->run_number);
+                        run_stats_add(RUN_SAVE_FAILED, 1);
+                    }
+                    else
+                    {
+                        run_stats_add(RUN_FRAMES_SAVED, 1);
+                        record_save_latency(job);
+                    }
+
+                    if (frame_container_checkpoint_due(frame->container))
+                        frame_container_checkpoint(frame->container);
+                }
+                else
+                    run_stats_add(RUN_SAVE_FAILED, 1);
+
+                frame_release(frame, job->frame);
+            }
+
+            free(job->timestamp);
+            frame_header_unref(job->header);
+            break;
+        case JOB_CONTAINER_CHECKPOINT:
+            if (frame->container)
+                frame_container_checkpoint(frame->container);
+            break;
+        case JOB_CONTAINER_CLOSE:
+            close_container(frame, modules);
+            break;
+    }
+}
+
+static void *writer_thread(void *_modules)
+{
+    Modules *modules = _modules;
+    FrameManager *frame = modules->frame;
+
+    while (true)
+    {
+        pthread_mutex_lock(&frame->write_mutex);
+        while (!frame->pending_head && !frame->writers_shutdown)
+            pthread_cond_wait(&frame->write_condition, &frame->write_mutex);
+
+        // Queued frames are always saved before shutting down
+        struct write_job *job = frame->pending_head;
+        if (!job)
+        {
+            pthread_mutex_unlock(&frame->write_mutex);
+            break;
+        }
+
+        frame->pending_head = job->next;
+        pthread_mutex_unlock(&frame->write_mutex);
+
+        // Encode and compress to a temporary file alongside the final path.
+        // Container jobs are done while committing, because they must be written in order.
+        // Dropped frames have already been released.
+        if (job->type == JOB_SAVE_FILE)
+        {
+            if (!job->dropped)
+            {
+                const char *suffix = pn_output_codec_suffix(job->codec);
+                job->temppath = temporary_filepath(job->filepath, strlen(job->filepath) - strlen(suffix), suffix);
+                // Failures are logged and counted when the job is committed
+                if (!job->temppath)
+                    discard_spilled_frame(frame, job);
+                else if (restore_spilled_frame(frame, job))
+                {
+                    lock_cfitsio();
+                    job->saved = frame_save(job->frame, job->timestamp, job->header, job->temppath, job->codec);
+                    unlock_cfitsio();
+                }
+
+                // Lent data may have been overwritten by the camera while it was encoded
+                if (job->saved && !frame_pool_data_valid(job->frame))
+                {
+                    pn_log("Frame %d was overwritten by the camera while it was saved.", job->run_number);
+                    delete_file(job->temppath);
+                    job->saved = false;
+                }
+
+                if (job->saved)
+                    record_save_latency(job);
+
+                frame_release(frame, job->frame);
+            }
+
+            free(job->timestamp);
+            frame_header_unref(job->header);
+        }
+
+        // Commit this and any following jobs that were waiting on it.
+        // If another writer is already committing it will pick this job up.
+        pthread_mutex_lock(&frame->write_mutex);
+        job->encoded = true;
+        if (!frame->committing)
+        {
+            frame->committing = true;
+            while (frame->commit_head && frame->commit_head->encoded)
+            {
+                struct write_job *done = frame->commit_head;
+                frame->commit_head = done->next;
+                if (!frame->commit_head)
+                    frame->tail = NULL;
+                frame->write_queue_length--;
+
+                pthread_mutex_unlock(&frame->write_mutex);
+
+                // Containers are written while committing
+                lock_cfitsio();
+                commit_job(frame, done, modules);
+                unlock_cfitsio();
+                free(done->filepath);
+                free(done->temppath);
+                free(done);
+                pthread_mutex_lock(&frame->write_mutex);
+            }
+            frame->committing = false;
+            log_due_run_summary(frame);
+        }
+        pthread_mutex_unlock(&frame->write_mutex);
+    }
+
+    return NULL;
+}
+
+static void spawn_writer_threads(FrameManager *frame, Modules *modules)
+{
+    int count = pn_preference_int(FRAME_WRITER_THREADS);
+    if (count < 1)
+        count = 1;
+
+    // The frame thread encodes previews, so even a single writer must be serialized
+    cfitsio_serialized = !fits_is_reentrant();
+    if (cfitsio_serialized)
+    {
+        if (count > 1)
+            pn_log("cfitsio was built without --enable-reentrant. Frames will be saved by a single writer thread.");
+        count = 1;
+    }
+
+    frame->writer_threads = calloc(count, sizeof(pthread_t));
+    if (!frame->writer_threads)
+        return;
+
+    frame->writers_shutdown = false;
+    for (size_t i = 0; i < (size_t)count; i++)
+    {
+        if (pthread_create(&frame->writer_threads[i], NULL, writer_thread, (void *)modules))
+        {
+            pn_log("Failed to create writer thread");
+            break;
+        }
+
+        frame->writer_count++;
+    }
+}
+
+// Wait for the writer threads to save any queued frames and exit
+static void join_writer_threads(FrameManager *frame)
+{
+    pthread_mutex_lock(&frame->write_mutex);
+    frame->writers_shutdown = true;
+    pthread_cond_broadcast(&frame->write_condition);
+    pthread_mutex_unlock(&frame->write_mutex);
+
+    void **retval = NULL;
+    for (size_t i = 0; i < frame->writer_count; i++)
+        pthread_join(frame->writer_threads[i], retval);
+
+    frame->writer_count = 0;
+}
+
+// Add a job to the end of the writer queue
+static void queue_write_job(FrameManager *frame, struct write_job *job)
+{
+    pthread_mutex_lock(&frame->write_mutex);
+    if (frame->tail)
+        frame->tail->next = job;
+    else
+        frame->commit_head = job;
+    frame->tail = job;
+    run_stats_peak(RUN_PEAK_WRITE_QUEUE, ++frame->write_queue_length);
+
+    if (!frame->pending_head)
+        frame->pending_head = job;
+
+    pthread_cond_signal(&frame->write_condition);
+    pthread_mutex_unlock(&frame->write_mutex);
+}
+
+// Queue a checkpoint or close of the open container behind any queued frames
+static void queue_container_job(FrameManager *frame, WriteJobType type)
+{
+    if (!frame->container_open || frame->writer_count == 0)
+        return;
+
+    struct write_job *job = calloc(1, sizeof(struct write_job));
+    if (!job)
+    {
+        pn_log("Failed to allocate write job.");
+        return;
+    }
+
+    job->type = type;
+    if (type == JOB_CONTAINER_CLOSE)
+        frame->container_open = false;
+
+    queue_write_job(frame, job);
+}
+
+// Copy a frame's data to the spool and return its pooled buffer, so that the
+// camera can continue acquiring while the frame waits for a writer.
+// Returns a copy of the frame without data, or NULL if it couldn't be spilled.
+static CameraFrame *spill_frame(FrameManager *frame, CameraFrame *f, uint64_t *offset)
+{
+    if (!frame->spool && !frame->spool_failed)
+    {
+        // Spill alongside the saved frames unless another disk is given
+        char *dir = pn_preference_string(FRAME_SPOOL_DIR);
+        if (!dir[0])
+        {
+            free(dir);
+            dir = pn_preference_string(OUTPUT_DIR);
+        }
+
+        size_t prefix_len = snprintf(NULL, 0, "%s/spool", dir);
+        char *prefix = malloc((prefix_len + 1)*sizeof(char));
+        char *filepath = NULL;
+        if (prefix)
+        {
+            snprintf(prefix, prefix_len + 1, "%s/spool", dir);
+            filepath = temporary_filepath(prefix, prefix_len, ".raw");
+        }
+
+        if (filepath)
+            frame->spool = frame_spool_open(filepath);
+
+        // Don't retry for every frame
+        if (!frame->spool)
+        {
+            pn_log("Failed to create frame spool. Frames will be held in memory.");
+            frame->spool_failed = true;
+        }
+
+        free(filepath);
+        free(prefix);
+        free(dir);
+    }
+
+    if (!frame->spool)
+        return NULL;
+
+    size_t pixels = (size_t)f->width*f->height;
+    CameraFrame *spilled = malloc(sizeof(CameraFrame));
+    if (!spilled || !frame_spool_write(frame->spool, f->data, pixels, offset))
+    {
+        pn_log("Failed to spill frame to the spool. Holding it in memory.");
+        free(spilled);
+        return NULL;
+    }
+
+    // Leave a frame that the camera overwrote while it was spilled
+    // in memory, so that the writer discards it
+    if (!frame_pool_data_valid(f))
+    {
+        frame_spool_read(frame->spool, *offset, NULL, pixels);
+        free(spilled);
+        return NULL;
+    }
+
+    // The copy takes the readout reference
+    *spilled = *f;
+    spilled->pool = NULL;
+    spilled->data = NULL;
+    spilled->release_data = NULL;
+    spilled->release_data_ref = NULL;
+    spilled->data_valid = NULL;
+    f->readout = NULL;
+    frame_release(frame, f);
+
+    return spilled;
+}
+
+// Release the oldest queued calibration frame that is still in the pool
+// and hasn't been taken by a writer. Returns false if there is none.
+static bool drop_queued_calibration(FrameManager *frame)
+{
+    CameraFrame *f = NULL;
+    int run_number = 0;
+
+    pthread_mutex_lock(&frame->write_mutex);
+    for (struct write_job *job = frame->pending_head; job; job = job->next)
+    {
+        if (job->calibration && !job->spilled && !job->dropped)
+        {
+            f = job->frame;
+            run_number = job->run_number;
+            job->frame = NULL;
+            job->dropped = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&frame->write_mutex);
+
+    if (!f)
+        return false;
+
+    frame_release(frame, f);
+    run_stats_add(RUN_SHED_DROPPED, 1);
+    pn_log("Dropped queued calibration frame %d to shed load.", run_number);
+    return true;
+}
+
+// Assign the next run number to a matched frame and pass ownership
+// of the frame and trigger timestamp to the writer threads.
+// If preview is set the saved file is also copied to the preview.
+// The stage selects a faster codec or spills the frame to shed load.
+// Returns false if the frame couldn't be queued.
+static bool save_frame(FrameManager *frame, CameraFrame *f, TimerTimestamp *timestamp, bool preview,
+                       bool container, bool calibration, enum load_shed_stage stage)
+{
+    if (frame->writer_count == 0)
+    {
+        pn_log("No writer threads available. Discarding frame");
+        run_stats_add(RUN_SAVE_FAILED, 1);
+        return false;
+    }
+
+    struct write_job *job = calloc(1, sizeof(struct write_job));
+    if (!job)
+    {
+        pn_log("Failed to allocate write job. Discarding frame");
+        run_stats_add(RUN_SAVE_FAILED, 1);
+        return false;
+    }
+
+    // Containers keep their codec while shedding load, otherwise every
+    // crossing of the threshold would close the container and start another
+    job->codec = pn_preference_char(OUTPUT_CODEC);
+    if (!container && stage >= LOAD_SHED_FAST_CODEC && (job->codec == CODEC_GZIP || job->codec == CODEC_HCOMPRESS))
+        job->codec = CODEC_RICE;
+
+    job->run_number = pn_preference_int(RUN_NUMBER);
+    if (container)
+    {
+        // Start a new container if the codec has changed
+        if (frame->container_open && frame->container_codec != job->codec)
+            queue_container_job(frame, JOB_CONTAINER_CLOSE);
+
+        // The container is named after its first frame
+        if (!frame->container_open)
+        {
+            job->filepath = next_filepath(frame_container_suffix(job->codec));
+            if (!job->filepath)
+            {
+                pn_log("Failed to determine next file path. Discarding frame");
+                run_stats_add(RUN_SAVE_FAILED, 1);
+                free(job);
+                return false;
+            }
+
+            frame->container_open = true;
+            frame->container_codec = job->codec;
+        }
+
+        job->type = JOB_CONTAINER_APPEND;
+    }
+    else
+    {
+        job->filepath = next_filepath(pn_output_codec_suffix(job->codec));
+        if (!job->filepath)
+        {
+            pn_log("Failed to determine next file path. Discarding frame");
+            run_stats_add(RUN_SAVE_FAILED, 1);
+            free(job);
+            return false;
+        }
+
+        job->type = JOB_SAVE_FILE;
+        job->preview = preview;
+    }
+
+    pn_preference_increment_framecount();
+
+    if (stage >= LOAD_SHED_SPOOL)
+    {
+        CameraFrame *spilled = spill_frame(frame, f, &job->spool_offset);
+        if (spilled)
+        {
+            f = spilled;
+            job->spilled = true;
+            run_stats_add(RUN_FRAMES_SPOOLED, 1);
+        }
+    }
+
+    job->calibration = calibration;
+    job->frame = f;
+    job->timestamp = timestamp;
+    job->header = frame_header_ref(frame->header);
+    job->matched_time = f->matched_time;
+    job->trigger_time = timestamp ? timestamp->received_time : 0;
+    queue_write_job(frame, job);
+
+    return true;
+}
+
+// Estimated exposure start of a frame relative to a trigger, in seconds
+static double trigger_mismatch(CameraFrame *f, TimerTimestamp *trigger_start, double exptime)
+{
+    double elapsed = (double)(f->downloaded_time.time - trigger_start->time) / NS_PER_SECOND;
+    double readout_time = f->readout ? f->readout->readout_time : 0;
+    return elapsed - readout_time - exptime;
+}
+
+static void log_mismatch(CameraFrame *f, TimerTimestamp *trigger_start, double exptime, double mismatch)
+{
+    TimestampCivil downloaded = timestamp_to_civil(f->downloaded_time.time);
+    double readout_time = f->readout ? f->readout->readout_time : 0;
+    TimestampCivil estimate_start = timestamp_to_civil(f->downloaded_time.time -
+        (TimestampNS)((readout_time + exptime)*NS_PER_SECOND));
+    TimestampCivil trigger = timestamp_to_civil(trigger_start->time);
+
+    pn_log("ERROR: Estimated frame start doesn't match trigger start. Mismatch: %g", mismatch);
+    pn_log("Frame recieved: %02d:%02d:%02d", downloaded.hours, downloaded.minutes, downloaded.seconds);
+    pn_log("Estimated frame start: %02d:%02d:%02d", estimate_start.hours, estimate_start.minutes, estimate_start.seconds);
+    pn_log("Trigger start: %02d:%02d:%02d", trigger.hours, trigger.minutes, trigger.seconds);
+}
+
+// Pop the oldest frame and the trigger that it matches.
+// Frames and triggers are both queued in time order, so if the oldest frame
+// and trigger don't agree then the earlier of the two can never be matched.
+// Only that one is discarded, and matching continues with the next.
+// Must be called with frame_mutex held. Sets *f to NULL if no match is available.
+static void match_frame(FrameManager *frame, Modules *modules, uint8_t trigger_mode, double exptime,
+                        bool validate, CameraFrame **f, TimerTimestamp **t)
+{
+    while (true)
+    {
+        CameraFrame *head_frame = ringbuffer_peek(frame->frame_queue);
+        if (!head_frame)
+            return;
+
+        if (trigger_mode == TRIGGER_BIAS)
+        {
+            *f = ringbuffer_pop(frame->frame_queue);
+            return;
+        }
+
+        TimerTimestamp *head_trigger = ringbuffer_peek(frame->trigger_queue);
+        if (!head_trigger)
+            return;
+
+        // Convert trigger to start of the exposure
+        TimerTimestamp trigger_start = *head_trigger;
+        camera_normalize_trigger(modules->camera, &trigger_start);
+        double mismatch = trigger_mismatch(head_frame, &trigger_start, exptime);
+
+        if (fabs(mismatch) <= MATCH_TOLERANCE || !validate)
+        {
+            if (fabs(mismatch) > MATCH_TOLERANCE)
+                pn_log("WARNING: Estimated frame start doesn't match trigger start. Mismatch: %g", mismatch);
+
+            if (frame->resync_frames || frame->resync_triggers)
+            {
+                frame->resync_count++;
+                pn_log("Resynchronized after discarding %zu frames and %zu triggers.",
+                       frame->resync_frames, frame->resync_triggers);
+                pn_log("%zu resyncs have discarded %zu frames and %zu triggers this acquisition.",
+                       frame->resync_count, frame->resync_total_frames, frame->resync_total_triggers);
+                frame->resync_frames = frame->resync_triggers = 0;
+            }
+
+            *f = ringbuffer_pop(frame->frame_queue);
+            *t = ringbuffer_pop(frame->trigger_queue);
+            **t = trigger_start;
+            return;
+        }
+
+        log_mismatch(head_frame, &trigger_start, exptime, mismatch);
+        if (mismatch > 0)
+        {
+            // The frame started after the trigger: the trigger has no frame
+            pn_log("Discarding unmatched trigger.");
+            free(ringbuffer_pop(frame->trigger_queue));
+            run_stats_add(RUN_MATCHER_TRIGGERS, 1);
+            frame->resync_triggers++;
+            frame->resync_total_triggers++;
+        }
+        else
+        {
+            // The frame started before the trigger: the frame has no trigger
+            pn_log("Discarding unmatched frame.");
+            frame_release(frame, ringbuffer_pop(frame->frame_queue));
+            run_stats_add(RUN_MATCHER_FRAMES, 1);
+            frame->resync_frames++;
+            frame->resync_total_frames++;
+        }
+    }
+}
+
 bool wait_for_next_signal(FrameManager *frame, size_t *queued_frames, size_t *queued_triggers)
 {
-    *queued_frames = atomicqueue_length(frame->frame_queue);
-    *queued_triggers = atomicqueue_length(frame->trigger_queue);
+    *queued_frames = ringbuffer_length(frame->frame_queue);
+    *queued_triggers = ringbuffer_length(frame->trigger_queue);
 
     if (pn_preference_char(TIMER_TRIGGER_MODE) == TRIGGER_BIAS)
         return *queued_frames == 0 && !frame->shutdown;
@@ -488,8 +1143,9 @@ void *frame_thread(void *_modules)
 
     // Loop until shutdown, parsing incoming data
     time_t last_update = 0;
-    TimerTimestamp last_preview = system_time();
+    TimestampNS last_preview = system_time().time;
     int preview_delta = pn_preference_int(PREVIEW_RATE_LIMIT);
+    spawn_writer_threads(frame, modules);
     while (true)
     {
         // Wait for a frame to become available
@@ -504,11 +1160,43 @@ void *frame_thread(void *_modules)
         size_t queued_frames, queued_triggers;
 
         // Sleep until frame & trigger available, or shutdown.
+        bool idle = false;
         while (wait_for_next_signal(frame, &queued_frames, &queued_triggers))
-            pthread_cond_wait(&frame->signal_condition, &frame->signal_mutex);
+        {
+            // Nothing is left to match from the stopped acquisition
+            if (frame->acquisition_stopped)
+            {
+                frame->acquisition_stopped = false;
+                pthread_mutex_lock(&frame->write_mutex);
+                frame->summary_due = true;
+                log_due_run_summary(frame);
+                pthread_mutex_unlock(&frame->write_mutex);
+            }
+
+            // Checkpoint an open container if no frames arrive for a while
+            if (frame->container_open)
+            {
+                struct timespec timeout;
+                clock_gettime(CLOCK_REALTIME, &timeout);
+                timeout.tv_sec += CONTAINER_CHECKPOINT_INTERVAL;
+                if (pthread_cond_timedwait(&frame->signal_condition, &frame->signal_mutex, &timeout) == ETIMEDOUT)
+                {
+                    idle = true;
+                    break;
+                }
+            }
+            else
+                pthread_cond_wait(&frame->signal_condition, &frame->signal_mutex);
+        }
 
         pthread_mutex_unlock(&frame->signal_mutex);
 
+        if (idle)
+        {
+            queue_container_job(frame, JOB_CONTAINER_CHECKPOINT);
+            continue;
+        }
+
         // Update status every 5s
         time_t current = time(NULL);
         if (current - last_update > 5)
@@ -521,82 +1209,142 @@ void *frame_thread(void *_modules)
             break;
 
         // Match frame with trigger and save to disk
-        CameraFrame *f = atomicqueue_pop(frame->frame_queue);
-        TimerTimestamp *t = NULL;
-        bool process = true;
-
+        // The queues may have been purged since we were woken
         uint8_t trigger_mode = pn_preference_char(TIMER_TRIGGER_MODE);
-        if (trigger_mode != TRIGGER_BIAS)
+        double exptime = pn_preference_int(EXPOSURE_TIME);
+        if (trigger_mode != TRIGGER_SECONDS)
+            exptime /= 1000;
+
+        bool validate = pn_preference_char(VALIDATE_TIMESTAMPS);
+
+        CameraFrame *f = NULL;
+        TimerTimestamp *t = NULL;
+        pthread_mutex_lock(&frame->frame_mutex);
+        match_frame(frame, modules, trigger_mode, exptime, validate, &f, &t);
+        pthread_mutex_unlock(&frame->frame_mutex);
+
+        if (!f)
+            continue;
+
+        f->matched_time = monotonic_time();
+        if (t)
+            latency_record(LATENCY_TRIGGER_DOWNLOAD, t->received_time, f->queued_time);
+        latency_record(LATENCY_DOWNLOAD_MATCH, f->queued_time, f->matched_time);
+
+        // The first frame from the MicroMax corresponds to the startup
+        // and alignment period, so is meaningless
+        // The first frame from the ProEM has incorrect cleaning so the
+        // bias is inconsistent with the other frames
+        if (!frame->first_frame)
         {
-            t = atomicqueue_pop(frame->trigger_queue);
+            frame_process_transforms(f);
 
-            // Convert trigger to start of the exposure
-            camera_normalize_trigger(modules->camera, t);
+            // Render the static header keys once per acquisition,
+            // or again if the preferences have changed
+            if (!frame->header || frame->header->generation != pn_preference_generation())
+            {
+                frame_header_unref(frame->header);
+                frame->header = frame_header_new(f);
 
-            double exptime = pn_preference_int(EXPOSURE_TIME);
-            if (pn_preference_char(TIMER_TRIGGER_MODE) != TRIGGER_SECONDS)
-                exptime /= 1000;
+                // The container's primary header is out of date
+                queue_container_job(frame, JOB_CONTAINER_CLOSE);
+            }
 
-            // Ensure that the trigger and frame download times are consistent
-            double estimated_start_time = timestamp_to_unixtime(&f->downloaded_time) - f->readout_time - exptime;
-            double mismatch = estimated_start_time - timestamp_to_unixtime(t);
+            // Shed work as the memory held by queued frames approaches its budget
+            enum load_shed_stage stage = update_load_stage(frame);
 
-            // Allow at least 1 second of leeway to account for the
-            // delay in recieving the GPS time and any other factors
-            if (fabs(mismatch) > 1.5)
+            TimestampNS cur_preview = system_time().time;
+            double dt = (double)(cur_preview - last_preview) / NS_PER_MILLISECOND;
+            // Only previews that were due but skipped to shed load are counted
+            bool preview = dt >= preview_delta;
+            if (preview && stage >= LOAD_SHED_SKIP_PREVIEW)
             {
-                if (pn_preference_char(VALIDATE_TIMESTAMPS))
-                {
-                    TimerTimestamp estimate_start = f->downloaded_time;
-                    estimate_start.seconds -= f->readout_time + exptime;
-                    timestamp_normalize(&estimate_start);
-
-                    pn_log("ERROR: Estimated frame start doesn't match trigger start. Mismatch: %g", mismatch);
-                    pn_log("Frame recieved: %02d:%02d:%02d", f->downloaded_time.hours, f->downloaded_time.minutes, f->downloaded_time.seconds);
-                    pn_log("Estimated frame start: %02d:%02d:%02d", estimate_start.hours, estimate_start.minutes, estimate_start.seconds);
-                    pn_log("Trigger start: %02d:%02d:%02d", t->hours, t->minutes, t->seconds);
-
-                    pn_log("Discarding all stored frames and triggers.");
-                    clear_queued_data(false);
-                    process = false;
-                }
-                else
-                    pn_log("WARNING: Estimated frame start doesn't match trigger start. Mismatch: %g", mismatch);
+                run_stats_add(RUN_PREVIEW_SKIPPED, 1);
+                preview = false;
             }
-        }
 
-        if (process)
-        {
-            // The first frame from the MicroMax corresponds to the startup
-            // and alignment period, so is meaningless
-            // The first frame from the ProEM has incorrect cleaning so the
-            // bias is inconsistent with the other frames
-            if (!frame->first_frame)
+            if (preview)
+                last_preview = cur_preview;
+
+            // The writer threads take ownership of saved frames,
+            // and update the preview from the saved file
+            bool save = pn_preference_char(SAVE_FRAMES);
+            bool container = save && pn_preference_char(OUTPUT_CONTAINER);
+            if (!container)
+                queue_container_job(frame, JOB_CONTAINER_CLOSE);
+
+            uint8_t type = pn_preference_char(OBJECT_TYPE);
+            bool calibration = trigger_mode == TRIGGER_BIAS ||
+                type == OBJECT_DARK || type == OBJECT_FLAT || type == OBJECT_BIAS;
+
+            // Only calibration frames are dropped, oldest first.
+            // Science frames are only lost if the frame pool is exhausted.
+            bool drop = save && stage >= LOAD_SHED_DROP_CALIBRATION &&
+                !drop_queued_calibration(frame) && calibration;
+
+            // Frames in a container can't be copied to the preview
+            if (container && preview && frame->header)
             {
-                frame_process_transforms(f);
-                if (pn_preference_char(SAVE_FRAMES))
-                    save_frame(f, t, modules);
+                preview_frame(f, t, frame->header, modules);
+                preview = false;
+            }
 
-                TimerTimestamp cur_preview = system_time();
-                double dt = 1000*(timestamp_to_unixtime(&cur_preview) - timestamp_to_unixtime(&last_preview));
-                if (dt >= preview_delta)
-                {
-                    preview_frame(f, t, modules);
-                    last_preview = cur_preview;
-                }
+            if (drop)
+            {
+                pn_log("Dropped calibration frame to shed load.");
+                run_stats_add(RUN_SHED_DROPPED, 1);
             }
-            else
+            else if (!frame->header)
             {
-                pn_log("Discarding first frame.");
-                frame->first_frame = false;
+                pn_log("Failed to create frame header. Discarding frame.");
+                if (save)
+                    run_stats_add(RUN_SAVE_FAILED, 1);
             }
+            else if (save && save_frame(frame, f, t, preview, container, calibration, stage))
+            {
+                f = NULL;
+                t = NULL;
+            }
+            else if (preview)
+                preview_frame(f, t, frame->header, modules);
+        }
+        else
+        {
+            pn_log("Discarding first frame.");
+            frame->first_frame = false;
+
+            // The readout settings may have changed since the last acquisition
+            frame_header_unref(frame->header);
+            frame->header = NULL;
+            queue_container_job(frame, JOB_CONTAINER_CLOSE);
+
+            // Try to create the spool again if it failed last acquisition
+            frame->spool_failed = false;
         }
 
         free(t);
-        free(f->data);
-        free(f);
+        if (f)
+            frame_release(frame, f);
     }
 
+    queue_container_job(frame, JOB_CONTAINER_CLOSE);
+    join_writer_threads(frame);
+
+    // Acquisition may have stopped just before shutdown
+    pthread_mutex_lock(&frame->signal_mutex);
+    bool stopped = frame->acquisition_stopped;
+    frame->acquisition_stopped = false;
+    pthread_mutex_unlock(&frame->signal_mutex);
+
+    pthread_mutex_lock(&frame->write_mutex);
+    frame->summary_due |= stopped;
+    log_due_run_summary(frame);
+    pthread_mutex_unlock(&frame->write_mutex);
+
+    frame_spool_close(frame->spool);
+    frame->spool = NULL;
+    frame_header_unref(frame->header);
+    frame->header = NULL;
     frame->thread_alive = false;
     return NULL;
 }
@@ -626,6 +1374,40 @@ void frame_manager_notify_shutdown(FrameManager *frame)
     pthread_mutex_unlock(&frame->signal_mutex);
 }
 
+// Called by the camera thread as an acquisition starts, to reset the run counters.
+// If the previous acquisition's summary is still waiting on its frames it is logged
+// first, so that it isn't lost. Any of those frames that are saved afterwards are
+// counted towards the new run.
+void frame_manager_notify_acquisition_started(FrameManager *frame)
+{
+    pthread_mutex_lock(&frame->signal_mutex);
+    bool stopped = frame->acquisition_stopped;
+    frame->acquisition_stopped = false;
+    pthread_mutex_unlock(&frame->signal_mutex);
+
+    pthread_mutex_lock(&frame->write_mutex);
+    if (stopped || frame->summary_due)
+    {
+        pn_log("The previous run is still being saved (%zu write jobs queued). Logging its summary now.",
+               frame->write_queue_length);
+        frame->summary_due = false;
+        run_stats_log_summary();
+    }
+
+    run_stats_reset();
+    pthread_mutex_unlock(&frame->write_mutex);
+}
+
+// Called by the camera thread once an acquisition has stopped. The run summary
+// is logged after the remaining frames have been matched and saved.
+void frame_manager_notify_acquisition_stopped(FrameManager *frame)
+{
+    pthread_mutex_lock(&frame->signal_mutex);
+    frame->acquisition_stopped = true;
+    pthread_cond_signal(&frame->signal_condition);
+    pthread_mutex_unlock(&frame->signal_mutex);
+}
+
 bool frame_manager_thread_alive(FrameManager *frame)
 {
     return frame->thread_alive;
@@ -635,14 +1417,21 @@ bool frame_manager_thread_alive(FrameManager *frame)
 // frame to the main thread for processing.
 void frame_manager_queue_frame(FrameManager *frame, CameraFrame *f)
 {
-    pthread_mutex_lock(&frame->frame_mutex);
-    bool success = atomicqueue_push(frame->frame_queue, f);
-    pthread_mutex_unlock(&frame->frame_mutex);
+    // Counted before the frame thread can release it
+    uint64_t bytes = (uint64_t)f->width*f->height*sizeof(uint16_t);
+    __atomic_store_n(&frame->frame_bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&frame->backlog_bytes, bytes, __ATOMIC_RELAXED);
 
-    if (!success)
+    if (!ringbuffer_push(frame->frame_queue, f))
     {
         pn_log("Failed to push frame. Discarding.");
-        free(f);
+        run_stats_add(RUN_QUEUE_REJECTED, 1);
+        frame_release(frame, f);
+    }
+    else
+    {
+        run_stats_peak(RUN_PEAK_FRAME_QUEUE, ringbuffer_length(frame->frame_queue));
+        update_load_stage(frame);
     }
 
     // Wake processing thread
@@ -655,15 +1444,14 @@ void frame_manager_queue_frame(FrameManager *frame, CameraFrame *f)
 // trigger timestamp to the main thread for processing.
 void frame_manager_queue_trigger(FrameManager *frame, TimerTimestamp *t)
 {
-    pthread_mutex_lock(&frame->frame_mutex);
-    bool success = atomicqueue_push(frame->trigger_queue, t);
-    pthread_mutex_unlock(&frame->frame_mutex);
-
-    if (!success)
+    if (!ringbuffer_push(frame->trigger_queue, t))
     {
         pn_log("Failed to push trigger. Discarding.");
+        run_stats_add(RUN_QUEUE_REJECTED, 1);
         free(t);
     }
+    else
+        run_stats_peak(RUN_PEAK_TRIGGER_QUEUE, ringbuffer_length(frame->trigger_queue));
 
     // Wake processing thread
     pthread_mutex_lock(&frame->signal_mutex);
@@ -681,27 +1469,38 @@ void frame_manager_purge_queues(FrameManager *frame, bool reset_first_frame)
     pthread_mutex_lock(&frame->frame_mutex);
 
     size_t discarded = 0;
-    while ((item = atomicqueue_pop(frame->frame_queue)) != NULL)
+    while ((item = ringbuffer_pop(frame->frame_queue)) != NULL)
     {
         discarded++;
-        free(item);
+        frame_release(frame, item);
     }
 
     if (discarded > 0)
+    {
         pn_log("Discarded %zu queued frames.", discarded);
+        run_stats_add(RUN_MATCHER_FRAMES, discarded);
+    }
 
     discarded = 0;
-    while ((item = atomicqueue_pop(frame->trigger_queue)) != NULL)
+    while ((item = ringbuffer_pop(frame->trigger_queue)) != NULL)
     {
         discarded++;
         free(item);
     }
 
     if (discarded > 0)
+    {
         pn_log("Discarded %zu queued triggers.", discarded);
+        run_stats_add(RUN_MATCHER_TRIGGERS, discarded);
+    }
 
     if (reset_first_frame)
+    {
         frame->first_frame = true;
+        frame->resync_frames = frame->resync_triggers = 0;
+        frame->resync_count = 0;
+        frame->resync_total_frames = frame->resync_total_triggers = 0;
+    }
 
     pthread_mutex_unlock(&frame->frame_mutex);
 }
@@ -17,6 +17,8 @@ void frame_manager_free(FrameManager *frame);
 void frame_manager_spawn_thread(FrameManager *frame, Modules *modules);
 void frame_manager_join_thread(FrameManager *frame);
 void frame_manager_notify_shutdown(FrameManager *frame);
+void frame_manager_notify_acquisition_started(FrameManager *frame);
+void frame_manager_notify_acquisition_stopped(FrameManager *frame);
 bool frame_manager_thread_alive(FrameManager *frame);
 void frame_manager_run(FrameManager *frame);
 
@@ -0,0 +1,220 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "frame_pool.h"
+#include "main.h"
+
+// A fixed set of CameraFrames and pixel buffers that are allocated once
+// and then recycled between the camera backends and the frame manager.
+struct frame_pool
+{
+    pthread_mutex_t mutex;
+
+    CameraFrame *frames;
+    uint16_t *data;
+    size_t frame_count;
+    size_t frame_pixels;
+
+    // The pixel buffer owned by each frame, and one extra that is
+    // swapped with a frame's buffer when it is transformed out of place
+    uint16_t **buffers;
+    uint16_t *spare;
+
+    // Stack of frames that are available for checkout
+    CameraFrame **available;
+    size_t available_count;
+
+    // Frames that couldn't be checked out because the pool was empty
+    size_t dropped;
+
+    // A retired pool is freed once the last outstanding frame is returned
+    bool retired;
+};
+
+static void frame_pool_free(struct frame_pool *pool)
+{
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool->available);
+    free(pool->buffers);
+    free(pool->frames);
+    free(pool->data);
+    free(pool);
+}
+
+struct frame_pool *frame_pool_new(size_t frame_count, size_t frame_pixels)
+{
+    struct frame_pool *pool = calloc(1, sizeof(struct frame_pool));
+    if (!pool)
+        return NULL;
+
+    pool->frames = calloc(frame_count, sizeof(CameraFrame));
+    pool->available = calloc(frame_count, sizeof(CameraFrame *));
+    pool->buffers = calloc(frame_count, sizeof(uint16_t *));
+    pool->data = malloc((frame_count + 1)*frame_pixels*sizeof(uint16_t));
+    if (!pool->frames || !pool->available || !pool->buffers || !pool->data)
+    {
+        free(pool->frames);
+        free(pool->available);
+        free(pool->buffers);
+        free(pool->data);
+        free(pool);
+        return NULL;
+    }
+
+    // Touch every page now so that the acquisition doesn't pay for page faults later
+    memset(pool->data, 0, (frame_count + 1)*frame_pixels*sizeof(uint16_t));
+
+    for (size_t i = 0; i < frame_count; i++)
+    {
+        pool->buffers[i] = &pool->data[i*frame_pixels];
+        pool->frames[i].pool = pool;
+        pool->frames[i].data = pool->buffers[i];
+        pool->available[i] = &pool->frames[i];
+    }
+    pool->spare = &pool->data[frame_count*frame_pixels];
+
+    pool->frame_count = pool->available_count = frame_count;
+    pool->frame_pixels = frame_pixels;
+    pthread_mutex_init(&pool->mutex, NULL);
+    return pool;
+}
+
+// Release the pool once all frames have been returned.
+// The pool must not be used for checkouts after this is called.
+void frame_pool_retire(struct frame_pool *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->retired = true;
+    bool unused = pool->available_count == pool->frame_count;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (unused)
+        frame_pool_free(pool);
+}
+
+bool frame_pool_matches(struct frame_pool *pool, size_t frame_count, size_t frame_pixels)
+{
+    return pool && pool->frame_count == frame_count && pool->frame_pixels == frame_pixels;
+}
+
+// Take a frame from the pool for a width x height image.
+// Returns NULL and counts a dropped frame if the pool is exhausted.
+CameraFrame *frame_pool_checkout(struct frame_pool *pool, uint16_t width, uint16_t height)
+{
+    if (!pool)
+    {
+        pn_log("Frame pool is not available. Discarding frame.");
+        return NULL;
+    }
+
+    if ((size_t)width*height > pool->frame_pixels)
+    {
+        pn_log("Frame size %dx%d exceeds frame pool buffer size. Discarding frame.", width, height);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    CameraFrame *frame = NULL;
+    if (pool->available_count > 0)
+        frame = pool->available[--pool->available_count];
+    else
+        pool->dropped++;
+    size_t dropped = pool->dropped;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!frame)
+    {
+        pn_log("Frame pool exhausted. Discarding frame (%zu dropped).", dropped);
+        return NULL;
+    }
+
+    frame->width = width;
+    frame->height = height;
+    frame->release_data = NULL;
+    frame->release_data_ref = NULL;
+    frame->data_valid = NULL;
+    return frame;
+}
+
+// Return a frame to the pool it was checked out from
+void frame_pool_release(CameraFrame *frame)
+{
+    struct frame_pool *pool = frame->pool;
+
+    // Hand borrowed data back to the backend and restore the pooled buffer
+    if (frame->release_data)
+    {
+        frame->release_data(frame->release_data_ref);
+        frame->release_data = NULL;
+        frame->release_data_ref = NULL;
+        frame->data_valid = NULL;
+    }
+    frame->data = pool->buffers[frame - pool->frames];
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->available[pool->available_count++] = frame;
+    bool unused = pool->retired && pool->available_count == pool->frame_count;
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (unused)
+        frame_pool_free(pool);
+}
+
+// Returns a buffer, large enough for any frame in the pool, that the
+// caller may write a transformed copy of frame->data into.
+// Only one thread may use the spare buffer of a given pool.
+uint16_t *frame_pool_spare(CameraFrame *frame)
+{
+    return frame->pool->spare;
+}
+
+// Make the spare buffer the frame's data, and recycle the frame's
+// own buffer as the new spare. Borrowed data is handed back now that
+// it has been copied, unless it was overwritten while it was read, in
+// which case it stays borrowed so that frame_pool_data_valid reports it.
+void frame_pool_swap_spare(CameraFrame *frame)
+{
+    struct frame_pool *pool = frame->pool;
+    size_t i = frame - pool->frames;
+
+    uint16_t *temp = pool->buffers[i];
+    pool->buffers[i] = pool->spare;
+    pool->spare = temp;
+    frame->data = pool->buffers[i];
+
+    if (frame->release_data && frame_pool_data_valid(frame))
+    {
+        frame->release_data(frame->release_data_ref);
+        frame->release_data = NULL;
+        frame->release_data_ref = NULL;
+        frame->data_valid = NULL;
+    }
+}
+
+// Whether the frame's data is still intact. Pooled data always is, but
+// a backend may overwrite data that it has lent to the frame manager.
+bool frame_pool_data_valid(CameraFrame *frame)
+{
+    return !frame->data_valid || frame->data_valid(frame->release_data_ref);
+}
+
+size_t frame_pool_dropped(struct frame_pool *pool)
+{
+    if (!pool)
+        return 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    size_t dropped = pool->dropped;
+    pthread_mutex_unlock(&pool->mutex);
+    return dropped;
+}
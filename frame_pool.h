@@ -0,0 +1,29 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "main.h"
+
+struct frame_pool;
+
+struct frame_pool *frame_pool_new(size_t frame_count, size_t frame_pixels);
+void frame_pool_retire(struct frame_pool *pool);
+bool frame_pool_matches(struct frame_pool *pool, size_t frame_count, size_t frame_pixels);
+
+CameraFrame *frame_pool_checkout(struct frame_pool *pool, uint16_t width, uint16_t height);
+void frame_pool_release(CameraFrame *frame);
+uint16_t *frame_pool_spare(CameraFrame *frame);
+void frame_pool_swap_spare(CameraFrame *frame);
+bool frame_pool_data_valid(CameraFrame *frame);
+size_t frame_pool_dropped(struct frame_pool *pool);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "frame_spool.h"
+#include "platform.h"
+#include "main.h"
+
+#ifdef _WIN32
+    #define fseeko fseeko64
+#endif
+
+struct frame_spool
+{
+    pthread_mutex_t mutex;
+    FILE *file;
+    char *filepath;
+
+    // Offset that the next frame is written to, and the number of
+    // written frames that haven't been read back. Protected by mutex.
+    uint64_t end;
+    size_t outstanding;
+};
+
+struct frame_spool *frame_spool_open(const char *filepath)
+{
+    struct frame_spool *spool = calloc(1, sizeof(struct frame_spool));
+    if (!spool)
+        return NULL;
+
+    spool->filepath = strdup(filepath);
+    spool->file = fopen(filepath, "w+b");
+    if (!spool->filepath || !spool->file)
+    {
+        pn_log("Failed to open frame spool `%s'.", filepath);
+        if (spool->file)
+            fclose(spool->file);
+        free(spool->filepath);
+        free(spool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&spool->mutex, NULL);
+    return spool;
+}
+
+void frame_spool_close(struct frame_spool *spool)
+{
+    if (!spool)
+        return;
+
+    if (spool->outstanding > 0)
+        pn_log("WARNING: Closing frame spool with %zu unread frames.", spool->outstanding);
+
+    fclose(spool->file);
+    delete_file(spool->filepath);
+    pthread_mutex_destroy(&spool->mutex);
+    free(spool->filepath);
+    free(spool);
+}
+
+bool frame_spool_write(struct frame_spool *spool, const uint16_t *data, size_t pixels, uint64_t *offset)
+{
+    pthread_mutex_lock(&spool->mutex);
+
+    // Start again from the beginning of the file once it has been drained
+    if (spool->outstanding == 0)
+        spool->end = 0;
+
+    bool success = fseeko(spool->file, spool->end, SEEK_SET) == 0 &&
+                   fwrite(data, sizeof(uint16_t), pixels, spool->file) == pixels;
+
+    if (success)
+    {
+        *offset = spool->end;
+        spool->end += pixels*sizeof(uint16_t);
+        spool->outstanding++;
+    }
+    else
+        clearerr(spool->file);
+
+    pthread_mutex_unlock(&spool->mutex);
+    return success;
+}
+
+bool frame_spool_read(struct frame_spool *spool, uint64_t offset, uint16_t *data, size_t pixels)
+{
+    pthread_mutex_lock(&spool->mutex);
+
+    bool success = true;
+    if (data)
+    {
+        success = fseeko(spool->file, offset, SEEK_SET) == 0 &&
+                  fread(data, sizeof(uint16_t), pixels, spool->file) == pixels;
+        if (!success)
+            clearerr(spool->file);
+    }
+
+    spool->outstanding--;
+    pthread_mutex_unlock(&spool->mutex);
+    return success;
+}
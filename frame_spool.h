@@ -0,0 +1,31 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef FRAME_SPOOL_H
+#define FRAME_SPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A scratch file that raw frame data is spilled to so that pooled frames can be
+// returned to the camera while they wait for a writer. Space is reused once every
+// spilled frame has been read back. Thread safe.
+struct frame_spool;
+
+struct frame_spool *frame_spool_open(const char *filepath);
+
+// Close and delete the spool file
+void frame_spool_close(struct frame_spool *spool);
+
+bool frame_spool_write(struct frame_spool *spool, const uint16_t *data, size_t pixels, uint64_t *offset);
+
+// Read a spilled frame back. Each written frame must be read (or abandoned
+// with frame_spool_read(..., NULL, ...)) exactly once.
+bool frame_spool_read(struct frame_spool *spool, uint64_t offset, uint16_t *data, size_t pixels);
+
+#endif
@@ -0,0 +1,185 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <string.h>
+#include <stddef.h>
+#include "frame_transform.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Output tile size (in pixels) for transposing orientations.
+// 64x64 16-bit pixels keeps both the source and destination tile in L1.
+#define TILE_SIZE 64
+
+uint8_t frame_orientation(bool flip_x, bool flip_y, bool transpose)
+{
+    return (flip_x ? ORIENTATION_FLIP_X : 0) |
+           (flip_y ? ORIENTATION_FLIP_Y : 0) |
+           (transpose ? ORIENTATION_TRANSPOSE : 0);
+}
+
+#ifdef __SSE2__
+static inline __m128i reverse_epi16(__m128i v)
+{
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+}
+#endif
+
+// Copy a row of n pixels in reverse order
+static void reverse_row(const uint16_t *in, uint16_t *out, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + n - i - 8));
+        _mm_storeu_si128((__m128i *)(out + i), reverse_epi16(v));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = in[n - i - 1];
+}
+
+// Transpose one output tile.
+// Output pixel (r, c) is read from in[base + r*row_step + c*col_step], where
+// row_step is +/-1 and col_step is +/- the input width.
+static void transpose_tile(const uint16_t *in, uint16_t *out, size_t out_width,
+                           ptrdiff_t base, ptrdiff_t row_step, ptrdiff_t col_step,
+                           size_t r0, size_t r1, size_t c0, size_t c1)
+{
+    size_t r = r0;
+#ifdef __SSE2__
+    // 8x8 blocks: load 8 input rows (output columns), transpose in registers,
+    // then store 8 output rows
+    for (; r + 8 <= r1; r += 8)
+    {
+        size_t c = c0;
+        for (; c + 8 <= c1; c += 8)
+        {
+            __m128i v[8];
+            for (size_t k = 0; k < 8; k++)
+            {
+                const uint16_t *src = in + base + (ptrdiff_t)r*row_step + (ptrdiff_t)(c + k)*col_step;
+                if (row_step > 0)
+                    v[k] = _mm_loadu_si128((const __m128i *)src);
+                else
+                    v[k] = reverse_epi16(_mm_loadu_si128((const __m128i *)(src - 7)));
+            }
+
+            __m128i a0 = _mm_unpacklo_epi16(v[0], v[1]);
+            __m128i a1 = _mm_unpackhi_epi16(v[0], v[1]);
+            __m128i a2 = _mm_unpacklo_epi16(v[2], v[3]);
+            __m128i a3 = _mm_unpackhi_epi16(v[2], v[3]);
+            __m128i a4 = _mm_unpacklo_epi16(v[4], v[5]);
+            __m128i a5 = _mm_unpackhi_epi16(v[4], v[5]);
+            __m128i a6 = _mm_unpacklo_epi16(v[6], v[7]);
+            __m128i a7 = _mm_unpackhi_epi16(v[6], v[7]);
+
+            __m128i b0 = _mm_unpacklo_epi32(a0, a2);
+            __m128i b1 = _mm_unpackhi_epi32(a0, a2);
+            __m128i b2 = _mm_unpacklo_epi32(a1, a3);
+            __m128i b3 = _mm_unpackhi_epi32(a1, a3);
+            __m128i b4 = _mm_unpacklo_epi32(a4, a6);
+            __m128i b5 = _mm_unpackhi_epi32(a4, a6);
+            __m128i b6 = _mm_unpacklo_epi32(a5, a7);
+            __m128i b7 = _mm_unpackhi_epi32(a5, a7);
+
+            uint16_t *dst = out + r*out_width + c;
+            _mm_storeu_si128((__m128i *)(dst + 0*out_width), _mm_unpacklo_epi64(b0, b4));
+            _mm_storeu_si128((__m128i *)(dst + 1*out_width), _mm_unpackhi_epi64(b0, b4));
+            _mm_storeu_si128((__m128i *)(dst + 2*out_width), _mm_unpacklo_epi64(b1, b5));
+            _mm_storeu_si128((__m128i *)(dst + 3*out_width), _mm_unpackhi_epi64(b1, b5));
+            _mm_storeu_si128((__m128i *)(dst + 4*out_width), _mm_unpacklo_epi64(b2, b6));
+            _mm_storeu_si128((__m128i *)(dst + 5*out_width), _mm_unpackhi_epi64(b2, b6));
+            _mm_storeu_si128((__m128i *)(dst + 6*out_width), _mm_unpacklo_epi64(b3, b7));
+            _mm_storeu_si128((__m128i *)(dst + 7*out_width), _mm_unpackhi_epi64(b3, b7));
+        }
+
+        // Remaining columns
+        for (size_t j = r; j < r + 8; j++)
+            for (size_t k = c; k < c1; k++)
+                out[j*out_width + k] = in[base + (ptrdiff_t)j*row_step + (ptrdiff_t)k*col_step];
+    }
+#endif
+    // Remaining rows
+    for (; r < r1; r++)
+        for (size_t c = c0; c < c1; c++)
+            out[r*out_width + c] = in[base + (ptrdiff_t)r*row_step + (ptrdiff_t)c*col_step];
+}
+
+// Write a reoriented copy of a width x height frame into out.
+// If the orientation includes a transpose the output is height x width.
+// in and out must not overlap.
+void frame_orient(const uint16_t *in, uint16_t *out, uint16_t width, uint16_t height, uint8_t orientation)
+{
+    bool flip_x = orientation & ORIENTATION_FLIP_X;
+    bool flip_y = orientation & ORIENTATION_FLIP_Y;
+
+    // Index of the input pixel that ends up at the output origin
+    ptrdiff_t base = (flip_y ? (ptrdiff_t)(height - 1)*width : 0) + (flip_x ? width - 1 : 0);
+    ptrdiff_t x_step = flip_x ? -1 : 1;
+    ptrdiff_t y_step = flip_y ? -(ptrdiff_t)width : width;
+
+    if (!(orientation & ORIENTATION_TRANSPOSE))
+    {
+        // Output rows are (possibly reversed) input rows
+        for (size_t r = 0; r < height; r++)
+        {
+            const uint16_t *src = in + base + (ptrdiff_t)r*y_step;
+            uint16_t *dst = out + r*width;
+            if (flip_x)
+                reverse_row(src - (width - 1), dst, width);
+            else
+                memcpy(dst, src, width*sizeof(uint16_t));
+        }
+        return;
+    }
+
+    // Output rows are input columns: walk the output in tiles so
+    // that the strided reads stay within a few cache lines
+    size_t out_width = height;
+    size_t out_height = width;
+    for (size_t r = 0; r < out_height; r += TILE_SIZE)
+    {
+        size_t r1 = r + TILE_SIZE < out_height ? r + TILE_SIZE : out_height;
+        for (size_t c = 0; c < out_width; c += TILE_SIZE)
+        {
+            size_t c1 = c + TILE_SIZE < out_width ? c + TILE_SIZE : out_width;
+            transpose_tile(in, out, out_width, base, x_step, y_step, r, r1, c, c1);
+        }
+    }
+}
+
+// Update an [x1, x2, y1, y2] subregion of a width x height frame to match a reoriented frame
+void frame_orient_region(uint16_t region[4], uint16_t width, uint16_t height, uint8_t orientation)
+{
+    if (orientation & ORIENTATION_FLIP_X)
+    {
+        uint16_t temp = width - region[0];
+        region[0] = width - region[1];
+        region[1] = temp;
+    }
+
+    if (orientation & ORIENTATION_FLIP_Y)
+    {
+        uint16_t temp = height - region[2];
+        region[2] = height - region[3];
+        region[3] = temp;
+    }
+
+    if (orientation & ORIENTATION_TRANSPOSE)
+        for (uint8_t i = 0; i < 2; i++)
+        {
+            uint16_t temp = region[i];
+            region[i] = region[i+2];
+            region[i+2] = temp;
+        }
+}
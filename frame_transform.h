@@ -0,0 +1,27 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef FRAME_TRANSFORM_H
+#define FRAME_TRANSFORM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// One of the eight frame orientations reachable by flipping and transposing.
+// Equivalent to flipping in x, then in y, then transposing.
+enum frame_orientation
+{
+    ORIENTATION_FLIP_X = 1,
+    ORIENTATION_FLIP_Y = 2,
+    ORIENTATION_TRANSPOSE = 4
+};
+
+uint8_t frame_orientation(bool flip_x, bool flip_y, bool transpose);
+void frame_orient(const uint16_t *in, uint16_t *out, uint16_t width, uint16_t height, uint8_t orientation);
+void frame_orient_region(uint16_t region[4], uint16_t width, uint16_t height, uint8_t orientation);
+
+#endif
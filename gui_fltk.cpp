@@ -108,6 +108,16 @@ bool FLTKGui::update()
         updateButtonGroup();
     }
 
+    struct run_stats stats;
+    run_stats_snapshot(&stats);
+    enum load_shed_stage load_stage = load_shed_stage();
+    if (memcmp(&stats, &cached_run_stats, sizeof(struct run_stats)) || load_stage != cached_load_stage)
+    {
+        cached_run_stats = stats;
+        cached_load_stage = load_stage;
+        updateStatsGroup();
+    }
+
     updateTimerGroup();
 
     Fl::redraw();
@@ -162,10 +172,11 @@ void FLTKGui::updateTimerGroup()
     if (timer_gps_status(m_timerRef) == GPS_ACTIVE)
     {
         TimerTimestamp ts = timer_current_timestamp(m_timerRef);
-        snprintf(buf, 32, "%04d-%02d-%02d", ts.year, ts.month, ts.day);
+        TimestampCivil utc = timestamp_to_civil(ts.time);
+        snprintf(buf, 32, "%04d-%02d-%02d", utc.year, utc.month, utc.day);
         m_timerUTCDateOutput->value(buf);
         snprintf(buf, 32, "%02d:%02d:%02d (%s)",
-                 ts.hours, ts.minutes, ts.seconds,
+                 utc.hours, utc.minutes, utc.seconds,
                  (ts.locked ? "Locked" : "Unlocked"));
         m_timerUTCTimeOutput->value(buf);
         progress = ts.exposure_progress;
@@ -330,15 +341,69 @@ void FLTKGui::updateAcquisitionGroup()
 		strcpy(buf, "Continuous");
     m_acquisitionBurstOutput->value(buf);
 
-    snprintf(buf, 100, "%s-%04d.fits.gz", run_prefix, cached_run_number);
+    snprintf(buf, 100, "%s-%04d%s", run_prefix, cached_run_number,
+             pn_output_codec_suffix(pn_preference_char(OUTPUT_CODEC)));
     m_acquisitionFilenameOutput->value(buf);
     free(object);
     free(run_prefix);
 }
 
+void FLTKGui::createStatsGroup()
+{
+    int y = 315, margin = 20;
+    m_statsGroup = createGroupBox(y, 185, "Frame Accounting"); y += 25;
+    m_statsFramesOutput = createOutputLabel(y, "Frames:"); y += margin;
+    m_statsCameraOutput = createOutputLabel(y, "Camera:"); y += margin;
+    m_statsMatcherOutput = createOutputLabel(y, "Unmatched:"); y += margin;
+    m_statsSaveOutput = createOutputLabel(y, "Save:"); y += margin;
+    m_statsPreviewOutput = createOutputLabel(y, "Preview:"); y += margin;
+    m_statsPeakOutput = createOutputLabel(y, "Peak queue:"); y += margin;
+    m_statsLoadOutput = createOutputLabel(y, "Load:"); y += margin;
+    m_statsShedOutput = createOutputLabel(y, "Shed:");
+    m_statsGroup->end();
+}
+
+void FLTKGui::updateStatsGroup()
+{
+    uint64_t *c = cached_run_stats.counters;
+    uint64_t *p = cached_run_stats.peaks;
+    char buf[100];
+
+    snprintf(buf, 100, "%lu acquired, %lu saved",
+             (unsigned long)c[RUN_FRAMES_ACQUIRED], (unsigned long)c[RUN_FRAMES_SAVED]);
+    m_statsFramesOutput->value(buf);
+
+    snprintf(buf, 100, "%lu lost, %lu no pool",
+             (unsigned long)c[RUN_CAMERA_LOST], (unsigned long)c[RUN_POOL_EXHAUSTED]);
+    m_statsCameraOutput->value(buf);
+
+    snprintf(buf, 100, "%lu frames, %lu triggers",
+             (unsigned long)c[RUN_MATCHER_FRAMES], (unsigned long)c[RUN_MATCHER_TRIGGERS]);
+    m_statsMatcherOutput->value(buf);
+
+    snprintf(buf, 100, "%lu failed", (unsigned long)c[RUN_SAVE_FAILED]);
+    m_statsSaveOutput->value(buf);
+
+    snprintf(buf, 100, "%lu skipped", (unsigned long)c[RUN_PREVIEW_SKIPPED]);
+    m_statsPreviewOutput->value(buf);
+
+    // Frames, triggers, write jobs; frames or triggers rejected by a full queue
+    snprintf(buf, 100, "%lu/%lu/%lu, %lu full",
+             (unsigned long)p[RUN_PEAK_FRAME_QUEUE], (unsigned long)p[RUN_PEAK_TRIGGER_QUEUE],
+             (unsigned long)p[RUN_PEAK_WRITE_QUEUE], (unsigned long)c[RUN_QUEUE_REJECTED]);
+    m_statsPeakOutput->value(buf);
+
+    m_statsLoadOutput->value(load_shed_stage_name(cached_load_stage));
+    m_statsLoadOutput->textcolor(cached_load_stage == LOAD_SHED_NONE ? FL_FOREGROUND_COLOR : FL_RED);
+
+    snprintf(buf, 100, "%lu spooled, %lu dropped",
+             (unsigned long)c[RUN_FRAMES_SPOOLED], (unsigned long)c[RUN_SHED_DROPPED]);
+    m_statsShedOutput->value(buf);
+}
+
 void FLTKGui::createLogGroup()
 {
-    m_logDisplay = new Fl_Multi_Browser(270, 10, 430, 295);
+    m_logDisplay = new Fl_Multi_Browser(270, 10, 430, 490);
     m_logEntries = 0;
 }
 
@@ -415,7 +480,7 @@ void FLTKGui::buttonQuitPressed(Fl_Widget* o, void *userdata)
 
 void FLTKGui::createButtonGroup()
 {
-    int y = 315;
+    int y = 510;
     m_buttonMetadata = new Fl_Button(10, y, 120, 30, "Set Metadata");
     m_buttonMetadata->user_data((void*)(this));
     m_buttonMetadata->callback(buttonMetadataPressed);
@@ -817,7 +882,7 @@ void FLTKGui::createMetadataWindow()
     m_metadataRunNumber = new Fl_Int_Input(x, y, 50, h, "-"); x+= 95;
 
     // Dirty hack... FLTK doesn't have a standalone label widget!?!
-    new Fl_Input(x, y, 0, h, ".fits.gz");
+    m_metadataSuffixLabel = new Fl_Input(x, y, 0, h, ".fits.gz");
 
     outputGroup->end();
 
@@ -865,6 +930,7 @@ void FLTKGui::showMetadataWindow()
 
     populate_string_preference(m_metadataRunPrefix, RUN_PREFIX);
     populate_int_preference(m_metadataRunNumber, RUN_NUMBER);
+    m_metadataSuffixLabel->copy_label(pn_output_codec_suffix(pn_preference_char(OUTPUT_CODEC)));
 
     populate_string_preference(m_metadataObserversInput, OBSERVERS);
     populate_string_preference(m_metadataObservatoryInput, OBSERVATORY);
@@ -1075,13 +1141,14 @@ FLTKGui::FLTKGui(Camera *camera, TimerUnit *timer)
 	Fl_File_Icon::load_system_icons();
 
 	// Create the main window
-    m_mainWindow = new Fl_Double_Window(710, 355, "Acquisition Control");
+    m_mainWindow = new Fl_Double_Window(710, 550, "Acquisition Control");
     m_mainWindow->user_data((void*)(this));
     m_mainWindow->callback(closeMainWindowCallback);
 
     createTimerGroup();
     createCameraGroup();
     createAcquisitionGroup();
+    createStatsGroup();
     createLogGroup();
     createButtonGroup();
 
@@ -1101,10 +1168,13 @@ FLTKGui::FLTKGui(Camera *camera, TimerUnit *timer)
     cached_exposure_time = pn_preference_int(EXPOSURE_TIME);
     cached_trigger_mode = pn_preference_char(TIMER_TRIGGER_MODE);
     cached_readout_display = camera_supports_readout_display(m_cameraRef);
+    run_stats_snapshot(&cached_run_stats);
+    cached_load_stage = load_shed_stage();
 
     updateTimerGroup();
     updateCameraGroup();
     updateAcquisitionGroup();
+    updateStatsGroup();
     updateButtonGroup();
 
 	m_mainWindow->show();
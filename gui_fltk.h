@@ -38,6 +38,8 @@ extern "C" {
     #include "main.h"
     #include "platform.h"
     #include "gui.h"
+    #include "run_stats.h"
+    #include "load_shed.h"
 }
 
 class FLTKGui
@@ -50,6 +52,7 @@ public:
     void updateTimerGroup();
     void updateCameraGroup();
     void updateAcquisitionGroup();
+    void updateStatsGroup();
     void updateButtonGroup();
     void showErrorPanel();
 
@@ -59,6 +62,7 @@ private:
     void createTimerGroup();
     void createCameraGroup();
     void createAcquisitionGroup();
+    void createStatsGroup();
     void createLogGroup();
     void createButtonGroup();
 
@@ -114,6 +118,17 @@ private:
     Fl_Output *m_acquisitionTargetOutput;
     Fl_Output *m_acquisitionBurstOutput;
     Fl_Output *m_acquisitionFilenameOutput;
+
+    // Frame accounting
+    Fl_Group *m_statsGroup;
+    Fl_Output *m_statsFramesOutput;
+    Fl_Output *m_statsCameraOutput;
+    Fl_Output *m_statsMatcherOutput;
+    Fl_Output *m_statsSaveOutput;
+    Fl_Output *m_statsPreviewOutput;
+    Fl_Output *m_statsPeakOutput;
+    Fl_Output *m_statsLoadOutput;
+    Fl_Output *m_statsShedOutput;
     
     // Log panel
     Fl_Multi_Browser *m_logDisplay;
@@ -138,6 +153,8 @@ private:
     TimerMode cached_timer_mode;
     uint8_t cached_trigger_mode;
     bool cached_readout_display;
+    struct run_stats cached_run_stats;
+    enum load_shed_stage cached_load_stage;
 
     // Camera window
     Fl_Double_Window *m_cameraWindow;
@@ -168,6 +185,7 @@ private:
     Fl_Button *m_metadataOutputDir;
     Fl_Input *m_metadataRunPrefix;
     Fl_Int_Input *m_metadataRunNumber;
+    Fl_Input *m_metadataSuffixLabel;
 
     Fl_Choice *m_metadataAcquistionInput;
     Fl_Int_Input *m_metadataBurstInput;
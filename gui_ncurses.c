@@ -26,6 +26,8 @@
 #include "preferences.h"
 #include "platform.h"
 #include "main.h"
+#include "run_stats.h"
+#include "load_shed.h"
 
 // Input parsing modes
 typedef enum
@@ -41,17 +43,20 @@ typedef enum
     INPUT_COUNTDOWN_NUMBER
 } PNUIInputType;
 
+// Frame accounting for the current run is shown between the log and the status bar
+#define STATS_WINDOW_HEIGHT 8
+
 extern TimerUnit *timer;
 extern Camera *camera;
 
 WINDOW  *time_window, *camera_window, *acquisition_window,
         *command_window, *metadata_window, *log_window,
-        *status_window, *separator_window,
+        *status_window, *separator_window, *stats_window,
         *input_window, *parameters_window, *frametype_window;
 
 PANEL   *time_panel, *camera_panel, *acquisition_panel,
         *command_panel, *metadata_panel, *log_panel,
-        *status_panel, *separator_panel,
+        *status_panel, *separator_panel, *stats_panel,
         *input_panel, *parameters_panel, *frametype_panel;
 
 PNCameraMode last_camera_mode;
@@ -60,6 +65,8 @@ int last_calibration_framecount;
 int last_run_number;
 int last_camera_downloading;
 uint16_t last_exposure_time;
+struct run_stats last_run_stats;
+enum load_shed_stage last_load_stage;
 PNUIInputType input_type = INPUT_MAIN;
 
 // A circular buffer for storing log messages
@@ -100,8 +107,9 @@ static void update_time_window()
     if (timer_gps_status(m_timerRef) == GPS_ACTIVE)
     {
         TimerTimestamp ts = timer_current_timestamp(m_timerRef);
+        TimestampCivil utc = timestamp_to_civil(ts.time);
         mvwaddstr(time_window, 1, 13, (ts.locked ? "Locked     " : "Unlocked   "));
-        mvwprintw(time_window, 3, 13, "%04d-%02d-%02d %02d:%02d:%02d", ts.year, ts.month, ts.day, ts.hours, ts.minutes, ts.seconds);
+        mvwprintw(time_window, 3, 13, "%04d-%02d-%02d %02d:%02d:%02d", utc.year, utc.month, utc.day, utc.hours, utc.minutes, utc.seconds);
 
         if (ts.exposure_progress != last_exposure_time)
             mvwprintw(time_window, 4, 13, "%03d        ", ts.exposure_progress);
@@ -227,7 +235,8 @@ static void update_acquisition_window()
         mvwaddstr(acquisition_window, 3, 13, "N/A        ");
 
     mvwaddstr(acquisition_window, 4, 13, "                    ");
-    mvwprintw(acquisition_window, 4, 13, "%s-%04d.fits.gz", run_prefix, run_number);
+    mvwprintw(acquisition_window, 4, 13, "%s-%04d%s", run_prefix, run_number,
+              pn_output_codec_suffix(pn_preference_char(OUTPUT_CODEC)));
     free(run_prefix);
 }
 
@@ -278,7 +287,7 @@ static WINDOW *create_log_window()
     int x = 35;
     int y = 0;
     int w = col - 34;
-    int h = row - 4;
+    int h = row - 4 - STATS_WINDOW_HEIGHT;
     return newwin(h, w, y, x);
 }
 
@@ -309,6 +318,78 @@ void pn_ui_log_line(char *msg)
 }
 
 
+static WINDOW *create_stats_window()
+{
+    int row, col;
+    getmaxyx(stdscr, row, col);
+
+    int x = 35;
+    int y = row - 3 - STATS_WINDOW_HEIGHT;
+    int w = col - 35;
+    int h = STATS_WINDOW_HEIGHT;
+
+    WINDOW *win = newwin(h, w, y, x);
+    box(win, 0, 0);
+
+    char *title = " Frame Accounting ";
+    mvwaddstr(win, 0, (w-strlen(title))/2, title);
+    mvwaddstr(win, 1, 2, "   Acquired:");
+    mvwaddstr(win, 2, 2, "      Saved:");
+    mvwaddstr(win, 3, 2, "Save failed:");
+    mvwaddstr(win, 4, 2, " Queue full:");
+    mvwaddstr(win, 5, 2, " No preview:");
+
+    int right = w / 2;
+    mvwaddstr(win, 1, right, "Camera lost:");
+    mvwaddstr(win, 2, right, " Pool empty:");
+    mvwaddstr(win, 3, right, "  Unmatched:");
+    mvwaddstr(win, 4, right, "Peak queues:");
+    mvwaddstr(win, 5, right, " (frame/trig/write)");
+    mvwaddstr(win, 6, 2, "   Shedding:");
+
+    return win;
+}
+
+// Print a value padded or truncated to the space before the next column
+static void print_stats_field(int y, int x, int end, const char *format, ...)
+{
+    char buf[64];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+
+    int width = end - x;
+    if (width > 0)
+        mvwprintw(stats_window, y, x, "%-*.*s", width, width, buf);
+}
+
+static void update_stats_window(struct run_stats *s, enum load_shed_stage stage)
+{
+    int w = getmaxx(stats_window);
+    int right = w / 2;
+
+    print_stats_field(1, 15, right - 1, "%llu", (unsigned long long)s->counters[RUN_FRAMES_ACQUIRED]);
+    print_stats_field(2, 15, right - 1, "%llu", (unsigned long long)s->counters[RUN_FRAMES_SAVED]);
+    print_stats_field(3, 15, right - 1, "%llu", (unsigned long long)s->counters[RUN_SAVE_FAILED]);
+    print_stats_field(4, 15, right - 1, "%llu", (unsigned long long)s->counters[RUN_QUEUE_REJECTED]);
+    print_stats_field(5, 15, right - 1, "%llu", (unsigned long long)s->counters[RUN_PREVIEW_SKIPPED]);
+
+    print_stats_field(1, right + 13, w - 1, "%llu", (unsigned long long)s->counters[RUN_CAMERA_LOST]);
+    print_stats_field(2, right + 13, w - 1, "%llu", (unsigned long long)s->counters[RUN_POOL_EXHAUSTED]);
+    print_stats_field(3, right + 13, w - 1, "%llu/%llu",
+                      (unsigned long long)s->counters[RUN_MATCHER_FRAMES],
+                      (unsigned long long)s->counters[RUN_MATCHER_TRIGGERS]);
+    print_stats_field(4, right + 13, w - 1, "%llu/%llu/%llu",
+                      (unsigned long long)s->peaks[RUN_PEAK_FRAME_QUEUE],
+                      (unsigned long long)s->peaks[RUN_PEAK_TRIGGER_QUEUE],
+                      (unsigned long long)s->peaks[RUN_PEAK_WRITE_QUEUE]);
+
+    print_stats_field(6, 15, w - 1, "%s (%llu spooled, %llu dropped)", load_shed_stage_name(stage),
+                      (unsigned long long)s->counters[RUN_FRAMES_SPOOLED],
+                      (unsigned long long)s->counters[RUN_SHED_DROPPED]);
+}
+
 static WINDOW *create_status_window()
 {
     int row, col;
@@ -506,6 +587,7 @@ void pn_ui_new(Camera *camera, TimerUnit *timer)
     metadata_window = create_metadata_window();
     log_window = create_log_window();
     status_window = create_status_window();
+    stats_window = create_stats_window();
 
     separator_window = create_separator_window();
     input_window = create_input_window();
@@ -519,6 +601,7 @@ void pn_ui_new(Camera *camera, TimerUnit *timer)
     metadata_panel = new_panel(metadata_window);
     log_panel = new_panel(log_window);
     status_panel = new_panel(status_window);
+    stats_panel = new_panel(stats_window);
     command_panel = new_panel(command_window);
 
     separator_panel = new_panel(separator_window);
@@ -535,6 +618,10 @@ void pn_ui_new(Camera *camera, TimerUnit *timer)
     update_command_window(last_camera_mode);
     update_metadata_window();
 
+    run_stats_snapshot(&last_run_stats);
+    last_load_stage = load_shed_stage();
+    update_stats_window(&last_run_stats, last_load_stage);
+
     last_camera_downloading = timer_mode(timer) == TIMER_READOUT;
 
     update_acquisition_window();
@@ -629,6 +716,12 @@ bool pn_ui_update()
             delwin(temp_win);
             update_status_window(mode);
 
+            temp_win = stats_window;
+            stats_window = create_stats_window();
+            replace_panel(stats_panel, stats_window);
+            delwin(temp_win);
+            update_stats_window(&last_run_stats, last_load_stage);
+
             temp_win = separator_window;
             separator_window = create_separator_window();
             replace_panel(separator_panel, separator_window);
@@ -975,6 +1068,16 @@ bool pn_ui_update()
         last_camera_temperature = temperature;
     }
 
+    struct run_stats stats;
+    run_stats_snapshot(&stats);
+    enum load_shed_stage load_stage = load_shed_stage();
+    if (memcmp(&stats, &last_run_stats, sizeof(struct run_stats)) || load_stage != last_load_stage)
+    {
+        update_stats_window(&stats, load_stage);
+        last_run_stats = stats;
+        last_load_stage = load_stage;
+    }
+
     int burst_countdown = pn_preference_int(BURST_COUNTDOWN);
     int run_number = pn_preference_int(RUN_NUMBER);
     uint16_t exposure_time = pn_preference_int(EXPOSURE_TIME);
@@ -1004,6 +1107,7 @@ void pn_ui_free()
     del_panel(acquisition_panel);
     del_panel(metadata_panel);
     del_panel(log_panel);
+    del_panel(stats_panel);
     del_panel(command_panel);
     del_panel(input_panel);
     del_panel(parameters_panel);
@@ -1014,6 +1118,7 @@ void pn_ui_free()
     delwin(acquisition_window);
     delwin(metadata_window);
     delwin(log_window);
+    delwin(stats_window);
     delwin(command_window);
     delwin(input_window);
     delwin(parameters_window);
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "latency.h"
+#include "main.h"
+#include "platform.h"
+
+// Log-linear histogram in the style of HdrHistogram: values below
+// SUB_BUCKET_COUNT ns are counted exactly, and each power of two above
+// that is split into SUB_BUCKET_COUNT linear buckets, giving a relative
+// error of at most 1 / SUB_BUCKET_COUNT (~6%). Values beyond 2^MAX_EXPONENT ns
+// (~18 minutes) are clamped into the last bucket; max is always exact.
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKET_COUNT (1 << SUB_BUCKET_BITS)
+#define MAX_EXPONENT 40
+#define BUCKET_COUNT (SUB_BUCKET_COUNT*(MAX_EXPONENT - SUB_BUCKET_BITS + 2))
+
+struct histogram
+{
+    uint64_t counts[BUCKET_COUNT];
+    uint64_t max;
+};
+
+static const char *stage_names[LATENCY_STAGE_COUNT] =
+{
+    "trigger->download",
+    "download->match",
+    "match->save",
+    "match->preview",
+    "trigger->save"
+};
+
+// The interval histograms are drained by latency_log_interval,
+// the totals accumulate for the lifetime of the program
+static struct histogram interval[LATENCY_STAGE_COUNT];
+static struct histogram total[LATENCY_STAGE_COUNT];
+static TimestampNS last_interval_log = 0;
+
+static size_t bucket_index(uint64_t value)
+{
+    if (value < SUB_BUCKET_COUNT)
+        return value;
+
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > MAX_EXPONENT)
+        return BUCKET_COUNT - 1;
+
+    // The leading bit selects the power of two, the next SUB_BUCKET_BITS the sub-bucket
+    size_t sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) - SUB_BUCKET_COUNT;
+    return SUB_BUCKET_COUNT*(exponent - SUB_BUCKET_BITS + 1) + sub_bucket;
+}
+
+// Largest value counted by a bucket
+static uint64_t bucket_upper_bound(size_t index)
+{
+    if (index < SUB_BUCKET_COUNT)
+        return index;
+
+    int exponent = index / SUB_BUCKET_COUNT + SUB_BUCKET_BITS - 1;
+    uint64_t sub_bucket = index % SUB_BUCKET_COUNT;
+    return ((SUB_BUCKET_COUNT + sub_bucket + 1) << (exponent - SUB_BUCKET_BITS)) - 1;
+}
+
+static void histogram_record(struct histogram *h, uint64_t value)
+{
+    __atomic_fetch_add(&h->counts[bucket_index(value)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&h->max, &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void latency_record(enum latency_stage stage, TimestampNS start, TimestampNS end)
+{
+    if (stage >= LATENCY_STAGE_COUNT || start == 0 || end == 0)
+        return;
+
+    // Triggers may legitimately arrive after the frame they belong to
+    // (e.g. the MicroMax triggers at the end of the exposure)
+    uint64_t value = end > start ? end - start : 0;
+    histogram_record(&interval[stage], value);
+    histogram_record(&total[stage], value);
+}
+
+// Take a consistent copy of a histogram, optionally resetting it.
+// Samples recorded concurrently are counted in either this copy or the next.
+static uint64_t histogram_snapshot(struct histogram *h, struct histogram *out, bool reset)
+{
+    uint64_t count = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++)
+    {
+        out->counts[i] = reset ? __atomic_exchange_n(&h->counts[i], 0, __ATOMIC_RELAXED) :
+                                 __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+        count += out->counts[i];
+    }
+
+    out->max = reset ? __atomic_exchange_n(&h->max, 0, __ATOMIC_RELAXED) :
+                       __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    return count;
+}
+
+static uint64_t histogram_percentile(struct histogram *h, uint64_t count, double percentile)
+{
+    uint64_t target = (uint64_t)(percentile*count/100 + 0.5);
+    if (target == 0)
+        target = 1;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; i++)
+    {
+        seen += h->counts[i];
+        if (seen >= target)
+        {
+            // The bucket bound can overestimate the largest sample
+            uint64_t bound = bucket_upper_bound(i);
+            return bound < h->max ? bound : h->max;
+        }
+    }
+
+    return h->max;
+}
+
+static void log_histograms(struct histogram *histograms, bool reset, const char *label)
+{
+    static struct histogram snapshot;
+    for (size_t i = 0; i < LATENCY_STAGE_COUNT; i++)
+    {
+        uint64_t count = histogram_snapshot(&histograms[i], &snapshot, reset);
+        if (count == 0)
+            continue;
+
+        double ms = NS_PER_MILLISECOND;
+        pn_log("%s latency %s: p50 %.1f ms, p99 %.1f ms, max %.1f ms (%llu frames)", label, stage_names[i],
+               histogram_percentile(&snapshot, count, 50) / ms,
+               histogram_percentile(&snapshot, count, 99) / ms,
+               snapshot.max / ms, (unsigned long long)count);
+    }
+}
+
+void latency_log_interval(int interval_seconds)
+{
+    if (interval_seconds <= 0)
+        return;
+
+    TimestampNS now = monotonic_time();
+    if (last_interval_log == 0)
+        last_interval_log = now;
+
+    if (now - last_interval_log < interval_seconds*NS_PER_SECOND)
+        return;
+
+    last_interval_log = now;
+    log_histograms(interval, true, "Recent");
+}
+
+void latency_log_summary()
+{
+    log_histograms(total, false, "Overall");
+}
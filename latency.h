@@ -0,0 +1,36 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "main.h"
+
+// Pipeline stages that are timed between monotonic timestamps
+// taken as a frame and its trigger pass through the program
+enum latency_stage
+{
+    LATENCY_TRIGGER_DOWNLOAD, // Trigger packet parsed -> frame queued by the camera
+    LATENCY_DOWNLOAD_MATCH,   // Frame queued -> paired with its trigger
+    LATENCY_MATCH_SAVE,       // Paired -> encoded to disk
+    LATENCY_MATCH_PREVIEW,    // Paired -> preview published
+    LATENCY_TRIGGER_SAVE,     // Trigger packet parsed -> encoded to disk
+    LATENCY_STAGE_COUNT
+};
+
+// Lock-free; may be called from any thread.
+// Samples with an unset (zero) start time are ignored.
+void latency_record(enum latency_stage stage, TimestampNS start, TimestampNS end);
+
+// Log percentiles for the samples recorded since the last call, if
+// interval_seconds have passed. Called periodically by the main thread.
+void latency_log_interval(int interval_seconds);
+
+// Log percentiles for all samples recorded since startup
+void latency_log_summary();
+
+#endif
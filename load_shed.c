@@ -0,0 +1,72 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdint.h>
+#include "load_shed.h"
+#include "main.h"
+
+// Percentage of the budget at which each stage is entered. A stage is left
+// once the backlog falls HYSTERESIS percent below its threshold, so that a
+// backlog hovering around a threshold doesn't toggle the codec every frame.
+static const uint64_t thresholds[LOAD_SHED_STAGE_COUNT] = {0, 25, 50, 70, 90};
+#define HYSTERESIS 10
+
+static const char *stage_names[LOAD_SHED_STAGE_COUNT] =
+{
+    "Normal",
+    "Skipping previews",
+    "Fast codec",
+    "Spooling to disk",
+    "Dropping calibrations"
+};
+
+static enum load_shed_stage current = LOAD_SHED_NONE;
+
+static enum load_shed_stage next_stage(enum load_shed_stage stage, uint64_t backlog, uint64_t budget)
+{
+    uint64_t percent = budget > 0 ? backlog*100 / budget : 0;
+
+    while (stage + 1 < LOAD_SHED_STAGE_COUNT && percent >= thresholds[stage + 1])
+        stage++;
+
+    while (stage > LOAD_SHED_NONE && percent + HYSTERESIS < thresholds[stage])
+        stage--;
+
+    return stage;
+}
+
+enum load_shed_stage load_shed_update(uint64_t backlog, uint64_t budget)
+{
+    enum load_shed_stage stage = __atomic_load_n(&current, __ATOMIC_RELAXED);
+    enum load_shed_stage next;
+    do
+    {
+        next = next_stage(stage, backlog, budget);
+        if (next == stage)
+            return stage;
+    }
+    while (!__atomic_compare_exchange_n(&current, &stage, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    double mb = 1024*1024;
+    if (next == LOAD_SHED_NONE)
+        pn_log("Frame backlog is %.0f of %.0f MB. Load shedding has stopped.", backlog / mb, budget / mb);
+    else
+        pn_log("%sFrame backlog is %.0f of %.0f MB. Load shedding stage %d: %s.",
+               next > stage ? "WARNING: " : "", backlog / mb, budget / mb, next, stage_names[next]);
+
+    return next;
+}
+
+enum load_shed_stage load_shed_stage()
+{
+    return __atomic_load_n(&current, __ATOMIC_RELAXED);
+}
+
+const char *load_shed_stage_name(enum load_shed_stage stage)
+{
+    return stage < LOAD_SHED_STAGE_COUNT ? stage_names[stage] : "Unknown";
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef LOAD_SHED_H
+#define LOAD_SHED_H
+
+#include <stdint.h>
+
+// Work that the frame manager gives up, in order, as the memory held by
+// queued frames approaches the FrameBacklogBudget. Each stage includes
+// the ones before it.
+enum load_shed_stage
+{
+    LOAD_SHED_NONE,
+    LOAD_SHED_SKIP_PREVIEW,     // Don't update the preview
+    LOAD_SHED_FAST_CODEC,       // Save with Rice instead of a slower codec (not in containers)
+    LOAD_SHED_SPOOL,            // Spill frames to a raw spool file until a writer is free
+    LOAD_SHED_DROP_CALIBRATION, // Drop the oldest queued calibration frames
+    LOAD_SHED_STAGE_COUNT
+};
+
+// Choose the stage for the given backlog and budget (in bytes), logging any change.
+// Lock-free; may be called from any thread.
+enum load_shed_stage load_shed_update(uint64_t backlog, uint64_t budget);
+
+// The most recently chosen stage
+enum load_shed_stage load_shed_stage();
+
+// Short description of a stage for display
+const char *load_shed_stage_name(enum load_shed_stage stage);
+
+#endif
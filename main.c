@@ -22,6 +22,8 @@
 #include "gui.h"
 #include "platform.h"
 #include "frame_manager.h"
+#include "latency.h"
+#include "run_stats.h"
 
 Modules *modules;
 struct atomicqueue *log_queue;
@@ -30,6 +32,8 @@ struct atomicqueue *log_queue;
 void queue_framedata(CameraFrame *f)
 {
     f->downloaded_time = timer_current_timestamp(modules->timer);
+    f->queued_time = monotonic_time();
+    run_stats_add(RUN_FRAMES_ACQUIRED, 1);
     frame_manager_queue_frame(modules->frame, f);
 }
 
@@ -47,6 +51,17 @@ void clear_queued_data(bool reset_first_frame)
     frame_manager_purge_queues(modules->frame, reset_first_frame);
 }
 
+// Passes the start and end of an acquisition from Camera -> FrameManager thread
+void notify_acquisition_started()
+{
+    frame_manager_notify_acquisition_started(modules->frame);
+}
+
+void notify_acquisition_stopped()
+{
+    frame_manager_notify_acquisition_stopped(modules->frame);
+}
+
 int main(int argc, char *argv[])
 {
     // Parse the commandline args
@@ -149,6 +164,9 @@ int main(int argc, char *argv[])
             free(log_message);
         }
 
+        // Report pipeline latency every LatencyLogInterval seconds (0 disables)
+        latency_log_interval(pn_preference_int(LATENCY_LOG_INTERVAL));
+
         bool request_shutdown = pn_ui_update();
         if ((status == NORMAL || status == ERROR) && request_shutdown)
         {
@@ -199,6 +217,7 @@ int main(int argc, char *argv[])
     frame_manager_join_thread(modules->frame);
     reduction_script_join_thread(modules->reduction);
     preview_script_join_thread(modules->preview);
+    latency_log_summary();
 
     timer_free(modules->timer);
     camera_free(modules->camera);
@@ -241,7 +260,7 @@ void pn_log(const char *format, ...)
     }
 
     // Add timestamp to beginning of format string
-    TimerTimestamp t = system_time();
+    TimestampCivil t = timestamp_to_civil(system_time().time);
     snprintf(message, 16, "[%02d:%02d:%02d.%03d] ", t.hours, t.minutes, t.seconds, t.milliseconds);
 
     va_start(args, format);
@@ -21,8 +21,26 @@ typedef struct
     struct ReductionScript * const reduction;
 } Modules;
 
+// Nanoseconds since the unix epoch (UTC)
+// Times are added and subtracted directly, and only converted
+// to a calendar date and time for display (see timestamp_to_civil)
+typedef int64_t TimestampNS;
+
+#define NS_PER_SECOND INT64_C(1000000000)
+#define NS_PER_MILLISECOND INT64_C(1000000)
+
 // Represents a timestamp from the GPS
-// Signed ints to allow subtracting times without hidden gotchas
+typedef struct
+{
+    TimestampNS time;
+    bool locked;
+    int32_t exposure_progress; // for current time
+
+    // monotonic_time() when the timer packet was received, for latency tracking
+    TimestampNS received_time;
+} TimerTimestamp;
+
+// Calendar date and time (UTC) for display
 typedef struct
 {
     int32_t year;
@@ -32,9 +50,7 @@ typedef struct
     int32_t minutes;
     int32_t seconds;
     int32_t milliseconds;
-    bool locked;
-    int32_t exposure_progress; // for current time
-} TimerTimestamp;
+} TimestampCivil;
 
 // Represents an aquired frame
 typedef struct
@@ -42,32 +58,39 @@ typedef struct
     uint16_t width;
     uint16_t height;
     uint16_t *data;
+    struct frame_pool *pool;
+
+    // Set by backends that lend their own buffer as data instead of copying
+    // into the pooled buffer. Called once the frame manager has finished.
+    void (*release_data)(void *ref);
+    void *release_data_ref;
+
+    // Optional, for lent buffers that the backend may overwrite while they are in use.
+    // Returns false once anything read from data can no longer be trusted.
+    bool (*data_valid)(void *ref);
     double temperature;
+    double temperature_age; // seconds between sampling temperature and claiming the frame
     TimerTimestamp downloaded_time;
 
+    // monotonic_time() when queued by the camera and paired with a trigger
+    TimestampNS queued_time;
+    TimestampNS matched_time;
+
     bool has_timestamp;
     double timestamp;
-    double readout_time;
-    double vertical_shift_us;
-
-    bool has_image_region;
-    bool has_bias_region;
-    uint16_t image_region[4];
-    uint16_t bias_region[4];
-
-    char *port_desc;
-    char *speed_desc;
-    char *gain_desc;
 
-    bool has_em_gain;
-    double em_gain;
+    // Readout settings shared with the other frames of the acquisition (see camera.h)
+    struct camera_readout *readout;
 
-    bool has_exposure_shortcut;
-    uint16_t exposure_shortcut_ms;
+    // ORIENTATION_* flags applied by frame_process_transforms.
+    // The readout regions are in the original (camera) orientation.
+    uint8_t orientation;
 } CameraFrame;
 
 void pn_log(const char * format, ...);
 void queue_framedata(CameraFrame *frame);
 void queue_trigger(TimerTimestamp *timestamp);
 void clear_queued_data(bool reset_first);
+void notify_acquisition_started();
+void notify_acquisition_stopped();
 #endif
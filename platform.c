@@ -15,24 +15,14 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <time.h>
 #include "main.h"
 
 #ifdef _WIN32
-    #include <time.h>
     #include "preferences.h"
     #include <windows.h>
 #endif
 
-#if defined(__MINGW64_VERSION_MAJOR)
-/* XXX why isn't this in sec_api/time_s.h? */
-# if defined(_USE_32BIT_TIME_T)
-#  define gmtime_s _gmtime32_s
-# else
-#  define gmtime_s _gmtime64_s
-# endif
-#endif
-
-
 #include "platform.h"
 
 // Append a formatted string to another string
@@ -53,60 +43,38 @@ int strncatf(char *restrict str, size_t size, const char *restrict format, ...)
 TimerTimestamp system_time()
 {
 #ifdef _WIN32
-    SYSTEMTIME st;
-    GetSystemTime(&st);
-
-    return (TimerTimestamp) {
-        .year = st.wYear,
-        .month = st.wMonth,
-        .day = st.wDay,
-        .hours = st.wHour,
-        .minutes = st.wMinute,
-        .seconds = st.wSecond,
-        .milliseconds = st.wMilliseconds,
-        .locked = true,
-        .exposure_progress = 0
-    };
+    // 100ns intervals since 1601-01-01
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    int64_t intervals = ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    TimestampNS time = (intervals - INT64_C(116444736000000000))*100;
 #else
-    struct timeval tv;
-    struct timezone tz;
-    gettimeofday(&tv, &tz);
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    TimestampNS time = ts.tv_sec*NS_PER_SECOND + ts.tv_nsec;
+#endif
 
-    struct tm *st = gmtime(&tv.tv_sec);
     return (TimerTimestamp) {
-        .year = st->tm_year + 1900,
-        .month = st->tm_mon + 1,
-        .day = st->tm_mday,
-        .hours = st->tm_hour,
-        .minutes = st->tm_min,
-        .seconds = st->tm_sec,
-        .milliseconds = tv.tv_usec / 1000,
+        .time = time,
         .locked = true,
         .exposure_progress = 0
     };
-#endif
-}
-
-time_t struct_tm_to_time_t(struct tm *t)
-{
-#ifdef _WIN64
-    return _mkgmtime(t);
-#elif defined _WIN32
-    return mktime(t);
-#else
-    return timegm(t);
-#endif
 }
 
-void normalize_tm(struct tm *t)
+// Nanoseconds since an arbitrary fixed point, unaffected by changes to the system clock.
+// Used for measuring intervals, never for display.
+TimestampNS monotonic_time()
 {
-    time_t b = struct_tm_to_time_t(t);
-#ifdef _WIN64
-    gmtime_s(t, &b);
-#elif defined _WIN32
-    *t = *localtime(&b);
+#ifdef _WIN32
+    LARGE_INTEGER frequency, counter;
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (counter.QuadPart / frequency.QuadPart)*NS_PER_SECOND +
+           (counter.QuadPart % frequency.QuadPart)*NS_PER_SECOND / frequency.QuadPart;
 #else
-    gmtime_r(&b, t);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*NS_PER_SECOND + ts.tv_nsec;
 #endif
 }
 
@@ -185,6 +153,44 @@ bool rename_atomically(const char *src, const char *dest, bool overwrite)
 #endif
 }
 
+// Copy src to dest, replacing dest if it exists
+bool copy_file(const char *src, const char *dest)
+{
+#ifdef _WIN32
+    return CopyFile(src, dest, FALSE);
+#else
+    FILE *in = fopen(src, "rb");
+    if (!in)
+        return false;
+
+    FILE *out = fopen(dest, "wb");
+    if (!out)
+    {
+        fclose(in);
+        return false;
+    }
+
+    char buf[65536];
+    size_t n;
+    bool success = true;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        if (fwrite(buf, 1, n, out) != n)
+        {
+            success = false;
+            break;
+        }
+
+    if (ferror(in))
+        success = false;
+
+    fclose(in);
+    if (fclose(out))
+        success = false;
+
+    return success;
+#endif
+}
+
 bool delete_file(const char *path)
 {
 #ifdef _WIN32
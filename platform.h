@@ -16,13 +16,13 @@
 
 int strncatf(char *str, size_t size, const char *format, ...);
 TimerTimestamp system_time();
-time_t struct_tm_to_time_t(struct tm *t);
-void normalize_tm(struct tm *t);
+TimestampNS monotonic_time();
 void millisleep(int ms);
 char *canonicalize_path(const char *path);
 char *platform_path(const char *path);
 bool file_exists(const char *path);
 bool rename_atomically(const char *src, const char *dest, bool overwrite);
+bool copy_file(const char *src, const char *dest);
 bool delete_file(const char *path);
 char *last_path_component(char *path);
 int run_command(const char *cmd, const char *log_prefix);
@@ -16,6 +16,9 @@
 static char *filename;
 static pthread_mutex_t access_mutex;
 
+// Incremented whenever a preference is changed through pn_preference_set
+static unsigned int generation;
+
 typedef enum { STRING, CHAR, INT } PNPrefDataType;
 typedef struct
 {
@@ -87,6 +90,18 @@ PNPreferenceStore prefs[] =
     {FRAME_FLIP_Y,              CHAR, .value.c = 0,     "FrameFlipY: %hhu\n"},
     {FRAME_TRANSPOSE,           CHAR, .value.c = 0,     "FrameTranspose: %hhu\n"},
     {PREVIEW_RATE_LIMIT,        INT,  .value.i = 500,   "PreviewRateLimit: %d\n"},
+    {FRAME_POOL_SIZE,           INT,  .value.i = 64,    "FramePoolSize: %d\n"},
+    {CAMERA_ZERO_COPY,          CHAR, .value.c = 0,     "CameraZeroCopy: %hhu\n"},
+    {CAMERA_FULL_REINIT,        CHAR, .value.c = 0,     "CameraFullReinit: %hhu\n"},
+    {FRAME_WRITER_THREADS,      INT,  .value.i = 2,     "FrameWriterThreads: %d\n"},
+    {OUTPUT_CODEC,              CHAR, .value.c = CODEC_GZIP, "OutputCodec: %hhu\n"},
+    {OUTPUT_CONTAINER,          CHAR, .value.c = 0,     "OutputContainer: %hhu\n"},
+    {LATENCY_LOG_INTERVAL,      INT,  .value.i = 60,    "LatencyLogInterval: %d\n"},
+    {SIMULATED_FRAME_WIDTH,     INT,  .value.i = 512,   "SimulatedFrameWidth: %d\n"},
+    {SIMULATED_FRAME_HEIGHT,    INT,  .value.i = 512,   "SimulatedFrameHeight: %d\n"},
+    {SIMULATED_BIAS_RATE,       INT,  .value.i = 10,    "SimulatedBiasRate: %d\n"},
+    {FRAME_BACKLOG_BUDGET,      INT,  .value.i = 0,     "FrameBacklogBudget: %d\n"},
+    {FRAME_SPOOL_DIR,         STRING, .value.s = "",    "FrameSpoolDir: %s\n"},
 
 #if (defined _WIN32)
     {MSYS_BASH_PATH, STRING, .value.s = "C:/MinGW/msys/1.0/bin/bash.exe",    "MsysBashPath: %s\n"}
@@ -245,6 +260,32 @@ unsigned char pn_preference_allow_save()
     return ret;
 }
 
+// Returns a counter that changes whenever a preference is set.
+// Used to detect when values derived from the preferences must be updated.
+unsigned int pn_preference_generation()
+{
+    pthread_mutex_lock(&access_mutex);
+    unsigned int ret = generation;
+    pthread_mutex_unlock(&access_mutex);
+    return ret;
+}
+
+// Filename suffix for frames saved with a given OUTPUT_CODEC
+const char *pn_output_codec_suffix(unsigned char codec)
+{
+    switch (codec)
+    {
+        case CODEC_RICE:
+        case CODEC_HCOMPRESS:
+            return ".fits.fz";
+        case CODEC_NONE:
+            return ".fits";
+        case CODEC_GZIP:
+        default:
+            return ".fits.gz";
+    }
+}
+
 void pn_preference_set(PNPreferenceType key, void *val)
 {
     pthread_mutex_lock(&access_mutex);
@@ -254,6 +295,7 @@ void pn_preference_set(PNPreferenceType key, void *val)
         case CHAR: prefs[key].value.c = *((char *)val); break;
         case INT: prefs[key].value.i = *((int *)val); break;
     }
+    generation++;
     save();
     pthread_mutex_unlock(&access_mutex);
 }
@@ -28,6 +28,14 @@ typedef enum
     TRIGGER_BIAS
 } PNTriggerMode;
 
+typedef enum
+{
+    CODEC_GZIP,
+    CODEC_RICE,
+    CODEC_HCOMPRESS,
+    CODEC_NONE
+} PNOutputCodec;
+
 typedef enum
 {
     OUTPUT_DIR,
@@ -78,6 +86,18 @@ typedef enum
     FRAME_FLIP_Y,
     FRAME_TRANSPOSE,
     PREVIEW_RATE_LIMIT,
+    FRAME_POOL_SIZE,
+    CAMERA_ZERO_COPY,
+    CAMERA_FULL_REINIT,
+    FRAME_WRITER_THREADS,
+    OUTPUT_CODEC,
+    OUTPUT_CONTAINER,
+    LATENCY_LOG_INTERVAL,
+    SIMULATED_FRAME_WIDTH,
+    SIMULATED_FRAME_HEIGHT,
+    SIMULATED_BIAS_RATE,
+    FRAME_BACKLOG_BUDGET,
+    FRAME_SPOOL_DIR,
 
 #if (defined _WIN32)
     MSYS_BASH_PATH,
@@ -96,6 +116,8 @@ int pn_preference_int(PNPreferenceType key);
 void pn_preference_increment_framecount();
 unsigned char pn_preference_toggle_save();
 unsigned char pn_preference_allow_save();
+unsigned int pn_preference_generation();
+const char *pn_output_codec_suffix(unsigned char codec);
 
 void pn_preference_set_char(PNPreferenceType key, unsigned char val);
 void pn_preference_set_string(PNPreferenceType key, const char *val);
@@ -8,9 +8,16 @@ if [ "$(xpaaccess -n Online_Preview)" = 0 ]; then
 	./startup.sh
 fi
 
+# The preview suffix follows the output codec; use the most recently written one
+PREVIEW=$(ls -t preview.fits preview.fits.gz preview.fits.fz 2>/dev/null | head -n 1)
+if [ -z "${PREVIEW}" ]; then
+	exit 0
+fi
+
 # Move preview to a temporary file to try and avoid file locking problems under windows
-mv preview.fits.gz preview.temp.fits.gz
+TEMP_PREVIEW="preview.temp${PREVIEW#preview}"
+mv "${PREVIEW}" "${TEMP_PREVIEW}"
 
 # Define e.g. GUIDE_OUTPUT="$(pwd)/guide.pos" in config.sh to enable guide output
-tsreduce preview $(pwd)/preview.temp.fits.gz Online_Preview ${GUIDE_OUTPUT}
-rm preview.temp.fits.gz
\ No newline at end of file
+tsreduce preview "$(pwd)/${TEMP_PREVIEW}" Online_Preview ${GUIDE_OUTPUT}
+rm "${TEMP_PREVIEW}"
\ No newline at end of file
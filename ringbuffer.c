@@ -0,0 +1,132 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include "ringbuffer.h"
+
+// Keep the producer and consumer indices on separate cache lines
+// so that the two threads don't invalidate each other's caches
+#define CACHE_LINE_SIZE 64
+
+struct ringbuffer
+{
+    // Immutable after creation
+    void **slots;
+    size_t mask;
+    char pad0[CACHE_LINE_SIZE];
+
+    // Owned by the consumer
+    size_t head;
+    size_t cached_tail;
+    char pad1[CACHE_LINE_SIZE];
+
+    // Owned by the producer
+    size_t tail;
+    size_t cached_head;
+    char pad2[CACHE_LINE_SIZE];
+};
+
+struct ringbuffer *ringbuffer_create(size_t capacity)
+{
+    struct ringbuffer *ring = calloc(1, sizeof(struct ringbuffer));
+    if (!ring)
+        return NULL;
+
+    // Round capacity up to a power of two so that
+    // indices can be wrapped with a mask
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    ring->slots = calloc(size, sizeof(void *));
+    if (!ring->slots)
+    {
+        free(ring);
+        return NULL;
+    }
+
+    ring->mask = size - 1;
+    return ring;
+}
+
+// Not thread safe: must only be called once the producer and consumer have stopped.
+// The queue doesn't own its objects, so callers must first pop and release them.
+void ringbuffer_destroy(struct ringbuffer *ring)
+{
+    if (!ring)
+        return;
+
+    assert(ringbuffer_length(ring) == 0);
+    free(ring->slots);
+    free(ring);
+}
+
+// Called by the producer thread only
+bool ringbuffer_push(struct ringbuffer *ring, void *object)
+{
+    size_t tail = ring->tail;
+
+    // Only reload the consumer index when the cached copy says we are full
+    if (tail - ring->cached_head > ring->mask)
+    {
+        ring->cached_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (tail - ring->cached_head > ring->mask)
+            return false;
+    }
+
+    ring->slots[tail & ring->mask] = object;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Called by the consumer thread only
+void *ringbuffer_pop(struct ringbuffer *ring)
+{
+    size_t head = ring->head;
+
+    // Only reload the producer index when the cached copy says we are empty
+    if (head == ring->cached_tail)
+    {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->cached_tail)
+            return NULL;
+    }
+
+    void *object = ring->slots[head & ring->mask];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return object;
+}
+
+// Called by the consumer thread only.
+// Returns the object that the next pop will return, without removing it.
+void *ringbuffer_peek(struct ringbuffer *ring)
+{
+    size_t head = ring->head;
+    if (head == ring->cached_tail)
+    {
+        ring->cached_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        if (head == ring->cached_tail)
+            return NULL;
+    }
+
+    return ring->slots[head & ring->mask];
+}
+
+// Safe to call from any thread. The result is a snapshot that may
+// already be stale if the producer or consumer are active.
+size_t ringbuffer_length(struct ringbuffer *ring)
+{
+    size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    return tail - head;
+}
+
+size_t ringbuffer_capacity(struct ringbuffer *ring)
+{
+    return ring->mask + 1;
+}
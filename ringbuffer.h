@@ -0,0 +1,25 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Fixed-capacity lock-free queue of object pointers.
+// Safe for exactly one producer thread and one consumer thread.
+// Callers with multiple consumers must serialize their pops externally.
+struct ringbuffer *ringbuffer_create(size_t capacity);
+void ringbuffer_destroy(struct ringbuffer *ring); // The queue must be empty
+bool ringbuffer_push(struct ringbuffer *ring, void *object);
+void *ringbuffer_pop(struct ringbuffer *ring);
+void *ringbuffer_peek(struct ringbuffer *ring);
+size_t ringbuffer_length(struct ringbuffer *ring);
+size_t ringbuffer_capacity(struct ringbuffer *ring);
+
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "run_stats.h"
+#include "main.h"
+
+static struct run_stats stats;
+
+void run_stats_add(enum run_counter counter, uint64_t count)
+{
+    if (counter < RUN_COUNTER_COUNT)
+        __atomic_fetch_add(&stats.counters[counter], count, __ATOMIC_RELAXED);
+}
+
+void run_stats_peak(enum run_peak peak, uint64_t value)
+{
+    if (peak >= RUN_PEAK_COUNT)
+        return;
+
+    uint64_t max = __atomic_load_n(&stats.peaks[peak], __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&stats.peaks[peak], &max, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void run_stats_reset()
+{
+    for (size_t i = 0; i < RUN_COUNTER_COUNT; i++)
+        __atomic_store_n(&stats.counters[i], 0, __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < RUN_PEAK_COUNT; i++)
+        __atomic_store_n(&stats.peaks[i], 0, __ATOMIC_RELAXED);
+}
+
+void run_stats_snapshot(struct run_stats *out)
+{
+    for (size_t i = 0; i < RUN_COUNTER_COUNT; i++)
+        out->counters[i] = __atomic_load_n(&stats.counters[i], __ATOMIC_RELAXED);
+
+    for (size_t i = 0; i < RUN_PEAK_COUNT; i++)
+        out->peaks[i] = __atomic_load_n(&stats.peaks[i], __ATOMIC_RELAXED);
+}
+
+void run_stats_log_summary()
+{
+    struct run_stats s;
+    run_stats_snapshot(&s);
+
+    pn_log("Run summary: %llu frames acquired, %llu saved.",
+           (unsigned long long)s.counters[RUN_FRAMES_ACQUIRED],
+           (unsigned long long)s.counters[RUN_FRAMES_SAVED]);
+    pn_log("Run summary: camera lost %llu readouts; %llu dropped by frame pool exhaustion.",
+           (unsigned long long)s.counters[RUN_CAMERA_LOST],
+           (unsigned long long)s.counters[RUN_POOL_EXHAUSTED]);
+    pn_log("Run summary: %llu rejected by full queues; matcher discarded %llu frames and %llu triggers.",
+           (unsigned long long)s.counters[RUN_QUEUE_REJECTED],
+           (unsigned long long)s.counters[RUN_MATCHER_FRAMES],
+           (unsigned long long)s.counters[RUN_MATCHER_TRIGGERS]);
+    pn_log("Run summary: %llu save failures, %llu previews skipped.",
+           (unsigned long long)s.counters[RUN_SAVE_FAILED],
+           (unsigned long long)s.counters[RUN_PREVIEW_SKIPPED]);
+    pn_log("Run summary: load shedding spooled %llu frames and dropped %llu calibration frames.",
+           (unsigned long long)s.counters[RUN_FRAMES_SPOOLED],
+           (unsigned long long)s.counters[RUN_SHED_DROPPED]);
+    pn_log("Run summary: peak backlog %llu frames, %llu triggers, %llu write jobs.",
+           (unsigned long long)s.peaks[RUN_PEAK_FRAME_QUEUE],
+           (unsigned long long)s.peaks[RUN_PEAK_TRIGGER_QUEUE],
+           (unsigned long long)s.peaks[RUN_PEAK_WRITE_QUEUE]);
+}
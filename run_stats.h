@@ -0,0 +1,63 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <stdint.h>
+
+// Frames and triggers counted as they pass through (or are lost from) the
+// pipeline, so that gaps in a run can be attributed to the camera, the
+// frame manager or the disk. Reset when the camera starts acquiring.
+enum run_counter
+{
+    RUN_FRAMES_ACQUIRED,       // Frames passed to the frame manager by the camera
+    RUN_CAMERA_LOST,           // Readouts lost or overwritten in the camera SDK / driver
+    RUN_POOL_EXHAUSTED,        // Readouts discarded because no frame was free in the pool
+    RUN_QUEUE_REJECTED,        // Frames or triggers that couldn't be queued for matching
+    RUN_MATCHER_FRAMES,        // Frames discarded without a matching trigger
+    RUN_MATCHER_TRIGGERS,      // Triggers discarded without a matching frame
+    RUN_FRAMES_SAVED,          // Frames written to disk
+    RUN_SAVE_FAILED,           // Frames that were meant to be saved but weren't
+    RUN_PREVIEW_SKIPPED,       // Previews that were due but skipped to shed load
+    RUN_FRAMES_SPOOLED,        // Frames spilled to the spool to shed load
+    RUN_SHED_DROPPED,          // Calibration frames dropped to shed load
+    RUN_COUNTER_COUNT
+};
+
+// Largest backlog seen by each queue
+enum run_peak
+{
+    RUN_PEAK_FRAME_QUEUE,
+    RUN_PEAK_TRIGGER_QUEUE,
+    RUN_PEAK_WRITE_QUEUE,
+    RUN_PEAK_COUNT
+};
+
+struct run_stats
+{
+    uint64_t counters[RUN_COUNTER_COUNT];
+    uint64_t peaks[RUN_PEAK_COUNT];
+};
+
+// Lock-free; may be called from any thread
+void run_stats_add(enum run_counter counter, uint64_t count);
+void run_stats_peak(enum run_peak peak, uint64_t value);
+
+// Called by the frame manager as an acquisition starts, once
+// the previous acquisition's summary has been logged
+void run_stats_reset();
+
+// Values may be updated concurrently, so each is individually
+// current but the set isn't guaranteed to be consistent
+void run_stats_snapshot(struct run_stats *out);
+
+// Log a summary of the current run. Called by the frame manager once
+// the frames of a stopped acquisition have been saved.
+void run_stats_log_summary();
+
+#endif
@@ -21,14 +21,24 @@
 #   include <fcntl.h>
 #   include <poll.h>
 #   include <sys/ioctl.h>
+#   ifdef __linux__
+#       include <sys/eventfd.h>
+#   endif
 #   include <termios.h>
 #endif
 struct serial_port
 {
 #ifdef _WIN32
     HANDLE handle;
+
+    // Read timeout applied by the last SetCommTimeouts call
+    int timeout;
 #else
     int fd;
+
+    // Read and write ends of the eventfd (Linux) or
+    // self-pipe used by serial_wake() to interrupt a blocking read
+    int wake[2];
 #endif
 };
 
@@ -103,6 +113,7 @@ struct serial_port *serial_new(const char *path, uint32_t baud, ssize_t *error)
         *error = -GetLastError();
         goto configuration_error;
     }
+    port->timeout = 0;
 
     return port;
 
@@ -179,6 +190,29 @@ open_error:
         goto configuration_error;
     }
 
+#ifdef __linux__
+    port->wake[0] = port->wake[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (port->wake[0] == -1)
+    {
+        *error = -errno;
+        goto configuration_error;
+    }
+#else
+    if (pipe(port->wake) == -1)
+    {
+        *error = -errno;
+        goto configuration_error;
+    }
+
+    if (fcntl(port->wake[0], F_SETFL, O_NONBLOCK) == -1 || fcntl(port->wake[1], F_SETFL, O_NONBLOCK) == -1)
+    {
+        *error = -errno;
+        close(port->wake[0]);
+        close(port->wake[1]);
+        goto configuration_error;
+    }
+#endif
+
     return port;
 configuration_error:
     close(port->fd);
@@ -196,6 +230,9 @@ void serial_free(struct serial_port *port)
 #else
     if (port->fd != -1)
         close(port->fd);
+    close(port->wake[0]);
+    if (port->wake[1] != port->wake[0])
+        close(port->wake[1]);
 #endif
     free(port);
 }
@@ -210,9 +247,33 @@ void serial_set_dtr(struct serial_port *port, bool enabled)
 #endif
 }
 
-ssize_t serial_read(struct serial_port *port, uint8_t *buf, size_t length)
+// Read up to length bytes, waiting up to timeout_ms (0 to return immediately,
+// -1 to wait indefinitely) for data to arrive.
+// Returns the number of bytes read, 0 if the timeout expired or serial_wake()
+// was called, or a negative error code.
+ssize_t serial_read_timeout(struct serial_port *port, uint8_t *buf, size_t length, int timeout_ms)
 {
 #ifdef _WIN32
+    // Windows has no equivalent of the wake eventfd without overlapped IO,
+    // so cap the wait to keep serial_wake() callers responsive
+    if (timeout_ms < 0 || timeout_ms > SERIAL_WAKE_INTERVAL)
+        timeout_ms = SERIAL_WAKE_INTERVAL;
+
+    if (timeout_ms != port->timeout)
+    {
+        // Return as soon as any data is available, or after
+        // timeout_ms if none arrives (immediately for 0)
+        COMMTIMEOUTS ct;
+        memset(&ct, 0, sizeof(COMMTIMEOUTS));
+        ct.ReadIntervalTimeout = MAXDWORD;
+        ct.ReadTotalTimeoutMultiplier = timeout_ms ? MAXDWORD : 0;
+        ct.ReadTotalTimeoutConstant = timeout_ms;
+
+        if (!SetCommTimeouts(port->handle, &ct))
+            return -GetLastError();
+        port->timeout = timeout_ms;
+    }
+
     DWORD read;
     if (!ReadFile(port->handle, buf, length, &read, NULL))
         return -GetLastError();
@@ -223,12 +284,27 @@ ssize_t serial_read(struct serial_port *port, uint8_t *buf, size_t length)
     // This makes it difficult to distinguish between no-data and error.
     // Instead, use poll() to check for the no-data case, so that any read() == 0
     // indicates that the device has been unplugged.
-    int ready = poll(&(struct pollfd) {.fd = port->fd, .events = POLLIN}, 1, 0);
-    if (ready == 0)
-        return 0;
-    else if (ready == -1)
+    struct pollfd fds[2] =
+    {
+        {.fd = port->fd, .events = POLLIN},
+        {.fd = port->wake[0], .events = POLLIN}
+    };
+
+    int ready;
+    do
+        ready = poll(fds, 2, timeout_ms);
+    while (ready == -1 && errno == EINTR);
+
+    if (ready == -1)
         return -errno;
 
+    // Reset the wakeup; the caller checks for whatever woke it
+    if (fds[1].revents & POLLIN)
+        while (read(port->wake[0], (uint8_t[16]){0}, 16) > 0);
+
+    if (!(fds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        return 0;
+
     ssize_t ret = read(port->fd, buf, length);
     if (ret == 0)
         return -ENXIO;
@@ -236,6 +312,28 @@ ssize_t serial_read(struct serial_port *port, uint8_t *buf, size_t length)
 #endif
 }
 
+// Read any available bytes without waiting
+ssize_t serial_read(struct serial_port *port, uint8_t *buf, size_t length)
+{
+    return serial_read_timeout(port, buf, length, 0);
+}
+
+// Interrupt a serial_read_timeout() that is blocked in another thread
+void serial_wake(struct serial_port *port)
+{
+#ifndef _WIN32
+    // Wakeups coalesce, so an EAGAIN means one is already pending
+#ifdef __linux__
+    ssize_t ret = write(port->wake[1], &(uint64_t){1}, sizeof(uint64_t));
+#else
+    ssize_t ret = write(port->wake[1], &(uint8_t){0}, 1);
+#endif
+    (void)ret;
+#else
+    (void)port;
+#endif
+}
+
 ssize_t serial_write(struct serial_port *port, const uint8_t *buf, size_t length)
 {
 #ifdef _WIN32
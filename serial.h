@@ -15,12 +15,18 @@
 typedef int ssize_t;
 #endif
 
+// Maximum time (in milliseconds) that a blocking read waits
+// before noticing serial_wake() on platforms without poll()
+#define SERIAL_WAKE_INTERVAL 10
+
 struct serial_port;
 
 struct serial_port *serial_new(const char *path, uint32_t baud, ssize_t *error);
 void serial_free(struct serial_port *port);
 void serial_set_dtr(struct serial_port *port, bool enabled);
 ssize_t serial_read(struct serial_port *port, uint8_t *buf, size_t length);
+ssize_t serial_read_timeout(struct serial_port *port, uint8_t *buf, size_t length, int timeout_ms);
+void serial_wake(struct serial_port *port);
 ssize_t serial_write(struct serial_port *port, const uint8_t *buf, size_t length);
 const char *serial_error_string(ssize_t code);
 
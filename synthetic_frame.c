@@ -0,0 +1,411 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "synthetic_frame.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Detector model, in ADU
+#define BIAS_LEVEL 1000.0f
+#define READ_NOISE 6.0f
+#define GAIN 2.0f // e-/ADU
+#define SKY_LEVEL 200.0f
+
+// Fractional change in the sky level across the frame in x and y
+#define SKY_GRADIENT_X 0.15f
+#define SKY_GRADIENT_Y -0.1f
+
+// Fractional amplitude and period (in frames) of slow transparency changes
+#define SKY_VARIATION 0.2f
+#define SKY_VARIATION_PERIOD 2000
+
+// One star per STAR_DENSITY pixels, with total fluxes drawn from a power
+// law so that faint stars are common and a few saturate
+#define STAR_DENSITY 2000
+#define STAR_MIN_FLUX 400.0f
+#define STAR_FLUX_INDEX 1.5f
+#define STAR_MAX_FLUX 5e6f
+#define PSF_SIGMA 1.6f
+#define PSF_RADIUS 7
+
+// Per-frame guiding drift (pixels) and jitter (standard deviation, pixels)
+#define DRIFT_X 0.03f
+#define DRIFT_Y 0.02f
+#define DRIFT_JITTER 0.05f
+
+// One hot pixel per HOT_PIXEL_DENSITY pixels, adding up to HOT_PIXEL_MAX ADU
+#define HOT_PIXEL_DENSITY 10000
+#define HOT_PIXEL_MAX 20000.0f
+
+// The sum of four uniform bytes has mean 510 and standard deviation
+// sqrt(4*(256^2 - 1)/12), which is close enough to a unit normal for noise
+#define BYTE_SUM_MEAN 510.0f
+#define BYTE_SUM_SCALE (1.0f / 147.8f)
+
+struct star
+{
+    float x;
+    float y;
+    float amplitude;
+};
+
+struct hot_pixel
+{
+    size_t index;
+    float value;
+};
+
+// Four independent xorshift128 generators, laid out so that
+// lane i of each word can be loaded into one SSE register
+struct lanes
+{
+    uint32_t x[4];
+    uint32_t y[4];
+    uint32_t z[4];
+    uint32_t w[4];
+};
+
+struct synthetic_frame
+{
+    uint16_t width;
+    uint16_t height;
+    uint32_t seed;
+    uint64_t frame;
+
+    // Expected star signal for the current frame
+    float *stars;
+
+    struct star *star;
+    size_t star_count;
+    struct hot_pixel *hot;
+    size_t hot_count;
+
+    float drift_x;
+    float drift_y;
+    float sky_scale;
+
+    // Stamp of each star in the previous frame, cleared by the next step
+    int32_t *stamp_x;
+    int32_t *stamp_y;
+
+    // Serial generator for the scene layout and drift
+    struct lanes rng;
+};
+
+static uint64_t splitmix64(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void lanes_seed(struct lanes *l, uint64_t seed)
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        uint64_t a = splitmix64(&seed);
+        uint64_t b = splitmix64(&seed);
+        l->x[i] = a;
+        l->y[i] = a >> 32;
+        l->z[i] = b;
+
+        // xorshift128 must not have an all-zero state
+        l->w[i] = (b >> 32) | 1;
+    }
+}
+
+// Advance all four lanes, writing one output per lane
+static inline void lanes_next(struct lanes *l, uint32_t out[4])
+{
+    for (size_t i = 0; i < 4; i++)
+    {
+        uint32_t t = l->x[i] ^ (l->x[i] << 11);
+        l->x[i] = l->y[i];
+        l->y[i] = l->z[i];
+        l->z[i] = l->w[i];
+        l->w[i] ^= (l->w[i] >> 19) ^ t ^ (t >> 8);
+        out[i] = l->w[i];
+    }
+}
+
+static inline float byte_sum_gaussian(uint32_t r)
+{
+    return ((r & 0xFF) + ((r >> 8) & 0xFF) + ((r >> 16) & 0xFF) + (r >> 24) - BYTE_SUM_MEAN)*BYTE_SUM_SCALE;
+}
+
+static float uniform(struct lanes *l)
+{
+    uint32_t r[4];
+    lanes_next(l, r);
+    return (r[0] >> 8) * (1.0f / 16777216.0f);
+}
+
+static float gaussian(struct lanes *l)
+{
+    uint32_t r[4];
+    lanes_next(l, r);
+    return byte_sum_gaussian(r[0]);
+}
+
+struct synthetic_frame *synthetic_frame_new(uint16_t width, uint16_t height, uint32_t seed)
+{
+    struct synthetic_frame *s = calloc(1, sizeof(struct synthetic_frame));
+    if (!s)
+        return NULL;
+
+    s->width = width;
+    s->height = height;
+    s->seed = seed;
+    s->sky_scale = 1;
+    lanes_seed(&s->rng, seed);
+
+    size_t pixels = (size_t)width*height;
+    s->star_count = pixels / STAR_DENSITY + 1;
+    s->hot_count = pixels / HOT_PIXEL_DENSITY + 1;
+
+    s->stars = calloc(pixels, sizeof(float));
+    s->star = calloc(s->star_count, sizeof(struct star));
+    s->stamp_x = calloc(s->star_count, sizeof(int32_t));
+    s->stamp_y = calloc(s->star_count, sizeof(int32_t));
+    s->hot = calloc(s->hot_count, sizeof(struct hot_pixel));
+    if (!s->stars || !s->star || !s->stamp_x || !s->stamp_y || !s->hot)
+    {
+        synthetic_frame_free(s);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < s->star_count; i++)
+    {
+        s->star[i].x = uniform(&s->rng)*width;
+        s->star[i].y = uniform(&s->rng)*height;
+
+        // Inverse transform sampling of a Pareto distribution
+        float flux = STAR_MIN_FLUX*powf(1 - uniform(&s->rng), -1 / STAR_FLUX_INDEX);
+        if (flux > STAR_MAX_FLUX)
+            flux = STAR_MAX_FLUX;
+        s->star[i].amplitude = flux / (2*M_PI*PSF_SIGMA*PSF_SIGMA);
+
+        // Nothing to clear before the first step
+        s->stamp_x[i] = -1;
+    }
+
+    for (size_t i = 0; i < s->hot_count; i++)
+    {
+        s->hot[i].index = (size_t)(uniform(&s->rng)*pixels) % pixels;
+        float u = uniform(&s->rng);
+        s->hot[i].value = HOT_PIXEL_MAX*u*u*u;
+    }
+
+    synthetic_frame_step(s);
+    return s;
+}
+
+void synthetic_frame_free(struct synthetic_frame *s)
+{
+    if (!s)
+        return;
+
+    free(s->stars);
+    free(s->star);
+    free(s->stamp_x);
+    free(s->stamp_y);
+    free(s->hot);
+    free(s);
+}
+
+// Clear (value 0) or add a star PSF stamp centered near (x, y)
+static void draw_star(struct synthetic_frame *s, int32_t x0, int32_t y0, float dx, float dy, float amplitude, bool clear)
+{
+    float gx[2*PSF_RADIUS + 1], gy[2*PSF_RADIUS + 1];
+    if (!clear)
+    {
+        // The PSF is separable, so only 2*(2r+1) exponentials are needed
+        float k = -1 / (2*PSF_SIGMA*PSF_SIGMA);
+        for (int i = -PSF_RADIUS; i <= PSF_RADIUS; i++)
+        {
+            gx[i + PSF_RADIUS] = expf(k*(i - dx)*(i - dx));
+            gy[i + PSF_RADIUS] = amplitude*expf(k*(i - dy)*(i - dy));
+        }
+    }
+
+    int x_start = x0 - PSF_RADIUS < 0 ? 0 : x0 - PSF_RADIUS;
+    int x_end = x0 + PSF_RADIUS >= s->width ? s->width - 1 : x0 + PSF_RADIUS;
+    int y_start = y0 - PSF_RADIUS < 0 ? 0 : y0 - PSF_RADIUS;
+    int y_end = y0 + PSF_RADIUS >= s->height ? s->height - 1 : y0 + PSF_RADIUS;
+
+    for (int y = y_start; y <= y_end; y++)
+    {
+        float *row = &s->stars[(size_t)y*s->width];
+        for (int x = x_start; x <= x_end; x++)
+            row[x] = clear ? 0 : row[x] + gx[x - x0 + PSF_RADIUS]*gy[y - y0 + PSF_RADIUS];
+    }
+}
+
+void synthetic_frame_step(struct synthetic_frame *s)
+{
+    s->frame++;
+    s->drift_x += DRIFT_X + DRIFT_JITTER*gaussian(&s->rng);
+    s->drift_y += DRIFT_Y + DRIFT_JITTER*gaussian(&s->rng);
+    s->drift_x = fmodf(s->drift_x, s->width);
+    s->drift_y = fmodf(s->drift_y, s->height);
+    s->sky_scale = 1 + SKY_VARIATION*sinf(2*M_PI*(s->frame % SKY_VARIATION_PERIOD) / SKY_VARIATION_PERIOD);
+
+    // Overlapping stamps are cleared completely before any are redrawn
+    for (size_t i = 0; i < s->star_count; i++)
+        if (s->stamp_x[i] >= 0)
+            draw_star(s, s->stamp_x[i], s->stamp_y[i], 0, 0, 0, true);
+
+    // Stars that drift off one edge reappear on the other
+    for (size_t i = 0; i < s->star_count; i++)
+    {
+        float x = fmodf(s->star[i].x + s->drift_x, s->width);
+        float y = fmodf(s->star[i].y + s->drift_y, s->height);
+        if (x < 0)
+            x += s->width;
+        if (y < 0)
+            y += s->height;
+
+        int32_t x0 = (int32_t)x;
+        int32_t y0 = (int32_t)y;
+        s->stamp_x[i] = x0;
+        s->stamp_y[i] = y0;
+        draw_star(s, x0, y0, x - x0, y - y0, s->star[i].amplitude, false);
+    }
+}
+
+#ifdef __SSE2__
+// Sum the four bytes of each 32-bit lane
+static inline __m128 byte_sum_ps(__m128i v)
+{
+    __m128i mask = _mm_set1_epi32(0x00FF00FF);
+    __m128i pairs = _mm_add_epi32(_mm_and_si128(v, mask), _mm_and_si128(_mm_srli_epi32(v, 8), mask));
+    __m128i sums = _mm_and_si128(_mm_add_epi32(pairs, _mm_srli_epi32(pairs, 16)), _mm_set1_epi32(0xFFFF));
+    return _mm_cvtepi32_ps(sums);
+}
+
+// Render n pixels (a multiple of 8) of a row, advancing the generator state
+static void render_span_sse2(struct lanes *l, const float *stars, uint16_t *out, size_t n,
+                             float sky_start, float sky_step, bool bias)
+{
+    __m128i x = _mm_loadu_si128((const __m128i *)l->x);
+    __m128i y = _mm_loadu_si128((const __m128i *)l->y);
+    __m128i z = _mm_loadu_si128((const __m128i *)l->z);
+    __m128i w = _mm_loadu_si128((const __m128i *)l->w);
+
+    const __m128 mean = _mm_set1_ps(BYTE_SUM_MEAN);
+    const __m128 scale = _mm_set1_ps(BYTE_SUM_SCALE);
+    const __m128 inv_gain = _mm_set1_ps(1 / GAIN);
+    const __m128 read_variance = _mm_set1_ps(READ_NOISE*READ_NOISE);
+    const __m128 bias_level = _mm_set1_ps(BIAS_LEVEL);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 saturated = _mm_set1_ps(65535.0f);
+    const __m128i offset = _mm_set1_epi32(32768);
+    const __m128i sign = _mm_set1_epi16((short)0x8000);
+
+    __m128 sky = _mm_setr_ps(sky_start, sky_start + sky_step, sky_start + 2*sky_step, sky_start + 3*sky_step);
+    const __m128 sky_increment = _mm_set1_ps(4*sky_step);
+
+    for (size_t i = 0; i < n; i += 8)
+    {
+        __m128i packed[2];
+        for (size_t k = 0; k < 2; k++)
+        {
+            __m128i t = _mm_xor_si128(x, _mm_slli_epi32(x, 11));
+            x = y;
+            y = z;
+            z = w;
+            w = _mm_xor_si128(_mm_xor_si128(w, _mm_srli_epi32(w, 19)), _mm_xor_si128(t, _mm_srli_epi32(t, 8)));
+            __m128 g = _mm_mul_ps(_mm_sub_ps(byte_sum_ps(w), mean), scale);
+
+            __m128 signal = zero;
+            if (!bias)
+            {
+                signal = _mm_add_ps(sky, _mm_loadu_ps(stars + i + 4*k));
+                sky = _mm_add_ps(sky, sky_increment);
+            }
+
+            __m128 sigma = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(signal, inv_gain), read_variance));
+            __m128 v = _mm_add_ps(_mm_add_ps(bias_level, signal), _mm_mul_ps(sigma, g));
+            v = _mm_min_ps(_mm_max_ps(v, zero), saturated);
+
+            // SSE2 can only pack with signed saturation, so shift into the int16 range and back
+            packed[k] = _mm_sub_epi32(_mm_cvtps_epi32(v), offset);
+        }
+
+        __m128i pixels = _mm_xor_si128(_mm_packs_epi32(packed[0], packed[1]), sign);
+        _mm_storeu_si128((__m128i *)(out + i), pixels);
+    }
+
+    _mm_storeu_si128((__m128i *)l->x, x);
+    _mm_storeu_si128((__m128i *)l->y, y);
+    _mm_storeu_si128((__m128i *)l->z, z);
+    _mm_storeu_si128((__m128i *)l->w, w);
+}
+#endif
+
+static void render_span(struct lanes *l, const float *stars, uint16_t *out, size_t n,
+                        float sky_start, float sky_step, bool bias)
+{
+    for (size_t i = 0; i < n; i += 4)
+    {
+        uint32_t r[4];
+        lanes_next(l, r);
+        for (size_t k = 0; k < 4 && i + k < n; k++)
+        {
+            float g = byte_sum_gaussian(r[k]);
+            float signal = bias ? 0 : sky_start + (i + k)*sky_step + stars[i + k];
+            float v = BIAS_LEVEL + signal + sqrtf(signal / GAIN + READ_NOISE*READ_NOISE)*g;
+            out[i + k] = v < 0 ? 0 : v > 65535 ? 65535 : (uint16_t)lrintf(v);
+        }
+    }
+}
+
+void synthetic_frame_render(struct synthetic_frame *s, uint16_t *out, bool bias,
+                            uint16_t row_start, uint16_t row_end)
+{
+    float sky_level = SKY_LEVEL*s->sky_scale;
+    float sky_step = sky_level*SKY_GRADIENT_X / s->width;
+
+    for (uint16_t y = row_start; y < row_end && y < s->height; y++)
+    {
+        // Seeding per row makes the output independent of how rows are divided between threads
+        struct lanes l;
+        lanes_seed(&l, ((uint64_t)s->seed << 48) ^ (s->frame << 16) ^ y);
+
+        size_t row = (size_t)y*s->width;
+        float sky_start = sky_level*(1 + SKY_GRADIENT_Y*y / s->height);
+        size_t x = 0;
+#ifdef __SSE2__
+        x = s->width & ~(size_t)7;
+        render_span_sse2(&l, &s->stars[row], &out[row], x, sky_start, sky_step, bias);
+#endif
+        render_span(&l, &s->stars[row + x], &out[row + x], s->width - x,
+                    sky_start + x*sky_step, sky_step, bias);
+    }
+
+    if (bias)
+        return;
+
+    // Hot pixels have shot noise of their own, but it is negligible next to their spread
+    size_t first = (size_t)row_start*s->width;
+    size_t last = (size_t)(row_end < s->height ? row_end : s->height)*s->width;
+    for (size_t i = 0; i < s->hot_count; i++)
+    {
+        size_t index = s->hot[i].index;
+        if (index < first || index >= last)
+            continue;
+
+        float v = out[index] + s->hot[i].value;
+        out[index] = v > 65535 ? 65535 : (uint16_t)v;
+    }
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef SYNTHETIC_FRAME_H
+#define SYNTHETIC_FRAME_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Renders a plausible sky for the simulated camera: a bias level with read noise,
+// a sky gradient, a drifting field of Gaussian stars and a fixed set of hot pixels,
+// with shot noise approximated by a Gaussian of the appropriate width.
+// A generator is not thread safe, but rendering into disjoint row ranges is.
+struct synthetic_frame;
+
+struct synthetic_frame *synthetic_frame_new(uint16_t width, uint16_t height, uint32_t seed);
+void synthetic_frame_free(struct synthetic_frame *s);
+
+// Advance the star field and sky level to the next frame
+void synthetic_frame_step(struct synthetic_frame *s);
+
+// Render rows [row_start, row_end) of the current frame into out, which holds the
+// full frame. Bias frames contain only the bias level and read noise.
+// Each row range draws from its own random stream so ranges may be rendered concurrently.
+void synthetic_frame_render(struct synthetic_frame *s, uint16_t *out, bool bias,
+                            uint16_t row_start, uint16_t row_end);
+
+#endif
@@ -7,6 +7,8 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <math.h>
@@ -19,86 +21,16 @@
 #include "platform.h"
 #include "camera.h"
 #include "serial.h"
+#include "timer_packet.h"
+#include "bytering.h"
 
-// Force gcc ABI for packed structs under windows
-#ifdef _WIN32
-#   define PACKED_STRUCT __attribute__((gcc_struct, __packed__))
-#else
-#   define PACKED_STRUCT __attribute__((__packed__))
-#endif
-
-// Timer message protocol definitions
-#define MAX_DATA_LENGTH 200
-enum packet_state {HEADERA = 0, HEADERB, TYPE, LENGTH, DATA, CHECKSUM, FOOTERA, FOOTERB};
-enum packet_type
-{
-    TIMESTAMP = 'A',
-    TRIGGER = 'B',
-    MESSAGE = 'C',
-    MESSAGE_RAW = 'D',
-    START_EXPOSURE = 'E',
-    STOP_EXPOSURE = 'F',
-    STATUS = 'H',
-    ENABLE_RELAY = 'R',
-};
-
-enum __attribute__((__packed__)) packet_timeflags {TIMESTAMP_LOCKED = 1, TIMESTAMP_IS_GPS = 2};
-struct PACKED_STRUCT packet_time
-{
-    uint16_t year;
-    uint8_t month;
-    uint8_t day;
-    uint8_t hours;
-    uint8_t minutes;
-    uint8_t seconds;
-    uint16_t milliseconds;
-    enum packet_timeflags flags;
-    int16_t utc_offset;
-    uint16_t exposure_progress;
-};
-
-enum __attribute__((__packed__)) packet_timingmode {TIME_SECONDS, TIME_MILLISECONDS};
-struct PACKED_STRUCT packet_startexposure
-{
-    uint8_t use_monitor;
-    enum packet_timingmode timing_mode;
-    uint16_t exposure;
-    uint8_t stride;
-    uint8_t align_first;
-};
-
-struct PACKED_STRUCT packet_status
-{
-    // Mirrors (unpacked) TimerMode enum
-    uint8_t timer;
-
-    // Mirrors (unpacked) TimerGPSStatus enum
-    uint8_t gps;
-};
-
-struct PACKED_STRUCT packet_message
-{
-    uint8_t length;
-    char str[MAX_DATA_LENGTH-1];
-};
+// Maximum time (in milliseconds) that the timer thread sleeps
+// waiting for serial data before checking for shutdown
+#define READ_TIMEOUT 100
 
-struct timer_packet
-{
-    enum packet_state state;
-    enum packet_type type;
-    uint8_t length;
-    uint8_t progress;
-    uint8_t checksum;
-
-    union
-    {
-        // Extra byte allows us to always null-terminate strings for display
-        uint8_t bytes[MAX_DATA_LENGTH+1];
-        struct packet_time time;
-        struct packet_status status;
-        struct packet_message message;
-    } data;
-};
+// Capacity (in bytes) of the outgoing packet queue.
+// Everything queued is sent by a single write.
+#define SEND_QUEUE_CAPACITY 1024
 
 // Private struct implementation
 struct TimerUnit
@@ -107,12 +39,20 @@ struct TimerUnit
     bool thread_alive;
 
     bool simulated;
-    uint16_t simulated_progress;
     bool simulated_send_shutdown;
 
+    // Simulated exposure period and the length of one exposure unit
+    // (s or ms) in nanoseconds. The period is zero when not exposing.
+    int64_t simulated_period;
+    int64_t simulated_unit;
+
+    // Signalled when the simulated exposure settings change or on shutdown
+    pthread_cond_t simulated_condition;
+
     uint16_t exposure_length;
     uint8_t exposure_stride;
 
+    // Set while the timer thread has the port open. Protected by port_mutex
     struct serial_port *port;
 
     bool shutdown;
@@ -120,10 +60,11 @@ struct TimerUnit
     TimerMode mode;
     TimerGPSStatus gps_status;
 
-    unsigned char send_buffer[256];
-    unsigned char send_length;
+    // Framed packets waiting to be sent, queued from any thread
+    struct bytering *send_queue;
+
     pthread_mutex_t read_mutex;
-    pthread_mutex_t write_mutex;
+    pthread_mutex_t port_mutex;
 };
 
 void *timer_thread(void *timer);
@@ -138,9 +79,17 @@ TimerUnit *timer_new(bool simulate_hardware)
     if (!timer)
         return NULL;
 
+    timer->send_queue = bytering_create(SEND_QUEUE_CAPACITY);
+    if (!timer->send_queue)
+    {
+        free(timer);
+        return NULL;
+    }
+
     timer->simulated = simulate_hardware;
     pthread_mutex_init(&timer->read_mutex, NULL);
-    pthread_mutex_init(&timer->write_mutex, NULL);
+    pthread_mutex_init(&timer->port_mutex, NULL);
+    pthread_cond_init(&timer->simulated_condition, NULL);
 
     return timer;
 }
@@ -148,7 +97,9 @@ TimerUnit *timer_new(bool simulate_hardware)
 void timer_free(TimerUnit *timer)
 {
     pthread_mutex_destroy(&timer->read_mutex);
-    pthread_mutex_destroy(&timer->write_mutex);
+    pthread_mutex_destroy(&timer->port_mutex);
+    pthread_cond_destroy(&timer->simulated_condition);
+    bytering_destroy(timer->send_queue);
     free(timer);
 }
 
@@ -173,7 +124,15 @@ void timer_join_thread(TimerUnit *timer)
 
 void timer_notify_shutdown(TimerUnit *timer)
 {
+    pthread_mutex_lock(&timer->read_mutex);
     timer->shutdown = true;
+    pthread_cond_signal(&timer->simulated_condition);
+    pthread_mutex_unlock(&timer->read_mutex);
+
+    pthread_mutex_lock(&timer->port_mutex);
+    if (timer->port)
+        serial_wake(timer->port);
+    pthread_mutex_unlock(&timer->port_mutex);
 }
 
 bool timer_thread_alive(TimerUnit *timer)
@@ -183,69 +142,43 @@ bool timer_thread_alive(TimerUnit *timer)
 
 #pragma mark Timer Routines (Called from Timer thread)
 
-// Queue a raw byte to be sent to the timer
-// Should only be called by queue_data
-static void queue_send_byte(TimerUnit *timer, unsigned char b)
-{
-    // Hard-loop until the send buffer empties
-    // Should never happen in normal operation
-    while (timer->send_length >= 255);
-
-    pthread_mutex_lock(&timer->write_mutex);
-    timer->send_buffer[timer->send_length++] = b;
-    pthread_mutex_unlock(&timer->write_mutex);
-}
-
 // Wrap an array of bytes in a data packet and send it to the timer
 static void queue_data(TimerUnit *timer, enum packet_type type, void *data, uint8_t length)
 {
-    // Data packet starts with $$ followed by packet type
-    queue_send_byte(timer, '$');
-    queue_send_byte(timer, '$');
-    queue_send_byte(timer, type);
-
-    // Length of data section
-    queue_send_byte(timer, length);
-
-    // Packet data
-    uint8_t checksum = 0;
-    for (uint8_t i = 0; i < length; i++)
+    uint8_t packet[MAX_PACKET_LENGTH];
+    size_t packet_length = timer_packet_encode(packet, type, data, length);
+    if (!bytering_push(timer->send_queue, packet, packet_length))
     {
-        checksum ^= ((uint8_t *)data)[i];
-        queue_send_byte(timer, ((uint8_t *)data)[i]);
+        pn_log("Timer send queue is full. Discarding packet: %c", type);
+        return;
     }
 
-    // Checksum
-    queue_send_byte(timer, checksum);
-
-    // Data packet ends with linefeed and carriage return
-    queue_send_byte(timer, '\r');
-    queue_send_byte(timer, '\n');
+    // Wake the timer thread to send the packet
+    pthread_mutex_lock(&timer->port_mutex);
+    if (timer->port)
+        serial_wake(timer->port);
+    pthread_mutex_unlock(&timer->port_mutex);
 }
 
 static void unpack_timestamp(struct packet_time *pt, TimerTimestamp *tt)
 {
-    tt->year = pt->year;
-    tt->month = pt->month;
-    tt->day = pt->day;
-    tt->hours = pt->hours;
-    tt->minutes = pt->minutes;
-    tt->seconds = pt->seconds;
-    tt->milliseconds = pt->milliseconds;
+    tt->time = timestamp_from_civil(pt->year, pt->month, pt->day, pt->hours,
+                                    pt->minutes, pt->seconds, pt->milliseconds);
     tt->locked = (pt->flags & TIMESTAMP_LOCKED);
     tt->exposure_progress = pt->exposure_progress;
+    tt->received_time = monotonic_time();
 
     // Convert GPS time to UTC
     if (pt->flags & TIMESTAMP_IS_GPS)
-        tt->seconds -= pt->utc_offset;
-
-    // Normalize the timestamp so that the milliseconds and
-    // seconds are in their expected range.
-    timestamp_normalize(tt);
+        tt->time -= pt->utc_offset*NS_PER_SECOND;
 }
 
-static void parse_packet(TimerUnit *timer, Camera *camera, struct timer_packet *p)
+static void parse_packet(struct timer_packet *p, void *_modules)
 {
+    const Modules *modules = _modules;
+    TimerUnit *timer = modules->timer;
+    Camera *camera = modules->camera;
+
     // Handle packet
     switch (p->type)
     {
@@ -270,7 +203,7 @@ static void parse_packet(TimerUnit *timer, Camera *camera, struct timer_packet *
             pthread_mutex_unlock(&timer->read_mutex);
 
             // Interpolate intermediate timestamps if necessary
-            uint8_t trigger_mode = pn_preference_char(TIMER_TRIGGER_MODE);
+            TimestampNS exposure = timer->exposure_length*timestamp_exposure_unit(pn_preference_char(TIMER_TRIGGER_MODE));
             for (uint8_t i = timer->exposure_stride - 1; i > 0; i--)
             {
                 TimerTimestamp *interpolated = malloc(sizeof(TimerTimestamp));
@@ -281,11 +214,7 @@ static void parse_packet(TimerUnit *timer, Camera *camera, struct timer_packet *
                 }
 
                 memcpy(interpolated, t, sizeof(TimerTimestamp));
-                if (trigger_mode == TRIGGER_SECONDS)
-                    interpolated->seconds -= i*timer->exposure_length;
-                else
-                    interpolated->milliseconds -= i*timer->exposure_length;
-                timestamp_normalize(interpolated);
+                interpolated->time -= i*exposure;
 
                 // Pass ownership to main thread
                 queue_trigger(interpolated);
@@ -346,6 +275,22 @@ static void parse_packet(TimerUnit *timer, Camera *camera, struct timer_packet *
     }
 }
 
+static void log_parser_error(enum timer_parser_error error, struct timer_packet *p, uint8_t got, uint8_t expected, void *context)
+{
+    switch (error)
+    {
+        case PARSER_LONG_PACKET:
+            pn_log("Timer warning: ignoring long packet: %c (length %u)", p->type, p->length);
+            break;
+        case PARSER_BAD_CHECKSUM:
+            pn_log("Timer warning: Packet checksum failed. Got 0x%02x, expected 0x%02x.", got, expected);
+            break;
+        case PARSER_BAD_FOOTER:
+            pn_log("Timer warning: Invalid packet end byte. Got 0x%02x, expected 0x%02x.", got, expected);
+            break;
+    }
+}
+
 // Main timer thread loop
 void *timer_thread(void *_modules)
 {
@@ -377,118 +322,60 @@ void *timer_thread(void *_modules)
     serial_set_dtr(port, false);
 
     // Clear any buffered data from before the reset
-    while (serial_read(port, &(uint8_t){0}, 1) > 0);
+    uint8_t discard[256];
+    while (serial_read(port, discard, sizeof(discard)) > 0);
 
     // Wait for bootloader timeout
     pn_log("Waiting for timer...");
     millisleep(5000);
 
-    struct timer_packet p = (struct timer_packet){.state = HEADERA};
+    struct timer_parser parser;
+    timer_parser_init(&parser, parse_packet, log_parser_error, _modules);
+
+    // Allow other threads to wake us when they queue data
+    pthread_mutex_lock(&timer->port_mutex);
+    timer->port = port;
+    pthread_mutex_unlock(&timer->port_mutex);
 
     while (!timer->shutdown)
     {
-        // Send any queued data
-        pthread_mutex_lock(&timer->write_mutex);
-        if (timer->send_length > 0)
+        // Send any queued packets
+        uint8_t send_buffer[SEND_QUEUE_CAPACITY];
+        size_t send_length = bytering_pop(timer->send_queue, send_buffer, sizeof(send_buffer));
+        if (send_length > 0)
         {
-            ssize_t ret = serial_write(port, timer->send_buffer, timer->send_length);
+            ssize_t ret = serial_write(port, send_buffer, send_length);
             if (ret < 0)
             {
                 pn_log("Timer write error (%zd): %s", ret, serial_error_string(ret));
-                pthread_mutex_unlock(&timer->write_mutex);
                 break;
             }
 
-            if (ret != timer->send_length)
+            if ((size_t)ret != send_length)
             {
-                pn_log("Timer write error: only %zu of %u bytes written", ret, timer->send_length);
-                pthread_mutex_unlock(&timer->write_mutex);
+                pn_log("Timer write error: only %zd of %zu bytes written", ret, send_length);
                 break;
             }
-
-            timer->send_length = 0;
         }
-        pthread_mutex_unlock(&timer->write_mutex);
 
-        // Check for new data
-        uint8_t b;
-        ssize_t status;
-        while ((status = serial_read(port, &b, 1)))
+        // Sleep until data arrives or a packet is queued to send
+        uint8_t buf[256];
+        ssize_t status = serial_read_timeout(port, buf, sizeof(buf), READ_TIMEOUT);
+        if (status < 0)
         {
-            if (status < 0)
-            {
-                pn_log("Timer read error (%zd): %s", status, serial_error_string(status));
-                goto error;
-            }
-
-            switch (p.state)
-            {
-                case HEADERA:
-                case HEADERB:
-                    if (b == '$')
-                        p.state++;
-                    else
-                        p.state = HEADERA;
-                    break;
-                case TYPE:
-                    p.type = b;
-                    p.state++;
-                    break;
-                case LENGTH:
-                    p.length = b;
-                    p.progress = 0;
-                    p.checksum = 0;
-                    if (p.length == 0)
-                        p.state = CHECKSUM;
-                    else if (p.length <= sizeof(p.data))
-                        p.state++;
-                    else
-                    {
-                        pn_log("Timer warning: ignoring long packet: %c (length %u)", p.type, p.length);
-                        p.state = HEADERA;
-                    }
-                    break;
-                case DATA:
-                    p.checksum ^= b;
-                    p.data.bytes[p.progress++] = b;
-                    if (p.progress == p.length)
-                        p.state++;
-                    break;
-                case CHECKSUM:
-                    if (p.checksum == b)
-                        p.state++;
-                    else
-                    {
-                        pn_log("Timer warning: Packet checksum failed. Got 0x%02x, expected 0x%02x.", b, p.checksum);
-                        p.state = HEADERA;
-                    }
-                    break;
-                case FOOTERA:
-                    if (b == '\r')
-                        p.state++;
-                    else
-                    {
-                        pn_log("Timer warning: Invalid packet end byte. Got 0x%02x, expected 0x%02x.", b, '\r');
-                        p.state = HEADERA;
-                    }
-                    break;
-                case FOOTERB:
-                    if (b == '\n')
-                        parse_packet(timer, modules->camera, &p);
-                    else
-                        pn_log("Timer warning: Invalid packet end byte. Got 0x%02x, expected 0x%02x.", b, '\n');
-
-                    p.state = HEADERA;
-                    break;
-            }
+            pn_log("Timer read error (%zd): %s", status, serial_error_string(status));
+            break;
         }
 
-        millisleep(100);
+        timer_parser_parse(&parser, buf, status);
     }
 
-error:
     pn_log("Shutting down timer.");
 
+    pthread_mutex_lock(&timer->port_mutex);
+    timer->port = NULL;
+    pthread_mutex_unlock(&timer->port_mutex);
+
     // Reset hardware
     serial_set_dtr(port, true);
     millisleep(100);
@@ -507,6 +394,9 @@ serial_error:
 }
 
 // Main simulated timer thread loop
+// Sleeps until the next whole second (to update the current time) or the end of
+// the current exposure, whichever is first. Exposures end at exact multiples of
+// the exposure period, like the hardware timer with aligned exposures.
 void *simulated_timer_thread(void *_modules)
 {
     const Modules *modules = _modules;
@@ -514,73 +404,69 @@ void *simulated_timer_thread(void *_modules)
 
     // Initialization
     pn_log("Initializing simulated Timer.");
-    timer->simulated_progress = timer->exposure_length = 0;
+    pthread_mutex_lock(&timer->read_mutex);
+    timer->simulated_period = timer->exposure_length = 0;
     timer->gps_status = GPS_ACTIVE;
 
-    TimerTimestamp last = system_time();
-
-    // Loop until shutdown, parsing incoming data
     while (!timer->shutdown)
     {
-        millisleep(1);
-
-        pthread_mutex_lock(&timer->read_mutex);
-        bool send_shutdown = timer->simulated_send_shutdown;
-        timer->simulated_send_shutdown = false;
-        pthread_mutex_unlock(&timer->read_mutex);
-        if (send_shutdown)
+        if (timer->simulated_send_shutdown)
         {
-            timer->exposure_length = 0;
-            timer->simulated_progress = 0;
+            timer->simulated_send_shutdown = false;
+            pthread_mutex_unlock(&timer->read_mutex);
             camera_notify_safe_to_stop(modules->camera);
+            pthread_mutex_lock(&timer->read_mutex);
+            continue;
         }
 
-        uint8_t trigger_mode = pn_preference_char(TIMER_TRIGGER_MODE);
-        TimerTimestamp cur = system_time();
-        if (cur.seconds != last.seconds || (trigger_mode != TRIGGER_SECONDS && cur.milliseconds != last.milliseconds))
-        {
-            if (camera_mode(modules->camera) == ACQUIRING && timer->exposure_length > 0)
-            {
-                if (trigger_mode == TRIGGER_SECONDS)
-                    timer->simulated_progress += (uint16_t)round(timestamp_to_unixtime(&cur) - timestamp_to_unixtime(&last));
-                else
-                    timer->simulated_progress += (uint16_t)round(1000*(timestamp_to_unixtime(&cur) - timestamp_to_unixtime(&last)));
-            }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        int64_t now = ts.tv_sec*NS_PER_SECOND + ts.tv_nsec;
+        int64_t period = timer->simulated_period;
 
-            if (timer->simulated_progress >= timer->exposure_length && timer->exposure_length > 0)
-            {
-                timer->simulated_progress -= timer->exposure_length;
+        timer->current_timestamp = (TimerTimestamp){.time = now, .locked = true};
+        if (period > 0)
+            timer->current_timestamp.exposure_progress = (now % period) / timer->simulated_unit;
 
-                TimerTimestamp *t = malloc(sizeof(TimerTimestamp));
-                if (!t)
-                {
-                    pn_log("Error allocating TimerTimestamp. Discarding trigger");
-                    break;
-                }
+        int64_t tick = (now / NS_PER_SECOND + 1)*NS_PER_SECOND;
+        int64_t trigger = period > 0 ? (now / period + 1)*period : INT64_MAX;
+        int64_t deadline = trigger < tick ? trigger : tick;
 
-                *t = cur;
+        struct timespec wake = {.tv_sec = deadline / NS_PER_SECOND, .tv_nsec = deadline % NS_PER_SECOND};
+        int ret = pthread_cond_timedwait(&timer->simulated_condition, &timer->read_mutex, &wake);
 
-                // Pass ownership to main thread
-                queue_trigger(t);
+        // Woken early by a change in settings or shutdown
+        if (ret != ETIMEDOUT || deadline != trigger || period != timer->simulated_period)
+            continue;
 
+        timer->current_timestamp = (TimerTimestamp){.time = trigger, .locked = true};
+        pthread_mutex_unlock(&timer->read_mutex);
+
+        if (camera_mode(modules->camera) == ACQUIRING)
+        {
+            TimerTimestamp *t = malloc(sizeof(TimerTimestamp));
+            if (!t)
+            {
+                pn_log("Error allocating TimerTimestamp. Discarding trigger");
                 pthread_mutex_lock(&timer->read_mutex);
-                timer->mode = TIMER_READOUT;
-                pthread_mutex_unlock(&timer->read_mutex);
+                break;
             }
 
-            cur.exposure_progress = timer->simulated_progress;
-            pthread_mutex_lock(&timer->read_mutex);
-            timer->current_timestamp = cur;
-            pthread_mutex_unlock(&timer->read_mutex);
+            *t = (TimerTimestamp){.time = trigger, .locked = true, .received_time = monotonic_time()};
 
-            last = cur;
+            // Pass ownership to main thread
+            queue_trigger(t);
+
+            pthread_mutex_lock(&timer->read_mutex);
+            timer->mode = TIMER_READOUT;
         }
+        else
+            pthread_mutex_lock(&timer->read_mutex);
     }
 
     pn_log("Simulated Timer shutdown.");
 
     // Invalidate current time
-    pthread_mutex_lock(&timer->read_mutex);
     timer->mode = TIMER_IDLE;
     pthread_mutex_unlock(&timer->read_mutex);
 
@@ -606,8 +492,10 @@ void timer_start_exposure(TimerUnit *timer, uint16_t exptime, bool use_monitor)
     if (timer->simulated)
     {
         pthread_mutex_lock(&timer->read_mutex);
-        timer->simulated_progress = 0;
+        timer->simulated_unit = timestamp_exposure_unit(trigger_mode);
+        timer->simulated_period = exptime*timer->simulated_unit;
         timer->mode = TIMER_EXPOSING;
+        pthread_cond_signal(&timer->simulated_condition);
         pthread_mutex_unlock(&timer->read_mutex);
     }
     else
@@ -636,7 +524,10 @@ void timer_stop_exposure(TimerUnit *timer)
     {
         pthread_mutex_lock(&timer->read_mutex);
         timer->simulated_send_shutdown = true;
+        timer->simulated_period = 0;
+        timer->exposure_length = 0;
         timer->mode = TIMER_IDLE;
+        pthread_cond_signal(&timer->simulated_condition);
         pthread_mutex_unlock(&timer->read_mutex);
     }
     else
@@ -665,32 +556,61 @@ TimerGPSStatus timer_gps_status(TimerUnit *timer)
     return timer->gps_status;
 }
 
-// Ensure all time components are within their allowed range
-void timestamp_normalize(TimerTimestamp *ts)
+// Days since the unix epoch for a date in the proleptic Gregorian calendar.
+// Out of range months are not supported, but days may be.
+static int64_t days_from_civil(int64_t year, int64_t month, int64_t day)
+{
+    // Count years from March, so that the leap day is at the end of the year
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era*400;
+    int64_t day_of_year = (153*(month + (month > 2 ? -3 : 9)) + 2)/5 + day - 1;
+    int64_t day_of_era = year_of_era*365 + year_of_era/4 - year_of_era/100 + day_of_year;
+    return era*146097 + day_of_era - 719468;
+}
+
+TimestampNS timestamp_from_civil(int32_t year, int32_t month, int32_t day,
+                                 int32_t hours, int32_t minutes, int32_t seconds, int32_t milliseconds)
+{
+    int64_t s = days_from_civil(year, month, day)*86400 + hours*3600 + minutes*60 + seconds;
+    return s*NS_PER_SECOND + milliseconds*NS_PER_MILLISECOND;
+}
+
+TimestampCivil timestamp_to_civil(TimestampNS time)
 {
-    // Normalize milliseconds manually
-    while (ts->milliseconds < 0)
+    // Round towards negative infinity so that times before the epoch work
+    const int64_t ns_per_day = 86400*NS_PER_SECOND;
+    int64_t days = time / ns_per_day;
+    int64_t ns = time % ns_per_day;
+    if (ns < 0)
     {
-        ts->milliseconds += 1000;
-        ts->seconds--;
+        ns += ns_per_day;
+        days--;
     }
 
-    // Let gmtime/timegm normalize the rest
-    struct tm a = {ts->seconds + ts->milliseconds / 1000, ts->minutes, ts->hours, ts->day, ts->month - 1, ts->year - 1900, 0, 0, 0};
-    normalize_tm(&a);
-
-    // Construct a new timestamp to return
-    ts->milliseconds = ts->milliseconds % 1000;
-    ts->seconds = a.tm_sec;
-    ts->minutes = a.tm_min;
-    ts->hours = a.tm_hour;
-    ts->day = a.tm_mday;
-    ts->month = a.tm_mon + 1;
-    ts->year = a.tm_year + 1900;
+    // Inverse of days_from_civil
+    days += 719468;
+    int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    int64_t day_of_era = days - era*146097;
+    int64_t year_of_era = (day_of_era - day_of_era/1460 + day_of_era/36524 - day_of_era/146096) / 365;
+    int64_t day_of_year = day_of_era - (365*year_of_era + year_of_era/4 - year_of_era/100);
+    int64_t mp = (5*day_of_year + 2)/153;
+    int32_t month = mp < 10 ? mp + 3 : mp - 9;
+
+    int64_t ms = ns / NS_PER_MILLISECOND;
+    return (TimestampCivil) {
+        .year = year_of_era + era*400 + (month <= 2),
+        .month = month,
+        .day = day_of_year - (153*mp + 2)/5 + 1,
+        .hours = ms / 3600000,
+        .minutes = (ms / 60000) % 60,
+        .seconds = (ms / 1000) % 60,
+        .milliseconds = ms % 1000
+    };
 }
 
-double timestamp_to_unixtime(TimerTimestamp *ts)
+// Length of one EXPOSURE_TIME unit for the given TIMER_TRIGGER_MODE
+TimestampNS timestamp_exposure_unit(uint8_t trigger_mode)
 {
-    struct tm t = {ts->seconds, ts->minutes, ts->hours, ts->day, ts->month - 1, ts->year - 1900,0,0,0};
-    return struct_tm_to_time_t(&t) + ts->milliseconds / 1000.0;
+    return trigger_mode == TRIGGER_SECONDS ? NS_PER_SECOND : NS_PER_MILLISECOND;
 }
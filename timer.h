@@ -43,7 +43,9 @@ TimerMode timer_mode(TimerUnit *timer);
 TimerTimestamp timer_current_timestamp(TimerUnit *timer);
 TimerGPSStatus timer_gps_status(TimerUnit *timer);
 
-void timestamp_normalize(TimerTimestamp *ts);
-double timestamp_to_unixtime(TimerTimestamp *ts);
+TimestampNS timestamp_from_civil(int32_t year, int32_t month, int32_t day,
+                                 int32_t hours, int32_t minutes, int32_t seconds, int32_t milliseconds);
+TimestampCivil timestamp_to_civil(TimestampNS time);
+TimestampNS timestamp_exposure_unit(uint8_t trigger_mode);
 
 #endif
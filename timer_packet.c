@@ -0,0 +1,168 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#include <string.h>
+#include "timer_packet.h"
+
+void timer_parser_init(struct timer_parser *parser, timer_packet_callback packet_callback,
+                       timer_parser_error_callback error_callback, void *context)
+{
+    memset(parser, 0, sizeof(struct timer_parser));
+    parser->packet.state = HEADERA;
+    parser->packet_callback = packet_callback;
+    parser->error_callback = error_callback;
+    parser->context = context;
+}
+
+static void discard_packet(struct timer_parser *parser, enum timer_parser_error error, uint8_t got, uint8_t expected)
+{
+    parser->error_count++;
+    if (parser->error_callback)
+        parser->error_callback(error, &parser->packet, got, expected, parser->context);
+
+    parser->packet.state = HEADERA;
+}
+
+// Feed a span of received bytes through the packet state machine,
+// calling the packet callback as each packet is completed
+void timer_parser_parse(struct timer_parser *parser, const uint8_t *buf, size_t length)
+{
+    struct timer_packet *p = &parser->packet;
+    const uint8_t *end = buf + length;
+
+    while (buf < end)
+    {
+        switch (p->state)
+        {
+            case HEADERA:
+            {
+                // Skip any garbage before the next packet in a single pass
+                const uint8_t *header = memchr(buf, '$', end - buf);
+                if (!header)
+                {
+                    parser->skipped_bytes += end - buf;
+                    return;
+                }
+
+                parser->skipped_bytes += header - buf;
+                buf = header + 1;
+                p->state = HEADERB;
+                break;
+            }
+            case HEADERB:
+                if (*buf++ == '$')
+                    p->state = TYPE;
+                else
+                {
+                    parser->skipped_bytes += 2;
+                    p->state = HEADERA;
+                }
+                break;
+            case TYPE:
+                p->type = *buf++;
+                p->state = LENGTH;
+                break;
+            case LENGTH:
+                p->length = *buf++;
+                p->progress = 0;
+                p->checksum = 0;
+                if (p->length == 0)
+                    p->state = CHECKSUM;
+                else if (p->length <= MAX_DATA_LENGTH)
+                    p->state = DATA;
+                else
+                    discard_packet(parser, PARSER_LONG_PACKET, p->length, MAX_DATA_LENGTH);
+                break;
+            case DATA:
+            {
+                // Copy as much of the data section as is available
+                size_t n = p->length - p->progress;
+                if (n > (size_t)(end - buf))
+                    n = end - buf;
+
+                uint8_t checksum = p->checksum;
+                for (size_t i = 0; i < n; i++)
+                    checksum ^= buf[i];
+
+                memcpy(&p->data.bytes[p->progress], buf, n);
+                p->checksum = checksum;
+                p->progress += n;
+                buf += n;
+
+                if (p->progress == p->length)
+                    p->state = CHECKSUM;
+                break;
+            }
+            case CHECKSUM:
+            {
+                uint8_t b = *buf++;
+                if (p->checksum == b)
+                    p->state = FOOTERA;
+                else
+                    discard_packet(parser, PARSER_BAD_CHECKSUM, b, p->checksum);
+                break;
+            }
+            case FOOTERA:
+            {
+                uint8_t b = *buf++;
+                if (b == '\r')
+                    p->state = FOOTERB;
+                else
+                    discard_packet(parser, PARSER_BAD_FOOTER, b, '\r');
+                break;
+            }
+            case FOOTERB:
+            {
+                uint8_t b = *buf++;
+                if (b == '\n')
+                {
+                    parser->packet_count++;
+                    p->state = HEADERA;
+                    if (parser->packet_callback)
+                        parser->packet_callback(p, parser->context);
+                }
+                else
+                    discard_packet(parser, PARSER_BAD_FOOTER, b, '\n');
+                break;
+            }
+        }
+    }
+}
+
+// Wrap an array of bytes in a data packet.
+// buf must have space for MAX_PACKET_LENGTH bytes.
+// Returns the number of bytes written.
+size_t timer_packet_encode(uint8_t *buf, enum packet_type type, const void *data, uint8_t length)
+{
+    if (length > MAX_DATA_LENGTH)
+        length = MAX_DATA_LENGTH;
+
+    // Data packet starts with $$ followed by packet type
+    buf[0] = '$';
+    buf[1] = '$';
+    buf[2] = type;
+
+    // Length of data section
+    buf[3] = length;
+
+    // Packet data
+    uint8_t checksum = 0;
+    for (uint8_t i = 0; i < length; i++)
+    {
+        checksum ^= ((const uint8_t *)data)[i];
+        buf[4 + i] = ((const uint8_t *)data)[i];
+    }
+
+    // Checksum
+    buf[4 + length] = checksum;
+
+    // Data packet ends with carriage return and linefeed
+    buf[5 + length] = '\r';
+    buf[6 + length] = '\n';
+
+    return 7 + length;
+}
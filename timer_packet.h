@@ -0,0 +1,134 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+#ifndef TIMER_PACKET_H
+#define TIMER_PACKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Force gcc ABI for packed structs under windows
+#ifdef _WIN32
+#   define PACKED_STRUCT __attribute__((gcc_struct, __packed__))
+#else
+#   define PACKED_STRUCT __attribute__((__packed__))
+#endif
+
+// Timer message protocol definitions
+// Packets are framed as $$, type, length, data, checksum (xor of data), \r\n
+#define MAX_DATA_LENGTH 200
+#define MAX_PACKET_LENGTH (MAX_DATA_LENGTH + 7)
+
+enum packet_state {HEADERA = 0, HEADERB, TYPE, LENGTH, DATA, CHECKSUM, FOOTERA, FOOTERB};
+enum packet_type
+{
+    TIMESTAMP = 'A',
+    TRIGGER = 'B',
+    MESSAGE = 'C',
+    MESSAGE_RAW = 'D',
+    START_EXPOSURE = 'E',
+    STOP_EXPOSURE = 'F',
+    STATUS = 'H',
+    ENABLE_RELAY = 'R',
+};
+
+enum __attribute__((__packed__)) packet_timeflags {TIMESTAMP_LOCKED = 1, TIMESTAMP_IS_GPS = 2};
+struct PACKED_STRUCT packet_time
+{
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    uint8_t hours;
+    uint8_t minutes;
+    uint8_t seconds;
+    uint16_t milliseconds;
+    enum packet_timeflags flags;
+    int16_t utc_offset;
+    uint16_t exposure_progress;
+};
+
+enum __attribute__((__packed__)) packet_timingmode {TIME_SECONDS, TIME_MILLISECONDS};
+struct PACKED_STRUCT packet_startexposure
+{
+    uint8_t use_monitor;
+    enum packet_timingmode timing_mode;
+    uint16_t exposure;
+    uint8_t stride;
+    uint8_t align_first;
+};
+
+struct PACKED_STRUCT packet_status
+{
+    // Mirrors (unpacked) TimerMode enum
+    uint8_t timer;
+
+    // Mirrors (unpacked) TimerGPSStatus enum
+    uint8_t gps;
+};
+
+struct PACKED_STRUCT packet_message
+{
+    uint8_t length;
+    char str[MAX_DATA_LENGTH-1];
+};
+
+struct timer_packet
+{
+    enum packet_state state;
+    enum packet_type type;
+    uint8_t length;
+    uint8_t progress;
+    uint8_t checksum;
+
+    union
+    {
+        // Extra byte allows us to always null-terminate strings for display
+        uint8_t bytes[MAX_DATA_LENGTH+1];
+        struct packet_time time;
+        struct packet_status status;
+        struct packet_message message;
+    } data;
+};
+
+enum timer_parser_error
+{
+    PARSER_LONG_PACKET,
+    PARSER_BAD_CHECKSUM,
+    PARSER_BAD_FOOTER
+};
+
+// Called for each complete packet. The packet is only valid until the callback returns.
+typedef void (*timer_packet_callback)(struct timer_packet *packet, void *context);
+
+// Called when a malformed packet is discarded.
+// got and expected are the offending byte and the value that was expected in its place.
+typedef void (*timer_parser_error_callback)(enum timer_parser_error error, struct timer_packet *packet,
+                                            uint8_t got, uint8_t expected, void *context);
+
+// Incremental packet parser. Input may be split at any byte,
+// and the partial packet is preserved between calls.
+struct timer_parser
+{
+    struct timer_packet packet;
+
+    timer_packet_callback packet_callback;
+    timer_parser_error_callback error_callback;
+    void *context;
+
+    // Statistics
+    uint64_t packet_count;
+    uint64_t error_count;
+    uint64_t skipped_bytes;
+};
+
+void timer_parser_init(struct timer_parser *parser, timer_packet_callback packet_callback,
+                       timer_parser_error_callback error_callback, void *context);
+void timer_parser_parse(struct timer_parser *parser, const uint8_t *buf, size_t length);
+size_t timer_packet_encode(uint8_t *buf, enum packet_type type, const void *data, uint8_t length);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ * Copyright 2013 Paul Chote
+ * This file is part of Puoko-nui, which is free software. It is made available
+ * to you under the terms of version 3 of the GNU General Public License, as
+ * published by the Free Software Foundation. For more information, see LICENSE.
+ */
+
+// Emulates the GPS timer on a pseudo-terminal so that the real serial port,
+// packet parser and trigger matching code can be exercised without hardware.
+// Point TimerSerialPort at the printed (or -l linked) path and run puokonui
+// with --simulate-camera: each trigger then produces a simulated frame.
+// Linux / POSIX only.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "timer_packet.h"
+#include "timer.h"
+
+// Maximum burst of injected noise, in bytes
+#define NOISE_BURST 80
+
+// Command line options
+static int64_t timestamp_interval = NS_PER_SECOND;
+static int64_t status_interval = NS_PER_SECOND;
+static int64_t noise_interval = 0;
+static int64_t period_override = 0;
+static int checksum_error_percent = 0;
+static int report_interval = 10;
+
+static volatile sig_atomic_t shutdown_requested = 0;
+
+struct emulator
+{
+    int master;
+
+    // Exposure sequence requested by START_EXPOSURE, zero when idle
+    int64_t period;
+    int64_t unit;
+    int64_t trigger_period;
+    int64_t next_trigger;
+    int64_t sequence_start;
+    bool stop_requested;
+
+    uint64_t sent[256];
+    uint64_t received[256];
+    uint64_t checksum_errors;
+    uint64_t noise_bytes;
+    uint64_t dropped;
+};
+
+static int64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec*NS_PER_SECOND + ts.tv_nsec;
+}
+
+static void handle_signal(int sig)
+{
+    shutdown_requested = 1;
+}
+
+// Write bytes to the pty, dropping them if the reader has fallen behind
+static void send_bytes(struct emulator *e, const uint8_t *buf, size_t length)
+{
+    ssize_t ret = write(e->master, buf, length);
+    if (ret < 0 && errno != EAGAIN && errno != EIO)
+        perror("write");
+
+    if (ret < (ssize_t)length)
+        e->dropped += ret < 0 ? length : length - ret;
+}
+
+static void send_packet(struct emulator *e, enum packet_type type, const void *data, uint8_t length)
+{
+    uint8_t packet[MAX_PACKET_LENGTH];
+    size_t packet_length = timer_packet_encode(packet, type, data, length);
+
+    if (checksum_error_percent && rand() % 100 < checksum_error_percent)
+    {
+        packet[packet_length - 3] ^= 0xFF;
+        e->checksum_errors++;
+    }
+
+    send_bytes(e, packet, packet_length);
+    e->sent[type]++;
+}
+
+static void send_time(struct emulator *e, enum packet_type type, int64_t time)
+{
+    time_t seconds = time / NS_PER_SECOND;
+    struct tm t;
+    gmtime_r(&seconds, &t);
+
+    uint16_t progress = 0;
+    if (e->period > 0 && time >= e->sequence_start)
+        progress = ((time - e->sequence_start) % e->period) / e->unit;
+
+    struct packet_time packet =
+    {
+        .year = t.tm_year + 1900,
+        .month = t.tm_mon + 1,
+        .day = t.tm_mday,
+        .hours = t.tm_hour,
+        .minutes = t.tm_min,
+        .seconds = t.tm_sec,
+        .milliseconds = (time % NS_PER_SECOND) / NS_PER_MILLISECOND,
+        .flags = TIMESTAMP_LOCKED,
+        .utc_offset = 0,
+        .exposure_progress = progress
+    };
+
+    send_packet(e, type, &packet, sizeof(struct packet_time));
+}
+
+static void send_status(struct emulator *e)
+{
+    struct packet_status status =
+    {
+        .timer = e->period > 0 ? TIMER_EXPOSING : TIMER_IDLE,
+        .gps = GPS_ACTIVE
+    };
+
+    send_packet(e, STATUS, &status, sizeof(struct packet_status));
+}
+
+static void send_message(struct emulator *e, const char *str)
+{
+    struct packet_message message;
+    message.length = strlen(str);
+    if (message.length > sizeof(message.str))
+        message.length = sizeof(message.str);
+    memcpy(message.str, str, message.length);
+
+    send_packet(e, MESSAGE, &message, message.length + 1);
+}
+
+// NMEA-like garbage, with occasional spurious packet headers
+static void send_noise(struct emulator *e)
+{
+    uint8_t noise[NOISE_BURST];
+    size_t length = 1 + rand() % NOISE_BURST;
+    for (size_t i = 0; i < length; i++)
+        noise[i] = rand() % 16 ? ' ' + rand() % 95 : '$';
+
+    send_bytes(e, noise, length);
+    e->noise_bytes += length;
+}
+
+static void received_packet(struct timer_packet *p, void *context)
+{
+    struct emulator *e = context;
+    e->received[(uint8_t)p->type]++;
+
+    switch (p->type)
+    {
+        case START_EXPOSURE:
+        {
+            struct packet_startexposure *start = (struct packet_startexposure *)p->data.bytes;
+            if (p->length != sizeof(struct packet_startexposure) || start->exposure == 0)
+            {
+                printf("Ignoring invalid START_EXPOSURE packet\n");
+                break;
+            }
+
+            e->unit = start->timing_mode == TIME_SECONDS ? NS_PER_SECOND : NS_PER_MILLISECOND;
+            e->period = start->exposure*e->unit;
+            uint8_t stride = start->stride ? start->stride : 1;
+
+            // Aligned sequences start on the next multiple of the exposure time
+            int64_t t = now();
+            e->sequence_start = start->align_first ? (t / e->period + 1)*e->period : t;
+
+            // The hardware sends one trigger per stride exposures
+            e->trigger_period = period_override ? period_override : e->period*stride;
+            e->next_trigger = e->sequence_start + e->trigger_period;
+            e->stop_requested = false;
+
+            printf("Starting %u %s exposures with stride %u%s\n", start->exposure,
+                   start->timing_mode == TIME_SECONDS ? "s" : "ms", stride, start->align_first ? " (aligned)" : "");
+            send_message(e, "Starting exposures");
+            send_status(e);
+            break;
+        }
+        case STOP_EXPOSURE:
+            // Stop after the exposure in progress, like the hardware
+            if (e->period > 0)
+                e->stop_requested = true;
+            else
+                send_packet(e, STOP_EXPOSURE, NULL, 0);
+            printf("Stopping exposures\n");
+            break;
+        default:
+            break;
+    }
+}
+
+static void parser_error(enum timer_parser_error error, struct timer_packet *p, uint8_t got, uint8_t expected, void *context)
+{
+    printf("Discarded malformed packet from puokonui (error %d)\n", error);
+}
+
+static void report(struct emulator *e)
+{
+    printf("Sent %llu timestamps, %llu triggers, %llu status; %llu bad checksums, %llu noise bytes, %llu dropped bytes\n",
+           (unsigned long long)e->sent[TIMESTAMP], (unsigned long long)e->sent[TRIGGER],
+           (unsigned long long)e->sent[STATUS], (unsigned long long)e->checksum_errors,
+           (unsigned long long)e->noise_bytes, (unsigned long long)e->dropped);
+}
+
+static void usage()
+{
+    printf("Usage: timeremu [options]\n");
+    printf("  -l <path>     Create a symlink to the pty at path\n");
+    printf("  -t <hz>       TIMESTAMP packet rate (default 1)\n");
+    printf("  -s <hz>       STATUS packet rate (default 1)\n");
+    printf("  -p <ms>       Send triggers every ms milliseconds, ignoring the requested exposure\n");
+    printf("  -n <hz>       Inject bursts of noise at this rate (default off)\n");
+    printf("  -c <percent>  Corrupt the checksum of this percentage of packets (default 0)\n");
+    printf("  -r <s>        Report statistics every s seconds (default 10)\n");
+}
+
+static int64_t interval_from_rate(const char *arg)
+{
+    double rate = atof(arg);
+    return rate > 0 ? (int64_t)(NS_PER_SECOND / rate) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *link_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "l:t:s:p:n:c:r:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'l': link_path = optarg; break;
+            case 't': timestamp_interval = interval_from_rate(optarg); break;
+            case 's': status_interval = interval_from_rate(optarg); break;
+            case 'p': period_override = (int64_t)(atof(optarg)*NS_PER_MILLISECOND); break;
+            case 'n': noise_interval = interval_from_rate(optarg); break;
+            case 'c': checksum_error_percent = atoi(optarg); break;
+            case 'r': report_interval = atoi(optarg); break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    struct emulator e = {0};
+    e.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (e.master == -1 || grantpt(e.master) == -1 || unlockpt(e.master) == -1)
+    {
+        perror("Failed to open pty");
+        return 1;
+    }
+
+    const char *path = ptsname(e.master);
+
+    // Hold the slave open so that the master doesn't see a hangup
+    // between connections, and use raw mode until the client configures it
+    int slave = open(path, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave == -1 || tcgetattr(slave, &tio) == -1)
+    {
+        perror("Failed to open pty slave");
+        return 1;
+    }
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+
+    if (link_path)
+    {
+        unlink(link_path);
+        if (symlink(path, link_path) == -1)
+        {
+            perror("Failed to create symlink");
+            return 1;
+        }
+    }
+
+    printf("Emulating timer on %s\n", link_path ? link_path : path);
+    fflush(stdout);
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    struct timer_parser parser;
+    timer_parser_init(&parser, received_packet, parser_error, &e);
+
+    int64_t t = now();
+    int64_t next_timestamp = timestamp_interval ? (t / timestamp_interval + 1)*timestamp_interval : INT64_MAX;
+    int64_t next_status = status_interval ? t + status_interval : INT64_MAX;
+    int64_t next_noise = noise_interval ? t + noise_interval : INT64_MAX;
+    int64_t next_report = report_interval > 0 ? t + report_interval*NS_PER_SECOND : INT64_MAX;
+
+    while (!shutdown_requested)
+    {
+        int64_t next_trigger = e.period > 0 ? e.next_trigger : INT64_MAX;
+        int64_t deadline = next_timestamp;
+        if (next_status < deadline) deadline = next_status;
+        if (next_noise < deadline) deadline = next_noise;
+        if (next_report < deadline) deadline = next_report;
+        if (next_trigger < deadline) deadline = next_trigger;
+
+        t = now();
+        int64_t wait = deadline > t ? deadline - t : 0;
+        struct timespec timeout = {.tv_sec = wait / NS_PER_SECOND, .tv_nsec = wait % NS_PER_SECOND};
+        struct pollfd pfd = {.fd = e.master, .events = POLLIN};
+        if (ppoll(&pfd, 1, &timeout, NULL) > 0 && (pfd.revents & POLLIN))
+        {
+            uint8_t buf[256];
+            ssize_t length = read(e.master, buf, sizeof(buf));
+            if (length > 0)
+                timer_parser_parse(&parser, buf, length);
+        }
+
+        t = now();
+        if (t >= next_trigger)
+        {
+            send_time(&e, TRIGGER, next_trigger);
+            e.next_trigger += e.trigger_period;
+            if (e.stop_requested)
+            {
+                e.period = 0;
+                e.stop_requested = false;
+                send_packet(&e, STOP_EXPOSURE, NULL, 0);
+                send_status(&e);
+            }
+        }
+
+        if (t >= next_timestamp)
+        {
+            send_time(&e, TIMESTAMP, next_timestamp);
+            next_timestamp += timestamp_interval;
+        }
+
+        if (t >= next_status)
+        {
+            send_status(&e);
+            next_status += status_interval;
+        }
+
+        if (t >= next_noise)
+        {
+            send_noise(&e);
+            next_noise += noise_interval;
+        }
+
+        if (t >= next_report)
+        {
+            report(&e);
+            fflush(stdout);
+            next_report += report_interval*NS_PER_SECOND;
+        }
+    }
+
+    report(&e);
+    if (link_path)
+        unlink(link_path);
+    close(slave);
+    close(e.master);
+    return 0;
+}